@@ -0,0 +1,56 @@
+/*
+ * clogl-dump: 把BinFile输出方向写的二进制日志还原成文本, 或者按顺序取出FlightRecorder环里的日志
+ *
+ * 用法:
+ *    clogl-dump [-f defFmt|ptidFmt] [-p 0|3|6] 文件...
+ *    -f 日志格式, 默认ptidFmt; -p 时间秒后面的位数, 默认0
+ */
+
+#include "clogl.h"
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-f defFmt|ptidFmt] [-p 0|3|6] file...\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *fmt = "ptidFmt";
+	int opt = 0;
+
+	while ((opt = getopt(argc, argv, "f:p:h")) != -1) {
+		switch (opt) {
+		case 'f':
+			fmt = optarg;
+			break;
+		case 'p':
+			if (cloglSetTimePrecision(atoi(optarg))) {
+				usage(argv[0]);
+				return 2;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return 2;
+		}
+	}
+	if (optind >= argc) {
+		usage(argv[0]);
+		return 2;
+	}
+
+	int rst = 0;
+	for (int i = optind; i < argc; i++) {
+		int bad = cloglDump(argv[i], stdout, fmt);
+		if (bad < 0) {
+			fprintf(stderr, "%s: can't read '%s'\n", argv[0], argv[i]);
+			rst = 1;
+		} else if (bad > 0) {
+			fprintf(stderr, "%s: '%s' %d bad blocks skipped\n", argv[0], argv[i], bad);
+			rst = 1;
+		}
+	}
+	fflush(stdout);
+
+	return rst;
+}
@@ -1,7 +1,7 @@
 /*
  * C语言日志记录
  * 可以多线程, 可以日志分级, 可以设置记录级别, 可以输出到多个方向
- * WARN!!! -> 初始化过程可不是线程安全的. 信号处理的过程也不是线程安全的!!!
+ * WARN!!! -> cloglInit只调一次. cloglNew/cloglGet可以在多个线程里同时调; 同一个日志对象的cloglAddApd和cloglApdSet不要在多个线程里同时调. 信号处理函数里只能用cloglSigLog
  *
  * 作者:
  *    刘恒(liuhengloveyou@gmail.com)
@@ -9,9 +9,29 @@
  *    2011.10.20
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE                   // pthread_getname_np
+#endif
 
 #include "clogl.h"
 
+// 只有实现用得到的, 不放进clogl.h
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <linux/io_uring.h>
+#include <sys/resource.h>
+#include <dirent.h>
+#include <sys/inotify.h>
+#include <poll.h>
+#include <fnmatch.h>
+#include <signal.h>
+#include <execinfo.h>
+#ifdef CLOGL_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
 clogl_t *clogls; // 保存系统中所有的日志对象
 
 /*
@@ -44,34 +64,429 @@ static void cloglErr(const char *msg)
 	return;
 }
 
+void freeMsgBuff(void *msgp);
+
 /*
-  获得线程私有日志缓冲区
+  线程私有的缓冲. 挂在同一个pthread_key上, 线程退出时一起释放. 用__thread的缓冲线程退出时会漏掉
  */
-static clogMsg *getMsgBuff(clogl_t *log)
+typedef struct _clogl_thread_buf
 {
-	clogMsg *msg = (clogMsg *)pthread_getspecific(log->msgp);
-	if (!msg) {
-		msg = (clogMsg *)calloc(1, sizeof(clogMsg));
-		if (!msg) {
+	clogMsg msg;                      // 格式化好的一条日志
+	clogMsg body;                     // JSON格式里printf风格日志格式化好的消息
+	clogMsg pack;                     // 参数记录. 延迟格式化, 二进制输出方向, cloglDump解码都用, 不会同时用
+	clogMsg text;                     // clogLoggerDropped格式化好的消息
+	clogMsg dump;                     // cloglDump按记录还原的消息
+} cloglThreadBuf;
+
+static pthread_key_t cloglMsgKey;
+static pthread_once_t cloglMsgOnce = PTHREAD_ONCE_INIT;
+
+static void cloglMsgInit()
+{
+	(void)pthread_key_create(&cloglMsgKey, freeMsgBuff);
+}
+
+/*
+  获得线程私有的缓冲. 第一次用时分配
+ */
+static cloglThreadBuf *cloglThreadBufs()
+{
+	(void)pthread_once(&cloglMsgOnce, cloglMsgInit);
+	cloglThreadBuf *bufs = (cloglThreadBuf *)pthread_getspecific(cloglMsgKey);
+	if (!bufs) {
+		bufs = (cloglThreadBuf *)calloc(1, sizeof(cloglThreadBuf));
+		if (!bufs) {
 			return NULL;
 		}
-		if (pthread_setspecific(log->msgp, msg)) {
+		if (pthread_setspecific(cloglMsgKey, bufs)) {
+			free(bufs);
 			return NULL;
 		}
 	}
 
-	return msg;
+	return bufs;
+}
+
+/*
+  获得线程私有日志缓冲区. 一个线程同时只格式化一条日志, 所有日志对象共用一个,
+  日志对象再多也不占pthread_key
+ */
+static clogMsg *getMsgBuff(clogl_t *log)
+{
+	log = log;
+
+	cloglThreadBuf *bufs = cloglThreadBufs();
+
+	return bufs ? &bufs->msg : NULL;
+}
+
+/*
+  正在格式化的一条日志的上下文. 延迟格式化时, 时间和线程号是调用线程记下的
+ */
+typedef struct _clogl_rec
+{
+	const cloglSite *site;        // 调用处. 直接调clogLogger时为NULL
+	struct timespec ts;           // 日志时间. 0表示取当前时间
+	pid_t pid;                    // 进程ID. 0表示当前进程
+	pid_t tid;                    // 线程ID. 0表示当前线程
+	char ids[40];                 // 格式化好的" <pid tid>". 空表示取当前线程的
+	int binDone;                  // 已经交给二进制输出方向了, 它们不再要格式化好的
+	int level;                    // 日志级别
+	const cloglField *fields;     // 结构化日志的字段. 非NULL时格式串是消息本身, 没有参数
+	int nfields;                  // 字段个数
+} cloglRec;
+
+static __thread const cloglRec *cloglCur; // 当前线程正在格式化的日志
+static __thread int cloglHeadLen;         // 刚格式化好的日志开头的时间和pid tid的长度. 合并重复日志时不比
+static __thread clogl_t *cloglOutLog;     // 正在输出的日志属于的日志对象
+static __thread int cloglForce;           // 正在输出cloglSiteSet打开了的调用处的日志, 不看级别
+static __thread int cloglIsWriter;        // 是异步写线程
+
+static const char *cloglLevelTag[CLOGL_LEVEL_UNKNOWN] = {"DATA", "ERROR", "WARN", "INFO", "DEBUG"};
+
+/*
+  各线程缓存的进程号, 线程号和格式化好的" <pid tid>". fork后由cloglForkGen作废
+ */
+typedef struct _clogl_ids
+{
+	unsigned int gen;             // 缓存时的cloglForkGen
+	pid_t pid;                    // 进程ID
+	pid_t tid;                    // 线程ID
+	int len;                      // str长度
+	char str[40];                 // " <%5d %5d>" 或 " <%5d %5d name>"
+} cloglIds;
+
+static __thread cloglIds cloglIdCache;
+static unsigned int cloglForkGen = 1;   // fork或设置变化时加1
+static int cloglIdName;                 // 是否带线程名
+static pthread_once_t cloglIdOnce = PTHREAD_ONCE_INIT;
+
+/*
+  fork出的子进程里pid和线程号都变了
+ */
+static void cloglIdAtfork()
+{
+	__atomic_add_fetch(&cloglForkGen, 1, __ATOMIC_RELAXED);
+}
+
+static void cloglIdInit()
+{
+	(void)pthread_atfork(NULL, NULL, cloglIdAtfork);
+}
+
+/*
+  当前线程的ID缓存. 只在第一次和fork后进内核
+ */
+static const cloglIds *cloglSelf()
+{
+	cloglIds *ids = &cloglIdCache;
+	unsigned int gen = __atomic_load_n(&cloglForkGen, __ATOMIC_RELAXED);
+	if (__builtin_expect(ids->gen == gen, 1)) {
+		return ids;
+	}
+
+	(void)pthread_once(&cloglIdOnce, cloglIdInit);
+
+	ids->pid = getpid();
+	ids->tid = (pid_t)syscall(__NR_gettid);
+
+	char name[16] = {0,};
+	if (!cloglIdName || pthread_getname_np(pthread_self(), name, sizeof(name))) {
+		name[0] = 0;
+	}
+	int n = 0;
+	if (name[0]) {
+		n = snprintf(ids->str, sizeof(ids->str), " <%5d %5d %s>", ids->pid, ids->tid, name);
+	} else {
+		n = snprintf(ids->str, sizeof(ids->str), " <%5d %5d>", ids->pid, ids->tid);
+	}
+	ids->len = (n < 0) ? 0 : (((size_t)n >= sizeof(ids->str)) ? (int)sizeof(ids->str) - 1 : n);
+	ids->gen = gen;
+
+	return ids;
+}
+
+static inline pid_t cloglTid()
+{
+	return cloglSelf()->tid;
+}
+
+/*
+  日志时间的秒部分("%Y-%m-%d %X")缓存. 每秒只格式化一次, 各线程共享. 用顺序锁保护
+ */
+static struct
+{
+	unsigned int seq;             // 奇数表示正在更新
+	time_t sec;                   // str对应的秒
+	char str[20];                 // 格式化好的时间
+} cloglTsCache;
+
+static int cloglTsDigits; // 秒后面的位数: 0, 3(毫秒), 6(微秒)
+static long cloglGmtOff;  // 最近一次localtime_r得到的时区偏移秒数. 信号处理函数里不能调localtime_r, 用它算本地时间
+static int cloglTsFine;   // 有布局要秒的小数, 不能用粗粒度时钟
+
+/*
+  当前日志的时间. 延迟格式化时是调用线程记下的
+ */
+static inline void cloglRecTs(struct timespec *ts)
+{
+	if (cloglCur && cloglCur->ts.tv_sec) {
+		*ts = cloglCur->ts;
+		return;
+	}
+
+	// 秒精度用粗粒度时钟就够了, 都走vDSO, 不进内核
+	clock_gettime((cloglTsDigits || cloglTsFine) ? CLOCK_REALTIME : CLOCK_REALTIME_COARSE, ts);
+}
+
+/*
+  sec对应的"%Y-%m-%d %X", 写19个字节到out
+ */
+static void cloglSecStr(time_t sec, char *out)
+{
+	unsigned int s1 = __atomic_load_n(&cloglTsCache.seq, __ATOMIC_ACQUIRE);
+	if (!(s1 & 1) && cloglTsCache.sec == sec) {
+		memcpy(out, cloglTsCache.str, 19);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&cloglTsCache.seq, __ATOMIC_RELAXED) == s1) {
+			return;
+		}
+	}
+
+	char tb[32] = {0,};
+	struct tm tm;
+	localtime_r(&sec, &tm);
+	__atomic_store_n(&cloglGmtOff, tm.tm_gmtoff, __ATOMIC_RELAXED);
+	strftime(tb, 20, "%Y-%m-%d %X", &tm);
+	memcpy(out, tb, 19);
+
+	// 只往前更新缓存. 有人正在更新就不管了
+	if (!(s1 & 1) && sec > cloglTsCache.sec
+	    && __atomic_compare_exchange_n(&cloglTsCache.seq, &s1, s1 + 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		cloglTsCache.sec = sec;
+		memcpy(cloglTsCache.str, tb, 20);
+		__atomic_store_n(&cloglTsCache.seq, s1 + 2, __ATOMIC_RELEASE);
+	}
+}
+
+/*
+  格式化当前日志的时间到buf, 至少要有32字节. 返回长度
+ */
+static int cloglTimeStr(char *buf)
+{
+	struct timespec ts;
+	cloglRecTs(&ts);
+	cloglSecStr(ts.tv_sec, buf);
+
+	int digits = cloglTsDigits;
+	if (!digits) {
+		buf[19] = 0;
+		return 19;
+	}
+
+	long frac = ts.tv_nsec / ((3 == digits) ? 1000000L : 1000L);
+	buf[19] = '.';
+	for (int i = digits; i > 0; i--) {
+		buf[19 + i] = '0' + frac % 10;
+		frac /= 10;
+	}
+	buf[20 + digits] = 0;
+
+	return 20 + digits;
+}
+
+/*
+  CLOGL_*宏的日志前缀: 级别和代码位置. 返回写入长度
+ */
+static int cloglSitePrefix(char *buf, size_t size)
+{
+	const cloglSite *site = cloglCur ? cloglCur->site : NULL;
+	if (!site || site->level < 0 || site->level >= CLOGL_LEVEL_UNKNOWN) {
+		buf[0] = 0;
+		return 0;
+	}
+
+	int n = 0;
+	if (CLOGL_LEVEL_DATA == site->level) {
+		n = snprintf(buf, size, "[DATA] ");
+	} else {
+#if defined (CLOGL_SRC_INFO)
+		n = snprintf(buf, size, "[%s] <%s %d %s> ", cloglLevelTag[site->level], site->file, site->line, site->func);
+#else
+		n = snprintf(buf, size, "[%s] <%d %s> ", cloglLevelTag[site->level], site->line, site->func);
+#endif
+	}
+	if (n < 0) {
+		n = 0;
+	} else if ((size_t)n >= size) {
+		n = size - 1;
+	}
+
+	return n;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
 
+static int cloglGrow(clogMsg *buff, size_t size);
+static int cloglPut(clogMsg *buff, size_t *pos, const void *bytes, size_t n);
+
+/* 结构化日志 >>> */
+/*
+  十进制整数追加到buff
+ */
+static int cloglPutInt(clogMsg *buff, size_t *pos, int64_t v)
+{
+	char b[24];
+	char *p = b + sizeof(b);
+	uint64_t u = (v < 0) ? 0 - (uint64_t)v : (uint64_t)v;
+	do {
+		*--p = '0' + u % 10;
+		u /= 10;
+	} while (u);
+	if (v < 0) {
+		*--p = '-';
+	}
+
+	return cloglPut(buff, pos, p, b + sizeof(b) - p);
+}
+
+/*
+  double追加到buff. 整数值直接转, 其他的用能原样读回的最短%g. NaN和无穷输出null
+ */
+static int cloglPutDouble(clogMsg *buff, size_t *pos, double v)
+{
+	if (!__builtin_isfinite(v)) {
+		return cloglPut(buff, pos, "null", 4);
+	}
+	if (v > -1e15 && v < 1e15 && v == (double)(int64_t)v) {
+		return cloglPutInt(buff, pos, (int64_t)v);
+	}
+
+	char b[32];
+	int n = snprintf(b, sizeof(b), "%.15g", v);
+	if (strtod(b, NULL) != v) {
+		n = snprintf(b, sizeof(b), "%.17g", v);
+	}
+
+	return cloglPut(buff, pos, b, n);
+}
+
+/*
+  JSON字符串追加到buff: 加引号, 转义引号, 反斜杠和控制字符. NULL输出null
+ */
+static int cloglPutJsonStr(clogMsg *buff, size_t *pos, const char *s)
+{
+	static const char hex[] = "0123456789abcdef";
+
+	if (!s) {
+		return cloglPut(buff, pos, "null", 4);
+	}
+	if (cloglPut(buff, pos, "\"", 1)) {
+		return -1;
+	}
+
+	const char *run = s; // 还没拷的不用转义的一段
+	for (; *s; s++) {
+		unsigned char c = (unsigned char)*s;
+		if (c >= 0x20 && c != '"' && c != '\\') {
+			continue;
+		}
+		if (s > run && cloglPut(buff, pos, run, s - run)) {
+			return -1;
+		}
+		char esc[6] = {'\\', 0, 0, 0, 0, 0};
+		int n = 2;
+		switch (c) {
+		case '"':  esc[1] = '"'; break;
+		case '\\': esc[1] = '\\'; break;
+		case '\n': esc[1] = 'n'; break;
+		case '\r': esc[1] = 'r'; break;
+		case '\t': esc[1] = 't'; break;
+		case '\b': esc[1] = 'b'; break;
+		case '\f': esc[1] = 'f'; break;
+		default:
+			esc[1] = 'u';
+			esc[2] = '0';
+			esc[3] = '0';
+			esc[4] = hex[c >> 4];
+			esc[5] = hex[c & 15];
+			n = 6;
+			break;
+		}
+		if (cloglPut(buff, pos, esc, n)) {
+			return -1;
+		}
+		run = s + 1;
+	}
+	if (s > run && cloglPut(buff, pos, run, s - run)) {
+		return -1;
+	}
+
+	return cloglPut(buff, pos, "\"", 1);
+}
+
+/*
+  一个字段的值追加到buff. json为0时字符串不加引号
+ */
+static int cloglPutField(clogMsg *buff, size_t *pos, const cloglField *f, int json)
+{
+	switch (f->type) {
+	case CLOGL_FIELD_INT:
+		return cloglPutInt(buff, pos, f->v.i);
+	case CLOGL_FIELD_DOUBLE:
+		return cloglPutDouble(buff, pos, f->v.d);
+	case CLOGL_FIELD_STR:
+		if (json) {
+			return cloglPutJsonStr(buff, pos, f->v.s);
+		}
+		return f->v.s ? cloglPut(buff, pos, f->v.s, strlen(f->v.s)) : cloglPut(buff, pos, "(null)", 6);
+	case CLOGL_FIELD_BOOL:
+		return f->v.b ? cloglPut(buff, pos, "true", 4) : cloglPut(buff, pos, "false", 5);
+	default:
+		return cloglPut(buff, pos, "null", 4);
+	}
+}
+
+/*
+  结构化日志给文本格式用的样子: 前缀, 消息, 再加上" key=value". 写在buff的*pos处, 后面补0
+ */
+static int cloglKVText(clogMsg *buff, size_t *pos, const char *prefix, int plen, const char *msg)
+{
+	int rst = cloglPut(buff, pos, prefix, plen);
+	rst |= cloglPut(buff, pos, msg, strlen(msg));
+	for (int i = 0; i < cloglCur->nfields; i++) {
+		const cloglField *f = &cloglCur->fields[i];
+		const char *key = f->key ? f->key : "";
+		rst |= cloglPut(buff, pos, " ", 1);
+		rst |= cloglPut(buff, pos, key, strlen(key));
+		rst |= cloglPut(buff, pos, "=", 1);
+		rst |= cloglPutField(buff, pos, f, 0);
+	}
+	rst |= cloglPut(buff, pos, "", 0);
+	if (rst) {
+		return -1;
+	}
+	buff->msgBuff[*pos] = 0;
+
+	return 0;
+}
+/* 结构化日志 <<< */
+
 /*
   clogl基本日志格式化. 每个格式都要先经它处理
   buf: 日志信息缓存; begin:缓存开头长度;
  */
 static int cloglBaseFmt(clogMsg **buff, size_t begin, const char *fmt, va_list args)
 {
+	char prefix[512];
+	int plen = cloglSitePrefix(prefix, sizeof(prefix));
+
+	if (cloglCur && cloglCur->fields) {
+		return cloglKVText(*buff, &begin, prefix, plen, fmt);
+	}
+
 	clogMsg *buffp = *buff;
 	if (!buffp) {
 		return -1;
@@ -89,8 +504,22 @@ static int cloglBaseFmt(clogMsg **buff, size_t begin, const char *fmt, va_list a
 	}
 
 	while (1) {		
-		char *msg = buffp->msgBuff + begin;
-		int len = buffp->msgSize - begin;
+		if (buffp->msgSize < begin + plen + 64) {
+			buffp->msgSize = begin + plen + 1024;
+			char *nf = (char *)realloc(buffp->msgBuff, buffp->msgSize);
+			if (!nf) {
+				cloglErr("cloglBaseFmt realloc error...");
+				free(buffp->msgBuff);
+				buffp->msgBuff = NULL;
+				buffp->msgSize = 0;
+				return -1;
+			}
+			buffp->msgBuff = nf;
+		}
+		memcpy(buffp->msgBuff + begin, prefix, plen);
+
+		char *msg = buffp->msgBuff + begin + plen;
+		int len = buffp->msgSize - begin - plen;
 
 		va_list vl;
 		va_copy(vl, args);
@@ -106,7 +535,7 @@ static int cloglBaseFmt(clogMsg **buff, size_t begin, const char *fmt, va_list a
 		}
 
 		if (n >= len)
-			buffp->msgSize = n + begin + 64;
+			buffp->msgSize = n + begin + plen + 64;
 
 		char *nf = (char *)realloc(buffp->msgBuff, buffp->msgSize);
 		if (!nf) {
@@ -134,17 +563,17 @@ static char *cloglDefFmt(clogl_t *log, const char *format, va_list args)
 		return NULL;
 	}
 
-	int rst = cloglBaseFmt(&msg, 20, format, args);
+	char tb[32];
+	int tlen = cloglTimeStr(tb);
+
+	int rst = cloglBaseFmt(&msg, tlen + 1, format, args);
 	if (rst) {
 		return NULL;
 	}
 
-	time_t clock = {0,};
-	struct tm *tm = NULL;
-	time(&clock);
-	tm = localtime(&clock);
-	strftime(msg->msgBuff, 20, "%Y-%m-%d %X", tm);
-	msg->msgBuff[19] = ' ';
+	memcpy(msg->msgBuff, tb, tlen);
+	msg->msgBuff[tlen] = ' ';
+	cloglHeadLen = tlen + 1;
 
 	return msg->msgBuff;
 }
@@ -161,852 +590,7687 @@ static char *cloglIDFmt(clogl_t *log, const char *format, va_list args)
 		return NULL;
 	}
 
-	int rst = cloglBaseFmt(&msg, 34, format, args);
+	// 日志前面的时间
+	char tb[32];
+	int tlen = cloglTimeStr(tb);
+
+	// pid tid. 延迟格式化时用调用线程记下的
+	const char *ids = NULL;
+	int ilen = 0;
+	if (cloglCur && cloglCur->ids[0]) {
+		ids = cloglCur->ids;
+		ilen = strlen(ids);
+	} else {
+		const cloglIds *self = cloglSelf();
+		ids = self->str;
+		ilen = self->len;
+	}
+
+	int rst = cloglBaseFmt(&msg, tlen + ilen + 1, format, args);
 	if (rst) {
 		return NULL;
 	}
 
-	// 日志前面的时间
-	time_t clock = {0,};
-	struct tm *tm = NULL;
-	time(&clock);
-	tm = localtime(&clock);
-	strftime(msg->msgBuff, 20, "%Y-%m-%d %X", tm);
-
-	// pid tid
-	snprintf(msg->msgBuff+19, 15, " <%5d %5d>", getpid(), (int)syscall(__NR_gettid));
-	msg->msgBuff[33] = ' ';
+	memcpy(msg->msgBuff, tb, tlen);
+	memcpy(msg->msgBuff + tlen, ids, ilen);
+	msg->msgBuff[tlen + ilen] = ' ';
+	cloglHeadLen = tlen + ilen + 1;
 
 	return msg->msgBuff;
 }
-/* 系统中所有日志格式 */
-static cloglFmt cloglFmts[3] = {
-	{(char*)"defFmt", cloglDefFmt},
-	{(char*)"ptidFmt", cloglIDFmt},
-	{NULL, NULL}
-};
 
 /*
- * 功能:
- *    跟据传的名字, 返回一个日志格式对象
- * 入参:
- *    name: 日志格式名
- * 出参:
- *    NO
- * 返回值:
- *    成功返回日志格式对象指针, 出错返回 NULL
+ *  JSON格式. 一条日志一行JSON, 直接写进线程的日志缓冲区. 结构化日志的消息和字段都不经过vsnprintf
  */
-static cloglFmt* cloglGetFmt(const char *name)
+static char *cloglJsonFmt(clogl_t *log, const char *format, va_list args)
 {
-	if (!name || !name[0])
+	log = log;
+
+	// 取日志缓冲区
+	cloglThreadBuf *bufs = cloglThreadBufs();
+	if (!bufs) {
+		cloglErr("cloglJsonFmt getMsgBuff null");
 		return NULL;
+	}
+	clogMsg *msg = &bufs->msg;
+	clogMsg *body = &bufs->body; // printf风格日志格式化好的消息
+
+	const cloglRec *rec = cloglCur;
+	const char *text = format;
+	if (!rec || !rec->fields) {
+		while (1) {
+			va_list vl;
+			va_copy(vl, args);
+			int n = vsnprintf(body->msgBuff, body->msgSize, format, vl);
+			va_end(vl);
+			if (n < 0) {
+				return NULL;
+			}
+			if (n > CLOGL_MSG_MAX) { //* 日志信息超长
+				text = "LOG TOO LONG";
+				break;
+			}
+			if ((size_t)n < body->msgSize) {
+				text = body->msgBuff;
+				break;
+			}
+			if (cloglGrow(body, n + 1)) {
+				return NULL;
+			}
+		}
+	}
 
-	cloglFmt *tmpFmt = &cloglFmts[0];
+	char tb[32];
+	int tlen = cloglTimeStr(tb);
 
-	while (tmpFmt) {
-		if (!strcmp(name, tmpFmt->name)) {
-			return tmpFmt;
-		}
-		tmpFmt ++;
+	// pid tid. 延迟格式化时用调用线程记下的
+	pid_t pid = 0, tid = 0;
+	if (rec && rec->pid) {
+		pid = rec->pid;
+		tid = rec->tid;
+	} else {
+		const cloglIds *self = cloglSelf();
+		pid = self->pid;
+		tid = self->tid;
 	}
 
-	return NULL;
-}
+	size_t pos = 0;
+	int rst = cloglPut(msg, &pos, "{\"time\":\"", 9);
+	rst |= cloglPut(msg, &pos, tb, tlen);
+	rst |= cloglPut(msg, &pos, "\"", 1);
+	if (rec && rec->level >= 0 && rec->level < CLOGL_LEVEL_UNKNOWN) {
+		rst |= cloglPut(msg, &pos, ",\"level\":\"", 10);
+		rst |= cloglPut(msg, &pos, cloglLevelTag[rec->level], strlen(cloglLevelTag[rec->level]));
+		rst |= cloglPut(msg, &pos, "\"", 1);
+	}
+	rst |= cloglPut(msg, &pos, ",\"pid\":", 7);
+	rst |= cloglPutInt(msg, &pos, pid);
+	rst |= cloglPut(msg, &pos, ",\"tid\":", 7);
+	rst |= cloglPutInt(msg, &pos, tid);
+	if (rec && rec->site) {
+		rst |= cloglPut(msg, &pos, ",\"file\":", 8);
+		rst |= cloglPutJsonStr(msg, &pos, rec->site->file);
+		rst |= cloglPut(msg, &pos, ",\"line\":", 8);
+		rst |= cloglPutInt(msg, &pos, rec->site->line);
+		rst |= cloglPut(msg, &pos, ",\"func\":", 8);
+		rst |= cloglPutJsonStr(msg, &pos, rec->site->func);
+	}
+	rst |= cloglPut(msg, &pos, ",\"msg\":", 7);
+	rst |= cloglPutJsonStr(msg, &pos, text);
+	for (int i = 0; rec && i < rec->nfields; i++) {
+		rst |= cloglPut(msg, &pos, ",", 1);
+		rst |= cloglPutJsonStr(msg, &pos, rec->fields[i].key ? rec->fields[i].key : "");
+		rst |= cloglPut(msg, &pos, ":", 1);
+		rst |= cloglPutField(msg, &pos, &rec->fields[i], 1);
+	}
+	rst |= cloglPut(msg, &pos, "}", 1);
+	if (rst) {
+		return NULL;
+	}
+	msg->msgBuff[pos] = 0; // cloglPut多留了一个字节
 
-////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////
+	return msg->msgBuff;
+}
 
+/* 布局 >>> */
 /*
-  功能:
-     打开一个输出方向
-  入参:
-     apd: 一个输出方向结构
+  布局串在cloglAddLayout时编译成一组操作, 写日志时按顺序执行, 不再解析
  */
-static inline int cloglApdOpen(cloglApd *apd)
-{
-    if (!apd)
-	return -1;
-
-    if (!apd->apdType)
-	return -1;
-       
-    if (!apd->apdType->open)
-	return 0;
+#define CLOGL_OP_TEXT         'S'                 // 字面量
+#define CLOGL_TS_MARK         '\001'              // 时间格式里秒的小数的位置, 后面跟位数
+#define CLOGL_TS_MAX          128                 // %d{}的strftime结果最多这么多字节, 包括结尾的0
+#define CLOGL_TS_CACHE        4                   // 每个线程缓存几个%d{}的strftime结果. 按操作的地址分
 
-    return apd->apdType->open(apd);
+typedef struct _clogl_op
+{
+	char code;                        // CLOGL_OP_TEXT 或布局里的转换字符
+	char left;                        // 左对齐
+	int minW;                         // 最小宽度, 不够补空格. 0 不补
+	int maxW;                         // 最大宽度, 超过截掉. 0 不截
+	const char *str;                  // 字面量, 或%d{}里的strftime格式. 在layout->text里
+	size_t len;                       // str长度
+} cloglOp;
+
+typedef struct _clogl_layout
+{
+	cloglFmt fmt;                     // 给cloglGetFmt找的格式
+	cloglOp *ops;                     // 操作
+	int nops;                         // 操作个数
+	char *text;                       // 字面量和时间格式
+	char *pattern;                    // 布局串原文. 重新加载配置时比较用
+	struct _clogl_layout *next;
+} cloglLayout;
+
+static cloglLayout *cloglLayouts; // 所有编译好的布局. 只加不删, 同名的新的在前面
+static pthread_mutex_t cloglLayoutLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void cloglLayoutFree(cloglLayout *lay)
+{
+	if (lay) {
+		free(lay->fmt.name);
+		free(lay->ops);
+		free(lay->text);
+		free(lay->pattern);
+		free(lay);
+	}
 }
 
 /*
- 功能:
-    关闭一个输出方向
- 入参:
-    apd: 一个输出方向结构
+  编译布局串. 不认识的转换返回NULL
  */
-static inline int cloglApdClose(cloglApd *apd)
+static cloglLayout *cloglLayoutCompile(const char *pattern)
 {
-    if (!apd)
-	return -1;
-
-    if (!apd->apdType)
-	return -1;
-       
-    if (!apd->apdType->close)
-	return 0;
+	size_t plen = strlen(pattern);
+	cloglLayout *lay = (cloglLayout *)calloc(1, sizeof(cloglLayout));
+	if (!lay) {
+		return NULL;
+	}
+	// 每个字符最多一个操作; 字面量和时间格式都不比原串长, 每段多一个结尾的0
+	lay->ops = (cloglOp *)calloc(plen + 1, sizeof(cloglOp));
+	lay->text = (char *)malloc(2 * plen + 2);
+	if (!lay->ops || !lay->text) {
+		cloglLayoutFree(lay);
+		return NULL;
+	}
 
-    return apd->apdType->close(apd);
-}
+	char *t = lay->text;
+	const char *p = pattern;
+	while (*p) {
+		cloglOp *op = &lay->ops[lay->nops];
+
+		// 字面量. %%也算, 和前后的并成一段
+		if ('%' != *p || '%' == p[1]) {
+			cloglOp *last = lay->nops ? op - 1 : NULL;
+			if (!last || CLOGL_OP_TEXT != last->code) {
+				op->code = CLOGL_OP_TEXT;
+				op->str = t;
+				lay->nops ++;
+				last = op;
+			}
+			*t++ = *p;
+			last->len ++;
+			p += ('%' == *p) ? 2 : 1;
+			continue;
+		}
 
+		p ++;
+		if ('-' == *p) {
+			op->left = 1;
+			p ++;
+		}
+		while (*p >= '0' && *p <= '9')
+			op->minW = op->minW * 10 + (*p++ - '0');
+		if ('.' == *p) {
+			p ++;
+			while (*p >= '0' && *p <= '9')
+				op->maxW = op->maxW * 10 + (*p++ - '0');
+		}
 
-/* 终端输出方向 >>> */
-static int term_open(cloglApd *apd)
-{
-	apd = apd;
-	return 0;
-}
-static int term_close(cloglApd *apd)
-{
-	apd = apd;
-	return 0;
-}
-static int term_append(cloglApd *apd, const char *msg)
-{
-	apd = apd;
-	fprintf(stderr, "%s\n", msg);
-	return 0;
+		op->code = *p++;
+		switch (op->code) {
+		case 'd':
+			if ('{' != *p) {
+				break; // 默认时间格式, 用cloglTimeStr
+			}
+			p ++;
+			op->str = t;
+			while (*p && '}' != *p) {
+				// %ms %us %ns 是秒的小数, 别的交给strftime
+				if ('%' == p[0] && p[1] && 's' == p[2] && strchr("mun", p[1])) {
+					*t++ = CLOGL_TS_MARK;
+					*t++ = ('m' == p[1]) ? '3' : (('u' == p[1]) ? '6' : '9');
+					p += 3;
+					cloglTsFine = 1;
+				} else if ('%' == p[0] && p[1]) {
+					*t++ = *p++;
+					*t++ = *p++;
+				} else {
+					*t++ = *p++;
+				}
+			}
+			if ('}' != *p) {
+				cloglLayoutFree(lay);
+				return NULL;
+			}
+			p ++;
+			op->len = t - op->str;
+			*t++ = 0;
+			if (op->len) {
+				// 拿名字长的月份和星期试一下, 写日志时放不下就什么也不输出了
+				char buf[CLOGL_TS_MAX];
+				struct tm tm;
+				time_t sample = 970056000; // 2000-09-27 星期三
+				localtime_r(&sample, &tm);
+				if (0 == strftime(buf, sizeof(buf), op->str, &tm)) {
+					cloglLayoutFree(lay);
+					return NULL;
+				}
+			}
+			break;
+		case 'p': case 'P': case 't': case 'c': case 'F': case 'L': case 'M': case 'm':
+			break;
+		default:
+			cloglLayoutFree(lay);
+			return NULL;
+		}
+		lay->nops ++;
+	}
+
+	return lay;
 }
-/* 终端输出方向 <<<*/
 
-/* 按时间产生新的日志文件. 单位小时 >>>*/
-static int timeFile_open(cloglApd *apd)
+/*
+  按op的宽度补空格或截断[start, *pos)
+ */
+static int cloglLayoutPad(clogMsg *buff, size_t start, size_t *pos, const cloglOp *op)
 {
-	cloglTimeFileOpt *opt = (cloglTimeFileOpt *)apd->opt;
-	if (!opt) {
-		return -1;
+	size_t len = *pos - start;
+	if (op->maxW && len > (size_t)op->maxW) {
+		len = op->maxW;
+		*pos = start + len;
 	}
-	if (!opt->fileName || !opt->fileName[0]) {
-		return -1;
+	if (len >= (size_t)op->minW) {
+		return 0;
 	}
 
-	opt->fp = fopen(opt->fileName, "a");
-	if (!opt->fp) {
+	size_t pad = op->minW - len;
+	if (cloglGrow(buff, *pos + pad + 1)) {
 		return -1;
 	}
-
-	opt->now = time(NULL); // 打开时间
-	apd->isOpen = 1;
+	char *s = buff->msgBuff + start;
+	if (op->left) {
+		memset(s + len, ' ', pad);
+	} else {
+		memmove(s + pad, s, len);
+		memset(s, ' ', pad);
+	}
+	*pos += pad;
 
 	return 0;
 }
-static int timeFile_close(cloglApd *apd)
+
+/*
+  %d{}的strftime结果缓存. 每个线程按秒缓存, 秒的小数每条现填
+ */
+typedef struct _clogl_layout_ts
 {
-	cloglTimeFileOpt *opt = (cloglTimeFileOpt *)apd->opt;
-	if (!opt) {
-		return -1;
+	const cloglOp *op;                // 缓存的是哪个操作的
+	time_t sec;                       // 哪一秒
+	size_t len;                       // str长度
+	char str[CLOGL_TS_MAX];           // strftime的结果, 秒的小数还是标记
+} cloglLayoutTs;
+
+/*
+  %d{}: 缓存按操作分几格, 几个输出方向用不同的时间格式时不会每条都互相挤掉
+ */
+static int cloglLayoutTime(clogMsg *buff, size_t *pos, const cloglOp *op)
+{
+	static __thread cloglLayoutTs caches[CLOGL_TS_CACHE];
+
+	struct timespec ts;
+	cloglRecTs(&ts);
+	cloglLayoutTs *cache = &caches[((uintptr_t)op / sizeof(cloglOp)) % CLOGL_TS_CACHE];
+	if (cache->op != op || cache->sec != ts.tv_sec) {
+		struct tm tm;
+		localtime_r(&ts.tv_sec, &tm);
+		cache->len = strftime(cache->str, sizeof(cache->str), op->str, &tm);
+		cache->op = op;
+		cache->sec = ts.tv_sec;
 	}
 
- 	if (opt->fp) {
- 		if (fclose(opt->fp)) {
+	const char *s = cache->str;
+	const char *e = s + cache->len;
+	while (s < e) {
+		const char *m = (const char *)memchr(s, CLOGL_TS_MARK, e - s);
+		if (!m || m + 1 >= e) {
+			return cloglPut(buff, pos, s, e - s);
+		}
+		if (m > s && cloglPut(buff, pos, s, m - s)) {
 			return -1;
 		}
- 		opt->fp = NULL;
-		apd->isOpen = 0;
- 	}
+		int digits = m[1] - '0';
+		char frac[9];
+		long v = ts.tv_nsec;
+		for (int i = 9; i > digits; i--)
+			v /= 10;
+		for (int i = digits - 1; i >= 0; i--) {
+			frac[i] = '0' + v % 10;
+			v /= 10;
+		}
+		if (cloglPut(buff, pos, frac, digits)) {
+			return -1;
+		}
+		s = m + 2;
+	}
 
 	return 0;
 }
 
-static int timeFile_append(cloglApd *apd, const char *msg)
+/*
+  日志信息: printf风格的就地vsnprintf进buff, 结构化日志是消息加字段
+ */
+static int cloglLayoutMsg(clogMsg *buff, size_t *pos, const char *format, va_list args)
 {
-	if (!msg) {
-		return -1;
+	if (cloglCur && cloglCur->fields) {
+		return cloglKVText(buff, pos, "", 0, format);
 	}
 
-	cloglTimeFileOpt *opt = (cloglTimeFileOpt *)apd->opt;
-	if (!opt) {
-		return -1;
+	while (1) {
+		size_t room = (buff->msgSize > *pos) ? buff->msgSize - *pos : 0;
+		va_list vl;
+		va_copy(vl, args);
+		int n = vsnprintf(room ? buff->msgBuff + *pos : NULL, room, format, vl);
+		va_end(vl);
+		if (n < 0) {
+			return -1;
+		}
+		if (n > CLOGL_MSG_MAX) { //* 日志信息超长
+			return cloglPut(buff, pos, "LOG TOO LONG", 12);
+		}
+		if ((size_t)n < room) {
+			*pos += n;
+			return 0;
+		}
+		if (cloglGrow(buff, *pos + n + 1)) {
+			return -1;
+		}
 	}
+}
 
-	if (!opt->fp) {
-		return -1;
+/*
+  按编译好的布局格式化一条日志到线程的日志缓冲区
+ */
+static char *cloglLayoutRun(const cloglLayout *lay, clogl_t *log, const char *format, va_list args)
+{
+	clogMsg *msg = getMsgBuff(log);
+	if (!msg) {
+		cloglErr("cloglLayoutRun getMsgBuff null");
+		return NULL;
+	}
+
+	const cloglRec *rec = cloglCur;
+	const cloglSite *site = rec ? rec->site : NULL;
+	size_t pos = 0;
+	int rst = 0;
+	for (int i = 0; i < lay->nops && !rst; i++) {
+		const cloglOp *op = &lay->ops[i];
+		size_t start = pos;
+		switch (op->code) {
+		case CLOGL_OP_TEXT:
+			rst = cloglPut(msg, &pos, op->str, op->len);
+			break;
+		case 'd':
+			if (op->str) {
+				rst = cloglLayoutTime(msg, &pos, op);
+			} else {
+				char tb[32];
+				int tlen = cloglTimeStr(tb);
+				rst = cloglPut(msg, &pos, tb, tlen);
+			}
+			break;
+		case 'p':
+			if (rec && rec->level >= 0 && rec->level < CLOGL_LEVEL_UNKNOWN) {
+				rst = cloglPut(msg, &pos, cloglLevelTag[rec->level], strlen(cloglLevelTag[rec->level]));
+			}
+			break;
+		case 'P':
+			rst = cloglPutInt(msg, &pos, (rec && rec->pid) ? rec->pid : cloglSelf()->pid);
+			break;
+		case 't':
+			rst = cloglPutInt(msg, &pos, (rec && rec->pid) ? rec->tid : cloglSelf()->tid);
+			break;
+		case 'c':
+			rst = cloglPut(msg, &pos, log->name, strlen(log->name));
+			break;
+		case 'F':
+			if (site && site->file) {
+				rst = cloglPut(msg, &pos, site->file, strlen(site->file));
+			}
+			break;
+		case 'L':
+			if (site) {
+				rst = cloglPutInt(msg, &pos, site->line);
+			}
+			break;
+		case 'M':
+			if (site && site->func) {
+				rst = cloglPut(msg, &pos, site->func, strlen(site->func));
+			}
+			break;
+		case 'm':
+			rst = cloglLayoutMsg(msg, &pos, format, args);
+			break;
+		}
+		if (!rst && (op->minW || op->maxW)) {
+			rst = cloglLayoutPad(msg, start, &pos, op);
+		}
 	}
-	fprintf(opt->fp, "%s\r\n", msg);
-	fflush(opt->fp); // 没有更新需求前, 保持每次flush 2012.12.20
-	/*
-	if (CLOGL_LEVEL_ERR >= apd->priority) {
-		fflush(opt->fp);
+
+	if (rst || cloglPut(msg, &pos, "", 0)) {
+		return NULL;
 	}
-	*/
-	return 0;
+	msg->msgBuff[pos] = 0;
+
+	return msg->msgBuff;
 }
-/* 按时间间隔换日志文件 */
-static int timeFile_event(cloglApd *apd)
+
+/*
+  用一个日志格式格式化. 编译好的布局和格式化函数两种
+ */
+static inline char *cloglFmtRun(cloglFmt *fmt, clogl_t *log, const char *format, va_list args)
 {
-	if (0 == apd->isOpen) // 还没记日志
-		return 0;
+	cloglHeadLen = 0; // 只有defFmt和ptidFmt会设置. 别的格式合并重复日志时比整行
+	return fmt->layout ? cloglLayoutRun(fmt->layout, log, format, args) : fmt->format(log, format, args);
+}
+/* 布局 <<< */
 
-	cloglTimeFileOpt *opt = (cloglTimeFileOpt *)apd->opt;
-	if (!opt) {
-		return -1;
-	}
-	if (!opt->fp) {
-		return -1;
-	}
-	if (!opt->fileName || !opt->fileName[0]) {
-		return -1;
-	}
-	if (0 == opt->now || 0 == opt->span) {
-		return -1;
-	}
+/* 系统中所有日志格式 */
+static cloglFmt cloglFmts[4] = {
+	{(char*)"defFmt", cloglDefFmt, NULL},
+	{(char*)"ptidFmt", cloglIDFmt, NULL},
+	{(char*)"jsonFmt", cloglJsonFmt, NULL},
+	{NULL, NULL, NULL}
+};
 
-	time_t nowTime = time(NULL);
-	if ((nowTime - opt->now) < opt->span) {
-		return 0;
-	}
+/*
+ * 功能:
+ *    跟据传的名字, 返回一个日志格式对象
+ * 入参:
+ *    name: 日志格式名
+ * 出参:
+ *    NO
+ * 返回值:
+ *    成功返回日志格式对象指针, 出错返回 NULL
+ */
+static cloglFmt* cloglGetFmt(const char *name)
+{
+	if (!name || !name[0])
+		return NULL;
 
-	// 关现在日志文件
-	if (cloglApdClose(apd)) {
-		return -1;
-	}
+	cloglFmt *tmpFmt = &cloglFmts[0];
 
-	// 备份文件
-	int len = strlen(opt->fileName);
-	char *newName = (char *)calloc(len+32, sizeof(char));
-	if (!newName) {
-		return -1;
+	while (tmpFmt->name) {
+		if (!strcmp(name, tmpFmt->name)) {
+			return tmpFmt;
+		}
+		tmpFmt ++;
 	}
-	(void)strcpy(newName, opt->fileName);
-	newName[len] = '.';
-	struct tm *t = localtime(&opt->now);
-	strftime(newName+len+1, 20, "%Y-%m-%d %X", t);
-	if (rename(opt->fileName, newName)) {
-		cloglErr("timeFile_event rename error");
-		free(newName);
-		return -1;
+
+	// cloglAddLayout加的
+	for (cloglLayout *lay = __atomic_load_n(&cloglLayouts, __ATOMIC_ACQUIRE); lay; lay = lay->next) {
+		if (!strcmp(name, lay->fmt.name)) {
+			return &lay->fmt;
+		}
 	}
-	free(newName);
-	
-	return 0;
+
+	return NULL;
 }
-/* 每小时换日志文件 */
-static int hourFile_event(cloglApd *apd)
+
+/*
+  编译并登记一个布局. replace为1时可以盖掉同名的布局: 新的放在前面, 旧的还留着给正在用的输出方向
+  同名同布局串的不重复登记
+ */
+static int cloglLayoutPut(const char *name, const char *pattern, int replace)
 {
-	if (0 == apd->isOpen)  // 还没记日志
-		return 0;
-	
-	cloglTimeFileOpt *opt = (cloglTimeFileOpt *)apd->opt;
-	if (!opt) {
+	if (!name || !name[0] || !pattern) {
 		return -1;
 	}
-	if (!opt->fp) {
+
+	cloglLayout *lay = cloglLayoutCompile(pattern);
+	if (!lay) {
 		return -1;
 	}
-	if (!opt->fileName || !opt->fileName[0]) {
+	lay->fmt.name = strdup(name);
+	lay->fmt.layout = lay;
+	lay->pattern = strdup(pattern);
+	if (!lay->fmt.name || !lay->pattern) {
+		cloglLayoutFree(lay);
 		return -1;
 	}
 
-	if (0 == opt->now)
-		return 0;
-
-	// 测试时间
-	time_t tNow = time(NULL);
-	time_t tLast = opt->now;
-	struct tm *nowTime = localtime((const time_t*)&tNow);
-	int hour = nowTime->tm_hour;
-	nowTime = localtime((const time_t*)&tLast);
-	if (hour == nowTime->tm_hour) {
-		return 0;
+	pthread_mutex_lock(&cloglLayoutLock);
+	cloglFmt *old = cloglGetFmt(name);
+	if (old && (!replace || !old->layout || !strcmp(old->layout->pattern, pattern))) {
+		pthread_mutex_unlock(&cloglLayoutLock);
+		cloglLayoutFree(lay);
+		return (replace && old->layout) ? 0 : -1;
 	}
+	lay->next = cloglLayouts;
+	__atomic_store_n(&cloglLayouts, lay, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&cloglLayoutLock);
 
-	// 关日志文件
-	if (cloglApdClose(apd)) {
-		return -1;
-	}
+	return 0;
+}
 
-	// 备件文件
-	int len = strlen(opt->fileName);
-	char *newName = (char *)calloc(len+32, sizeof(char));
-	if (!newName) {
-		return -1;
-	}
-	(void)strcpy(newName, opt->fileName);
-	newName[len] = '.';
-	strftime(newName+len+1, 16, "%Y-%m-%d-%H", localtime((const time_t*)&opt->now)); //%M%S
-	if (rename(opt->fileName, newName)) {
-		char buff[128] = {0};
-		sprintf(buff, "hourFile_event rename error: '%d', '%s', '%s'", errno, opt->fileName, newName);
-		cloglErr((const char *)buff);
-		free(newName);
-		return -1;
-	}
-	free(newName);
-	
+/*
+ * 功能:
+ *    把布局串编译成一个日志格式, 以后cloglAddApd可以按名字用. 只在这里解析一次, 写日志时执行编译好的操作
+ *    %d 时间, 同defFmt; %d{...} strftime格式, 里面还可以用 %ms %us %ns 表示秒的小数. 结果超过127个字节的格式不收
+ *    %p 级别  %P 进程ID  %t 线程ID  %c 日志对象名  %F 源文件  %L 行号  %M 函数名  %m 日志信息  %% 百分号
+ *    转换前可以加宽度: %-5p 左对齐补到5个字符; %8.8M 右对齐补到8个, 最多8个
+ * 入参:
+ *    name:    格式名. 不能和已有的重复
+ *    pattern: 布局串, 如 "%d{%H:%M:%S.%us} %-5p [%t] %F:%L %m"
+ * 出参:
+ *    NO
+ * 返回值:
+ *    0 OR -1
+ */
+int cloglAddLayout(const char *name, const char *pattern)
+{
+	return cloglLayoutPut(name, pattern, 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+  功能:
+     打开一个输出方向
+  入参:
+     apd: 一个输出方向结构
+ */
+static inline int cloglApdOpen(cloglApd *apd)
+{
+    if (!apd)
+	return -1;
+
+    if (!apd->apdType)
+	return -1;
+       
+    if (!apd->apdType->open)
 	return 0;
+
+    return apd->apdType->open(apd);
 }
-/* 按时间产生新的日志文件. 单位小时 <<<*/
 
-/* 按文件大小产生新的文件. 单位兆 >>>
-static int sizeFile_open(cloglApd *apd)
+/*
+ 功能:
+    关闭一个输出方向
+ 入参:
+    apd: 一个输出方向结构
+ */
+static inline int cloglApdClose(cloglApd *apd)
 {
-	cloglRollFileOpt *opt = (cloglRollFileOpt *)apd->opt;
-	if (!opt || 0 == opt->fileName[0])
-		return -1;
+    if (!apd)
+	return -1;
 
-	pthread_mutex_lock(&apd->pLock);
-	if (!apd->isOpen && !opt->fp) {
-		apd->isOpen ++;
-		opt->fp = fopen(opt->fileName, "a");
+    if (!apd->apdType)
+	return -1;
+       
+    if (!apd->apdType->close)
+	return 0;
+
+    return apd->apdType->close(apd);
+}
+
+
+/* 调度 >>> */
+/*
+  事件线程睡到最早的apd->deadline. 写日志的线程只在把某个deadline提前了的时候叫醒它
+ */
+static pthread_mutex_t cloglSchedLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cloglSchedCond = PTHREAD_COND_INITIALIZER;
+static int64_t cloglSchedNext;  // 事件线程睡到什么时候. 0 正在扫描, INT64_MAX 没有要等的
+static int cloglSchedKick;      // 扫描以后又有deadline提前了, 不要睡
+
+static int64_t cloglNowMs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+  要求在when(毫秒)之前调apd的event. 只会把deadline提前
+ */
+static void cloglSchedAt(cloglApd *apd, int64_t when)
+{
+	int64_t cur = __atomic_load_n(&apd->deadline, __ATOMIC_RELAXED);
+	do {
+		if (cur && cur <= when) {
+			return;
+		}
+	} while (!__atomic_compare_exchange_n(&apd->deadline, &cur, when, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	int64_t next = __atomic_load_n(&cloglSchedNext, __ATOMIC_ACQUIRE);
+	if (0 == next || when < next) {
+		pthread_mutex_lock(&cloglSchedLock);
+		cloglSchedKick = 1;
+		pthread_cond_signal(&cloglSchedCond);
+		pthread_mutex_unlock(&cloglSchedLock);
+	}
+}
+/* 调度 <<< */
+
+/* 终端输出方向 >>> */
+static int term_open(cloglApd *apd)
+{
+	apd = apd;
+	return 0;
+}
+static int term_close(cloglApd *apd)
+{
+	apd = apd;
+	return 0;
+}
+static int term_append(cloglApd *apd, int priority, const char *msg, size_t len)
+{
+	apd = apd;
+	priority = priority;
+	fwrite(msg, 1, len, stderr);
+	fputc('\n', stderr);
+	return 0;
+}
+static int cloglRawWrite(int fd, const char *buf, size_t len);
+static int term_sig(cloglApd *apd, const char *msg, size_t len)
+{
+	apd = apd;
+	if (!msg) {
+		return 0;
+	}
+	return (cloglRawWrite(STDERR_FILENO, msg, len) || cloglRawWrite(STDERR_FILENO, "\n", 1)) ? -1 : 0;
+}
+/* 终端输出方向 <<<*/
+
+/* 文件批量写 >>> */
+/*
+  把iov全部写进fd. 处理被信号打断和只写了一部分的情况
+ */
+static int cloglWritev(int fd, struct iovec *iov, int cnt)
+{
+	while (cnt > 0) {
+		ssize_t n = writev(fd, iov, cnt);
+		if (n < 0) {
+			if (EINTR == errno) {
+				continue;
+			}
+			return -1;
+		}
+		while (cnt > 0 && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov ++;
+			cnt --;
+		}
+		if (cnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+
+	return 0;
+}
+
+/*
+  信号处理函数里用的write. 只用异步信号安全的函数
+ */
+static int cloglRawWrite(int fd, const char *buf, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = write(fd, buf, len);
+		if (n < 0) {
+			if (EINTR == errno) {
+				continue;
+			}
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/*
+  信号处理函数里写: 先写掉缓冲里的, 再直接写这一条. msg为NULL只写缓冲
+  不加锁, 别的线程可能正在改缓冲. 只在进程要死了或者没有别的写线程时用
+ */
+static int cloglFileSig(cloglFileOut *out, const char *msg, size_t len)
+{
+	if (out->fd < 0) {
+		return -1;
+	}
+
+	size_t used = out->used;
+	out->used = 0;
+	int rst = 0;
+	if (used && out->buf && cloglRawWrite(out->fd, out->buf, used)) {
+		rst = -1;
+	}
+	if (msg && (cloglRawWrite(out->fd, msg, len) || cloglRawWrite(out->fd, "\r\n", 2))) {
+		rst = -1;
+	}
+
+	return rst;
+}
+
+static int cloglFileOpenFd(const char *fileName)
+{
+	return open(fileName, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+}
+
+static int cloglFileOpen(cloglFileOut *out, const char *fileName)
+{
+	out->fd = cloglFileOpenFd(fileName);
+	if (out->fd < 0) {
+		return -1;
+	}
+	out->used = 0;
+
+	return 0;
+}
+
+/*
+  把缓冲里的日志写进文件
+ */
+static int cloglFileFlush(cloglFileOut *out)
+{
+	if (out->fd < 0 || 0 == out->used) {
+		return 0;
+	}
+
+	struct iovec iov = {out->buf, out->used};
+	out->used = 0;
+
+	return cloglWritev(out->fd, &iov, 1);
+}
+
+static int cloglFileClose(cloglFileOut *out)
+{
+	if (out->fd < 0) {
+		return 0;
+	}
+
+	int rst = cloglFileFlush(out);
+	if (close(out->fd)) {
+		rst = -1;
+	}
+	out->fd = -1;
+	free(out->buf);
+	out->buf = NULL;
+	out->size = 0;
+
+	return rst;
+}
+
+/*
+  一条日志按输出方向的刷新策略写进文件. 每条日志后面加"\r\n"
+ */
+static int cloglFileAppend(cloglApd *apd, cloglFileOut *out, int priority, const char *msg, size_t len)
+{
+	static char crlf[2] = {'\r', '\n'};
+
+	if (out->fd < 0) {
+		return -1;
+	}
+
+	int now = (0 == apd->flushBytes) || (priority != CLOGL_LEVEL_DATA && priority <= apd->flushLevel);
+	if (!now && !out->buf) {
+		out->size = (apd->flushBytes > CLOGL_FILE_BUFF) ? apd->flushBytes : CLOGL_FILE_BUFF;
+		out->buf = (char *)malloc(out->size);
+		if (!out->buf) {
+			out->size = 0;
+			now = 1;
+		}
+	}
+
+	// 缓冲放得下就先放着
+	if (!now && out->used + len + 2 <= out->size) {
+		if (0 == out->used) {
+			clock_gettime(CLOCK_MONOTONIC_COARSE, &out->first);
+			if (apd->flushMs > 0) {
+				cloglSchedAt(apd, cloglNowMs() + apd->flushMs);
+			}
+		}
+		memcpy(out->buf + out->used, msg, len);
+		memcpy(out->buf + out->used + len, crlf, 2);
+		out->used += len + 2;
+		if (out->used < apd->flushBytes) {
+			return 0;
+		}
+		return cloglFileFlush(out);
+	}
+
+	// 缓冲里的和这一条一起写, 不再拷贝
+	struct iovec iov[3];
+	int cnt = 0;
+	if (out->used) {
+		iov[cnt].iov_base = out->buf;
+		iov[cnt].iov_len = out->used;
+		cnt ++;
+	}
+	iov[cnt].iov_base = (void *)msg;
+	iov[cnt].iov_len = len;
+	cnt ++;
+	iov[cnt].iov_base = crlf;
+	iov[cnt].iov_len = 2;
+	cnt ++;
+	out->used = 0;
+
+	return cloglWritev(out->fd, iov, cnt);
+}
+
+/*
+  按时间的刷新策略. 在事件线程里调
+ */
+static int cloglFileTick(cloglApd *apd, cloglFileOut *out)
+{
+	if (0 == out->used || apd->flushMs <= 0) {
+		return 0;
+	}
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	long ms = (ts.tv_sec - out->first.tv_sec) * 1000 + (ts.tv_nsec - out->first.tv_nsec) / 1000000;
+	if (ms < apd->flushMs) {
+		cloglSchedAt(apd, cloglNowMs() + apd->flushMs - ms);
+		return 0;
+	}
+
+	return cloglFileFlush(out);
+}
+
+/*
+  把fileName改名成fileName.加上tfmt格式的时间t. 在锁外调, 写线程拿着旧fd接着写进改名后的文件
+  返回新文件名, 调用者free. 出错返回NULL
+ */
+static char *cloglFileRename(const char *fileName, time_t t, const char *tfmt)
+{
+	int len = strlen(fileName);
+	char *newName = (char *)calloc(len+32, sizeof(char));
+	if (!newName) {
+		return NULL;
+	}
+	(void)strcpy(newName, fileName);
+	newName[len] = '.';
+	struct tm tm;
+	strftime(newName+len+1, 20, tfmt, localtime_r(&t, &tm));
+	if (rename(fileName, newName)) {
+		char buff[128] = {0};
+		snprintf(buff, sizeof(buff), "cloglFileRename error: '%d', '%s', '%s'", errno, fileName, newName);
+		cloglErr((const char *)buff);
+		free(newName);
+		return NULL;
+	}
+
+	return newName;
+}
+
+/*
+  t之后的下一个整点
+ */
+static time_t cloglNextHour(time_t t)
+{
+	struct tm tm;
+	localtime_r(&t, &tm);
+	tm.tm_min = 0;
+	tm.tm_sec = 0;
+	tm.tm_hour ++;
+	tm.tm_isdst = -1;
+
+	return mktime(&tm);
+}
+/* 文件批量写 <<< */
+
+/* 整理换下来的文件 >>> */
+/*
+  一个低优先级的线程按顺序做: 压缩换下来的日志文件, 压缩完改名成.gz/.lz4, 删掉原文件;
+  按保留策略删旧文件
+ */
+typedef struct _clogl_zip_job
+{
+	char *path;                       // 要压缩的文件. 保留策略时是日志文件名
+	int kind;                         // CLOGL_ZIP_*. 保留策略时为-1
+	int keepFiles;                    // 保留策略, 同cloglApd
+	off_t keepBytes;
+	time_t keepAge;
+	struct _clogl_zip_job *next;
+} cloglZipJob;
+
+#define CLOGL_ZIP_CHUNK       (64 * 1024)  // 每次读这么多字节. 也是LZ4的块大小
+#define CLOGL_KEEP_CHUNK      (64 * 1024 * 1024) // 删大文件前每次截掉这么多字节
+#define CLOGL_KEEP_PAUSE      10           // 每次截短后歇这么多毫秒
+
+static pthread_mutex_t cloglZipLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cloglZipCond = PTHREAD_COND_INITIALIZER;
+static cloglZipJob *cloglZipHead, **cloglZipTail = &cloglZipHead;
+static pthread_once_t cloglZipOnce = PTHREAD_ONCE_INIT;
+static int cloglZipBudget = CLOGL_ZIP_BUDGET;
+
+/*
+  LZ4块压缩. dst至少n + n/255 + 16字节. 返回压缩后的字节数
+ */
+#define CLOGL_LZ4_HASH        12
+static size_t cloglLz4Block(const uint8_t *src, size_t n, uint8_t *dst)
+{
+	uint32_t table[1 << CLOGL_LZ4_HASH];
+	uint8_t *op = dst;
+	size_t ip = 0, anchor = 0;
+
+	memset(table, 0xFF, sizeof(table));
+	if (n >= 13) {
+		size_t limit = n - 12;    // 最后一个匹配要在结尾12字节之前开始
+		size_t matchLimit = n - 5; // 最后5字节只能是字面量
+		while (ip < limit) {
+			uint32_t seq, cand;
+			memcpy(&seq, src + ip, 4);
+			uint32_t h = (seq * 2654435761u) >> (32 - CLOGL_LZ4_HASH);
+			uint32_t ref = table[h];
+			table[h] = ip;
+			if (ref == 0xFFFFFFFF || ip - ref > 65535 || (memcpy(&cand, src + ref, 4), cand != seq)) {
+				ip += 1 + ((ip - anchor) >> 6); // 越找不到跳得越快
+				continue;
+			}
+
+			size_t ml = 4;
+			while (ip + ml < matchLimit && src[ref + ml] == src[ip + ml])
+				ml ++;
+
+			size_t lit = ip - anchor;
+			uint8_t *token = op++;
+			*token = (uint8_t)(((lit >= 15) ? 15 : lit) << 4);
+			if (lit >= 15) {
+				size_t l = lit - 15;
+				for (; l >= 255; l -= 255)
+					*op++ = 255;
+				*op++ = (uint8_t)l;
+			}
+			memcpy(op, src + anchor, lit);
+			op += lit;
+			*op++ = (uint8_t)((ip - ref) & 0xFF);
+			*op++ = (uint8_t)((ip - ref) >> 8);
+			size_t m = ml - 4;
+			*token |= (uint8_t)((m >= 15) ? 15 : m);
+			if (m >= 15) {
+				m -= 15;
+				for (; m >= 255; m -= 255)
+					*op++ = 255;
+				*op++ = (uint8_t)m;
+			}
+
+			ip += ml;
+			anchor = ip;
+		}
+	}
+
+	// 最后的字面量
+	size_t lit = n - anchor;
+	*op++ = (uint8_t)(((lit >= 15) ? 15 : lit) << 4);
+	if (lit >= 15) {
+		size_t l = lit - 15;
+		for (; l >= 255; l -= 255)
+			*op++ = 255;
+		*op++ = (uint8_t)l;
+	}
+	memcpy(op, src + anchor, lit);
+	op += lit;
+
+	return op - dst;
+}
+
+/*
+  读满len字节, 除非到了文件尾
+ */
+static ssize_t cloglReadFull(int fd, char *buf, size_t len)
+{
+	size_t got = 0;
+	while (got < len) {
+		ssize_t n = read(fd, buf + got, len - got);
+		if (n < 0) {
+			if (EINTR == errno) {
+				continue;
+			}
+			return -1;
+		}
+		if (0 == n) {
+			break;
+		}
+		got += n;
+	}
+
+	return got;
+}
+
+static int cloglWriteAll(int fd, const void *buf, size_t len)
+{
+	struct iovec iov = {(void *)buf, len};
+	return cloglWritev(fd, &iov, 1);
+}
+
+/*
+  超过CPU预算就睡. 预算按压缩这个文件以来的线程CPU时间/墙上时间算
+ */
+static void cloglZipThrottle(const struct timespec *wall0, const struct timespec *cpu0)
+{
+	struct timespec wall, cpu;
+	clock_gettime(CLOCK_MONOTONIC, &wall);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+	int64_t wallUs = (wall.tv_sec - wall0->tv_sec) * 1000000LL + (wall.tv_nsec - wall0->tv_nsec) / 1000;
+	int64_t cpuUs = (cpu.tv_sec - cpu0->tv_sec) * 1000000LL + (cpu.tv_nsec - cpu0->tv_nsec) / 1000;
+	int64_t wantUs = cpuUs * 100 / __atomic_load_n(&cloglZipBudget, __ATOMIC_RELAXED);
+	if (wantUs > wallUs) {
+		int64_t us = wantUs - wallUs;
+		struct timespec ts = {us / 1000000, (us % 1000000) * 1000};
+		while (nanosleep(&ts, &ts) && EINTR == errno)
+			;
+	}
+}
+
+/*
+  把in压缩写进out. 返回0成功
+ */
+static int cloglZipStream(int in, int out, int kind)
+{
+	struct timespec wall0, cpu0;
+	clock_gettime(CLOCK_MONOTONIC, &wall0);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu0);
+
+	char *ibuf = (char *)malloc(CLOGL_ZIP_CHUNK);
+	char *obuf = (char *)malloc(CLOGL_ZIP_CHUNK + CLOGL_ZIP_CHUNK / 255 + 16);
+	if (!ibuf || !obuf) {
+		free(ibuf);
+		free(obuf);
+		return -1;
+	}
+
+	int rst = -1;
+#ifdef CLOGL_HAVE_ZLIB
+	if (CLOGL_ZIP_GZ == kind) {
+		z_stream zs;
+		memset(&zs, 0, sizeof(zs));
+		if (Z_OK != deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY)) {
+			goto out;
+		}
+		int flush = Z_NO_FLUSH;
+		while (Z_FINISH != flush) {
+			ssize_t n = cloglReadFull(in, ibuf, CLOGL_ZIP_CHUNK);
+			if (n < 0) {
+				deflateEnd(&zs);
+				goto out;
+			}
+			flush = (n < CLOGL_ZIP_CHUNK) ? Z_FINISH : Z_NO_FLUSH;
+			zs.next_in = (Bytef *)ibuf;
+			zs.avail_in = n;
+			do {
+				zs.next_out = (Bytef *)obuf;
+				zs.avail_out = CLOGL_ZIP_CHUNK;
+				(void)deflate(&zs, flush);
+				if (cloglWriteAll(out, obuf, CLOGL_ZIP_CHUNK - zs.avail_out)) {
+					deflateEnd(&zs);
+					goto out;
+				}
+			} while (0 == zs.avail_out);
+			cloglZipThrottle(&wall0, &cpu0);
+		}
+		deflateEnd(&zs);
+		rst = 0;
+		goto out;
+	}
+#endif
+
+	// LZ4帧: 块独立, 块最大64K, 没有校验. 头的最后一个字节是FLG/BD的xxh32校验
+	kind = kind;
+	static const uint8_t lz4Head[7] = {0x04, 0x22, 0x4D, 0x18, 0x60, 0x40, 0x82};
+	if (cloglWriteAll(out, lz4Head, sizeof(lz4Head))) {
+		goto out;
+	}
+	while (1) {
+		ssize_t n = cloglReadFull(in, ibuf, CLOGL_ZIP_CHUNK);
+		if (n < 0) {
+			goto out;
+		}
+		if (0 == n) {
+			break;
+		}
+		size_t clen = cloglLz4Block((const uint8_t *)ibuf, n, (uint8_t *)obuf + 4);
+		uint32_t bsize = clen;
+		const char *data = obuf + 4;
+		if (clen >= (size_t)n) {
+			// 压不小就原样存
+			bsize = (uint32_t)n | 0x80000000u;
+			clen = n;
+			data = ibuf;
+		}
+		uint8_t hdr[4] = {(uint8_t)bsize, (uint8_t)(bsize >> 8), (uint8_t)(bsize >> 16), (uint8_t)(bsize >> 24)};
+		if (cloglWriteAll(out, hdr, 4) || cloglWriteAll(out, data, clen)) {
+			goto out;
+		}
+		cloglZipThrottle(&wall0, &cpu0);
+	}
+	static const uint8_t lz4End[4] = {0, 0, 0, 0};
+	rst = cloglWriteAll(out, lz4End, 4);
+
+out:
+	free(ibuf);
+	free(obuf);
+	return rst;
+}
+
+/*
+  压缩一个文件: 先写到.tmp, 落盘后改名, 再删原文件
+ */
+static void cloglZipFile(const char *path, int kind)
+{
+	const char *ext = (CLOGL_ZIP_GZ == kind) ? ".gz" : ".lz4";
+	size_t len = strlen(path) + 16;
+	char *dst = (char *)malloc(len);
+	char *tmp = (char *)malloc(len);
+	if (!dst || !tmp) {
+		free(dst);
+		free(tmp);
+		return;
+	}
+	snprintf(dst, len, "%s%s", path, ext);
+	snprintf(tmp, len, "%s%s.tmp", path, ext);
+
+	int in = open(path, O_RDONLY | O_CLOEXEC);
+	int out = (in < 0) ? -1 : open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (in >= 0 && out >= 0) {
+		(void)posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+		if (!cloglZipStream(in, out, kind) && !fdatasync(out) && !rename(tmp, dst)) {
+			(void)unlink(path);
+		} else {
+			cloglErr("cloglZipFile error");
+			(void)unlink(tmp);
+		}
+		(void)posix_fadvise(in, 0, 0, POSIX_FADV_DONTNEED); // 不占页缓存
+	}
+	if (in >= 0) {
+		close(in);
+	}
+	if (out >= 0) {
+		close(out);
+	}
+	free(dst);
+	free(tmp);
+}
+
+/*
+  删一个旧文件. 先一段一段截短, 文件系统一次只释放一点块, 不会卡住写日志的线程
+ */
+static void cloglKeepDrop(int dfd, const char *name)
+{
+	int fd = openat(dfd, name, O_WRONLY | O_CLOEXEC | O_NOFOLLOW);
+	if (fd >= 0) {
+		struct stat st;
+		if (!fstat(fd, &st)) {
+			off_t size = st.st_size;
+			while (size > CLOGL_KEEP_CHUNK) {
+				size -= CLOGL_KEEP_CHUNK;
+				if (ftruncate(fd, size)) {
+					break;
+				}
+				struct timespec ts = {0, CLOGL_KEEP_PAUSE * 1000000L};
+				(void)nanosleep(&ts, NULL);
+			}
+		}
+		close(fd);
+	}
+	if (unlinkat(dfd, name, 0) && ENOENT != errno) {
+		cloglErr("cloglKeepDrop unlink error");
+	}
+}
+
+typedef struct _clogl_keep_file
+{
+	char *name;
+	off_t size;
+	time_t mtime;
+} cloglKeepFile;
+
+static int cloglKeepCmp(const void *a, const void *b)
+{
+	const cloglKeepFile *x = (const cloglKeepFile *)a;
+	const cloglKeepFile *y = (const cloglKeepFile *)b;
+	if (x->mtime != y->mtime) {
+		return (x->mtime > y->mtime) ? -1 : 1; // 新的在前
+	}
+	return strcmp(y->name, x->name);
+}
+
+/*
+  按保留策略删fileName换下来的文件. 换下来的文件名是fileName.后面跟数字开头的时间或序号, 可能有压缩后缀
+ */
+static void cloglKeepRun(const cloglZipJob *job)
+{
+	const char *slash = strrchr(job->path, '/');
+	const char *base = slash ? slash + 1 : job->path;
+	size_t blen = strlen(base);
+	char *dir = slash ? strndup(job->path, (slash == job->path) ? 1 : (size_t)(slash - job->path)) : strdup(".");
+	if (!dir) {
+		return;
+	}
+	DIR *d = opendir(dir);
+	free(dir);
+	if (!d) {
+		return;
+	}
+
+	cloglKeepFile *files = NULL;
+	size_t cnt = 0, cap = 0;
+	struct dirent *de;
+	while ((de = readdir(d))) {
+		const char *name = de->d_name;
+		size_t nlen = strlen(name);
+		if (nlen < blen + 2 || strncmp(name, base, blen) || '.' != name[blen] || name[blen + 1] < '0' || name[blen + 1] > '9') {
+			continue;
+		}
+		if (nlen > 4 && !strcmp(name + nlen - 4, ".tmp")) { // 正在压缩
+			continue;
+		}
+		struct stat st;
+		if (fstatat(dirfd(d), name, &st, AT_SYMLINK_NOFOLLOW) || !S_ISREG(st.st_mode)) {
+			continue;
+		}
+		if (cnt == cap) {
+			cap = cap ? cap * 2 : 16;
+			cloglKeepFile *tmp = (cloglKeepFile *)realloc(files, cap * sizeof(cloglKeepFile));
+			if (!tmp) {
+				break;
+			}
+			files = tmp;
+		}
+		files[cnt].name = strdup(name);
+		if (!files[cnt].name) {
+			break;
+		}
+		files[cnt].size = st.st_size;
+		files[cnt].mtime = st.st_mtime;
+		cnt ++;
+	}
+
+	qsort(files, cnt, sizeof(cloglKeepFile), cloglKeepCmp);
+	time_t now = time(NULL);
+	off_t total = 0;
+	for (size_t i = 0; i < cnt; i++) {
+		total += files[i].size;
+		if ((job->keepFiles && i >= (size_t)job->keepFiles) || (job->keepBytes && total > job->keepBytes) || (job->keepAge && now - files[i].mtime > job->keepAge)) {
+			cloglKeepDrop(dirfd(d), files[i].name);
+		}
+		free(files[i].name);
+	}
+	free(files);
+	closedir(d);
+}
+
+static void *threadZip(void *parm)
+{
+	parm = parm;
+
+	// 不和业务抢CPU和磁盘
+	pid_t tid = syscall(SYS_gettid);
+	(void)setpriority(PRIO_PROCESS, tid, 19);
+	(void)syscall(SYS_ioprio_set, 1, tid, 3 << 13); // IOPRIO_WHO_PROCESS, IOPRIO_CLASS_IDLE
+
+	while (1) {
+		pthread_mutex_lock(&cloglZipLock);
+		while (!cloglZipHead)
+			pthread_cond_wait(&cloglZipCond, &cloglZipLock);
+		cloglZipJob *job = cloglZipHead;
+		cloglZipHead = job->next;
+		if (!cloglZipHead) {
+			cloglZipTail = &cloglZipHead;
+		}
+		pthread_mutex_unlock(&cloglZipLock);
+
+		if (job->kind < 0) {
+			cloglKeepRun(job);
+		} else {
+			cloglZipFile(job->path, job->kind);
+		}
+		free(job->path);
+		free(job);
+	}
+
+	return (void *)0;
+}
+
+static void cloglZipStart(void)
+{
+	pthread_t ptid;
+	if (pthread_create(&ptid, NULL, threadZip, NULL)) {
+		cloglErr("cloglZipStart error");
+		return;
+	}
+	(void)pthread_detach(ptid);
+}
+
+static void cloglZipQueue(cloglZipJob *job)
+{
+	pthread_once(&cloglZipOnce, cloglZipStart);
+	pthread_mutex_lock(&cloglZipLock);
+	*cloglZipTail = job;
+	cloglZipTail = &job->next;
+	pthread_cond_signal(&cloglZipCond);
+	pthread_mutex_unlock(&cloglZipLock);
+}
+
+/*
+  换了文件后交给整理线程: 按apd的设置压缩换下来的backup(可以为NULL), 再按保留策略删旧文件. 不等
+ */
+static void cloglZipPush(cloglApd *apd, const char *fileName, const char *backup)
+{
+	if (backup && apd->compress) {
+		cloglZipJob *job = (cloglZipJob *)calloc(1, sizeof(cloglZipJob));
+		if (job && (job->path = strdup(backup))) {
+			job->kind = apd->compress;
+			cloglZipQueue(job);
+		} else {
+			free(job);
+		}
+	}
+
+	if (apd->keepFiles || apd->keepBytes || apd->keepAge) {
+		cloglZipJob *job = (cloglZipJob *)calloc(1, sizeof(cloglZipJob));
+		if (job && (job->path = strdup(fileName))) {
+			job->kind = -1;
+			job->keepFiles = apd->keepFiles;
+			job->keepBytes = apd->keepBytes;
+			job->keepAge = apd->keepAge;
+			cloglZipQueue(job);
+		} else {
+			free(job);
+		}
+	}
+}
+/* 整理换下来的文件 <<< */
+
+/* 按时间产生新的日志文件. 单位小时 >>>*/
+static int timeFile_open(cloglApd *apd)
+{
+	cloglTimeFileOpt *opt = (cloglTimeFileOpt *)apd->opt;
+	if (!opt) {
+		return -1;
+	}
+	if (!opt->fileName || !opt->fileName[0]) {
+		return -1;
+	}
+
+	if (cloglFileOpen(&opt->out, opt->fileName)) {
+		return -1;
+	}
+
+	opt->now = time(NULL); // 打开时间
+	opt->next = opt->now + opt->span;
+	apd->isOpen = 1;
+	cloglSchedAt(apd, (int64_t)opt->next * 1000);
+
+	return 0;
+}
+/* 下一个整点换文件. 只在打开时算一次 */
+static int hourFile_open(cloglApd *apd)
+{
+	if (timeFile_open(apd)) {
+		return -1;
+	}
+
+	cloglTimeFileOpt *opt = (cloglTimeFileOpt *)apd->opt;
+	opt->next = cloglNextHour(opt->now);
+	cloglSchedAt(apd, (int64_t)opt->next * 1000);
+
+	return 0;
+}
+static int timeFile_close(cloglApd *apd)
+{
+	cloglTimeFileOpt *opt = (cloglTimeFileOpt *)apd->opt;
+	if (!opt) {
+		return -1;
+	}
+
+ 	if (opt->out.fd >= 0) {
+ 		if (cloglFileClose(&opt->out)) {
+			return -1;
+		}
+		apd->isOpen = 0;
+ 	}
+
+	return 0;
+}
+
+static int timeFile_append(cloglApd *apd, int priority, const char *msg, size_t len)
+{
+	if (!msg) {
+		return -1;
+	}
+
+	cloglTimeFileOpt *opt = (cloglTimeFileOpt *)apd->opt;
+	if (!opt) {
+		return -1;
+	}
+
+	// 2012.12.20 起每条都flush. 现在按apd的刷新策略, 默认仍是每条一次write
+	return cloglFileAppend(apd, &opt->out, priority, msg, len);
+}
+static int timeFile_sig(cloglApd *apd, const char *msg, size_t len)
+{
+	cloglTimeFileOpt *opt = (cloglTimeFileOpt *)apd->opt;
+	return opt ? cloglFileSig(&opt->out, msg, len) : -1;
+}
+static int timeFile_flush(cloglApd *apd)
+{
+	cloglTimeFileOpt *opt = (cloglTimeFileOpt *)apd->opt;
+	if (!opt) {
+		return -1;
+	}
+
+	return cloglFileFlush(&opt->out);
+}
+static int timeFile_init(cloglApd *apd, const char *fileName)
+{
+	if (!fileName || !fileName[0]) {
+		return -1;
+	}
+
+	cloglTimeFileOpt *opt = (cloglTimeFileOpt *)calloc(1, sizeof(cloglTimeFileOpt));
+	if (!opt) {
+		return -1;
+	}
+	opt->fileName = strdup(fileName);
+	if (!opt->fileName) {
+		free(opt);
+		return -1;
+	}
+	opt->out.fd = -1;
+	opt->span = 1 * 60 * 60; // 默认简隔1小时
+	apd->opt = opt;
+
+	return 0;
+}
+static int timeFile_set(cloglApd *apd, const char *key, const char *value)
+{
+	cloglTimeFileOpt *opt = (cloglTimeFileOpt *)apd->opt;
+	if (!opt) {
+		return -1;
+	}
+
+	if (!strcmp(key, "span")) {
+		int hours = atoi(value);
+		if (hours <= 0) {
+			return -1;
+		}
+		opt->span = (time_t)hours * 60 * 60;
+		return 0;
+	}
+
+	return -1;
+}
+/*
+  到了opt->next就换文件. 改名和打开新文件都在锁外, 锁里只换fd, 旧fd在锁外关
+ */
+static int timeFile_roll(cloglApd *apd, const char *tfmt, int hourly)
+{
+	cloglTimeFileOpt *opt = (cloglTimeFileOpt *)apd->opt;
+	if (!opt) {
+		return -1;
+	}
+	if (!opt->fileName || !opt->fileName[0]) {
+		return -1;
+	}
+
+	pthread_mutex_lock(&apd->pLock);
+	if (0 == apd->isOpen || opt->out.fd < 0) { // 还没记日志
+		pthread_mutex_unlock(&apd->pLock);
+		return 0;
+	}
+	(void)cloglFileTick(apd, &opt->out);
+	time_t opened = opt->now;
+	int due = opt->next && time(NULL) >= opt->next;
+	if (!due && opt->next) {
+		cloglSchedAt(apd, (int64_t)opt->next * 1000);
+	}
+	pthread_mutex_unlock(&apd->pLock);
+	if (!due) {
+		return 0;
+	}
+
+	// 备份文件. 改名失败也换一次fd, 重新开始计时
+	char *backup = cloglFileRename(opt->fileName, opened, tfmt);
+	int fd = cloglFileOpenFd(opt->fileName);
+	if (fd < 0) {
+		cloglErr("timeFile_roll open error");
+		free(backup);
+		cloglSchedAt(apd, cloglNowMs() + 1000); // 过一会儿再试
+		return -1;
+	}
+
+	pthread_mutex_lock(&apd->pLock);
+	if (0 == apd->isOpen || opt->out.fd < 0) { // 已经被关了
+		pthread_mutex_unlock(&apd->pLock);
+		close(fd);
+		free(backup);
+		return 0;
+	}
+	(void)cloglFileFlush(&opt->out); // 缓冲里的属于旧文件
+	int oldFd = opt->out.fd;
+	opt->out.fd = fd;
+	opt->now = time(NULL);
+	opt->next = hourly ? cloglNextHour(opt->now) : opt->now + opt->span;
+	cloglSchedAt(apd, (int64_t)opt->next * 1000);
+	pthread_mutex_unlock(&apd->pLock);
+
+	close(oldFd);
+	cloglZipPush(apd, opt->fileName, backup);
+	free(backup);
+
+	return 0;
+}
+/* 按时间间隔换日志文件 */
+static int timeFile_event(cloglApd *apd)
+{
+	return timeFile_roll(apd, "%Y-%m-%d %X", 0);
+}
+/* 每小时换日志文件 */
+static int hourFile_event(cloglApd *apd)
+{
+	return timeFile_roll(apd, "%Y-%m-%d-%H", 1);
+}
+/* 按时间产生新的日志文件. 单位小时 <<<*/
+
+/* 内存映射文件 >>> */
+static unsigned long cloglRcuMark();
+static int cloglRcuPassed(unsigned long gp);
+
+/*
+  映射的一段文件. 写线程用原子加占位置, 写满了由占到段尾的那个线程换段
+ */
+typedef struct _clogl_mmap_seg
+{
+	char *base;                       // 映射地址. 解除映射后为NULL
+	size_t size;                      // 映射长度
+	off_t off;                        // 映射在文件里的偏移. 页对齐
+	size_t pos;                       // 下一个写位置(相对base). 写线程原子加
+	size_t done;                      // 已经拷贝完的字节数. 包括开头属于上一段的部分
+	size_t end;                       // 封段后的有效长度. 没封时为(size_t)-1
+	int fd;                           // 所在文件
+	int last;                         // 是所在文件的最后一段. 回收时截断并关闭文件
+	unsigned long gp;                 // 换下来时开始的宽限期. 过去了才没有写线程还拿着这个结构体
+	struct _clogl_mmap_seg *next;     // 回收链
+} cloglMmapSeg;
+
+/*
+  从文件的start处映射一段, 至少能放下need字节. 先fallocate, 写的时候不会因为磁盘满收到SIGBUS
+ */
+static cloglMmapSeg *cloglMmapMap(int fd, off_t start, size_t need, size_t segSize)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	if (page <= 0) {
+		page = 4096;
+	}
+	off_t aoff = start - (start % page);
+	size_t intra = start - aoff;
+	size_t size = segSize;
+	if (size < intra + need) {
+		size = intra + need;
+	}
+	size = (size + page - 1) / page * page;
+
+	if (fallocate(fd, 0, aoff, size)) {
+		if (EOPNOTSUPP != errno && ENOSYS != errno) {
+			return NULL;
+		}
+		// 文件系统不支持, 退回稀疏文件
+		struct stat st;
+		if (fstat(fd, &st) || (st.st_size < (off_t)(aoff + size) && ftruncate(fd, aoff + size))) {
+			return NULL;
+		}
+	}
+
+	void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, aoff);
+	if (MAP_FAILED == base) {
+		return NULL;
+	}
+
+	cloglMmapSeg *seg = (cloglMmapSeg *)calloc(1, sizeof(cloglMmapSeg));
+	if (!seg) {
+		munmap(base, size);
+		return NULL;
+	}
+	seg->base = (char *)base;
+	seg->size = size;
+	seg->off = aoff;
+	seg->pos = intra;
+	seg->done = intra;
+	seg->end = (size_t)-1;
+	seg->fd = fd;
+
+	return seg;
+}
+
+/*
+  回收写完的段. 写线程都在读区间里占位置, 换段以后的宽限期过去了才释放结构体.
+  force: 等正在拷贝的写完, 并释放所有结构体. 只在链已经没有读者了的时候用
+  换下来的文件关掉, 并且没有还映射着的段了, 才交给整理线程按保留策略删: 还映射着的文件被截短, 写线程会收到SIGBUS
+  返回下次要再来回收的时间(毫秒), 0 已经回收完了
+ */
+static int64_t cloglMmapReclaim(cloglApd *apd, int force)
+{
+	cloglMmapFileOpt *opt = (cloglMmapFileOpt *)apd->opt;
+	int64_t again = 0;
+	int closed = 0;
+	int mapped = 0;
+
+	pthread_mutex_lock(&opt->rollLock);
+	cloglMmapSeg **pp = &opt->retired;
+	while (*pp) {
+		cloglMmapSeg *seg = *pp;
+		if (seg->base) {
+			size_t end = __atomic_load_n(&seg->end, __ATOMIC_ACQUIRE);
+			while (__atomic_load_n(&seg->done, __ATOMIC_ACQUIRE) < end) {
+				if (!force) {
+					break;
+				}
+				sched_yield();
+			}
+			if (__atomic_load_n(&seg->done, __ATOMIC_ACQUIRE) < end) {
+				again = cloglNowMs() + CLOGL_EVENT_TIME;
+				mapped = 1;
+				pp = &seg->next;
+				continue;
+			}
+			munmap(seg->base, seg->size);
+			seg->base = NULL;
+			if (seg->last) {
+				// 去掉fallocate多分配的部分
+				if (ftruncate(seg->fd, seg->off + end)) {
+					cloglErr("cloglMmapReclaim ftruncate error");
+				}
+				close(seg->fd);
+				closed = 1;
+			}
+		}
+		if (force || cloglRcuPassed(seg->gp)) {
+			*pp = seg->next;
+			free(seg);
+			continue;
+		}
+		again = cloglNowMs() + CLOGL_EVENT_TIME;
+		pp = &seg->next;
+	}
+	pthread_mutex_unlock(&opt->rollLock);
+
+	if (closed && !mapped) {
+		cloglZipPush(apd, opt->fileName, NULL); // 映射时不知道改了什么名, 不压缩
+	}
+
+	return again;
+}
+
+/*
+  封住当前段: 以后的写线程都占不到位置. 返回被封的段, 没有当前段返回NULL
+ */
+static cloglMmapSeg *cloglMmapSeal(cloglMmapFileOpt *opt)
+{
+	while (1) {
+		cloglMmapSeg *seg = __atomic_load_n(&opt->cur, __ATOMIC_ACQUIRE);
+		if (!seg) {
+			return NULL;
+		}
+		size_t off = __atomic_fetch_add(&seg->pos, seg->size + 1, __ATOMIC_RELAXED);
+		if (off <= seg->size) {
+			__atomic_store_n(&seg->end, off, __ATOMIC_RELEASE);
+			return seg;
+		}
+		// 别的线程正在换段
+		while (__atomic_load_n(&opt->cur, __ATOMIC_ACQUIRE) == seg)
+			sched_yield();
+	}
+}
+
+/*
+  换下已封的段old. newFd < 0 时在同一个文件里接着映射, 否则换到newFd的文件末尾. 失败时当前段为NULL
+ */
+static int cloglMmapSwitch(cloglMmapFileOpt *opt, cloglMmapSeg *old, size_t need, int newFd)
+{
+	cloglMmapSeg *seg = NULL;
+	if (newFd < 0) {
+		seg = cloglMmapMap(old->fd, old->off + old->end, need, opt->segSize);
+	} else {
+		struct stat st;
+		if (!fstat(newFd, &st)) {
+			seg = cloglMmapMap(newFd, st.st_size, need, opt->segSize);
+		}
+	}
+
+	pthread_mutex_lock(&opt->rollLock);
+	old->last = (newFd >= 0 || !seg); // 换了文件或者映射失败, 旧文件由这一段收尾
+	old->next = opt->retired;
+	opt->retired = old;
+	__atomic_store_n(&opt->cur, seg, __ATOMIC_RELEASE);
+	old->gp = cloglRcuMark(); // 在这之后进来的写线程拿不到old
+	pthread_mutex_unlock(&opt->rollLock);
+
+	return seg ? 0 : -1;
+}
+
+/*
+  文件结尾上次没截断的0(进程崩溃时留下的)不要, 从最后一个非0字节后面接着写
+ */
+static off_t cloglMmapTail(int fd, size_t limit)
+{
+	struct stat st;
+	if (fstat(fd, &st)) {
+		return -1;
+	}
+
+	char buf[4096];
+	off_t end = st.st_size;
+	off_t low = (st.st_size > (off_t)limit) ? st.st_size - (off_t)limit : 0;
+	while (end > low) {
+		size_t n = (end - low > (off_t)sizeof(buf)) ? sizeof(buf) : (size_t)(end - low);
+		off_t from = end - (off_t)n;
+		if (pread(fd, buf, n, from) != (ssize_t)n) {
+			return st.st_size;
+		}
+		while (n > 0 && 0 == buf[n - 1])
+			n --;
+		if (n > 0) {
+			return from + (off_t)n;
+		}
+		end = from;
+	}
+
+	return low;
+}
+
+static int mmapFile_open(cloglApd *apd)
+{
+	cloglMmapFileOpt *opt = (cloglMmapFileOpt *)apd->opt;
+	if (!opt || !opt->fileName || !opt->fileName[0]) {
+		return -1;
+	}
+
+	int fd = open(opt->fileName, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		return -1;
+	}
+	off_t start = cloglMmapTail(fd, opt->segSize);
+	cloglMmapSeg *seg = (start < 0) ? NULL : cloglMmapMap(fd, start, 0, opt->segSize);
+	if (!seg) {
+		close(fd);
+		return -1;
+	}
+	seg->last = 1;
+
+	opt->now = time(NULL); // 打开时间
+	__atomic_store_n(&opt->cur, seg, __ATOMIC_RELEASE);
+	__atomic_store_n(&apd->isOpen, 1, __ATOMIC_RELEASE);
+	if (opt->span) {
+		cloglSchedAt(apd, (int64_t)(opt->now + opt->span) * 1000);
+	}
+
+	return 0;
+}
+static int mmapFile_close(cloglApd *apd)
+{
+	cloglMmapFileOpt *opt = (cloglMmapFileOpt *)apd->opt;
+	if (!opt) {
+		return -1;
+	}
+
+	cloglMmapSeg *seg = cloglMmapSeal(opt);
+	if (seg) {
+		pthread_mutex_lock(&opt->rollLock);
+		seg->last = 1;
+		seg->next = opt->retired;
+		opt->retired = seg;
+		__atomic_store_n(&opt->cur, NULL, __ATOMIC_RELEASE);
+		seg->gp = cloglRcuMark();
+		pthread_mutex_unlock(&opt->rollLock);
+	}
+	cloglMmapReclaim(apd, 1);
+	__atomic_store_n(&apd->isOpen, 0, __ATOMIC_RELEASE);
+
+	return 0;
+}
+static int mmapFile_append(cloglApd *apd, int priority, const char *msg, size_t len)
+{
+	priority = priority;
+
+	cloglMmapFileOpt *opt = (cloglMmapFileOpt *)apd->opt;
+	size_t need = len + 2;
+
+	while (1) {
+		cloglMmapSeg *seg = __atomic_load_n(&opt->cur, __ATOMIC_ACQUIRE);
+		if (!seg) {
+			__atomic_store_n(&apd->isOpen, 0, __ATOMIC_RELEASE); // 下次重新打开
+			return -1;
+		}
+
+		size_t off = __atomic_fetch_add(&seg->pos, need, __ATOMIC_RELAXED);
+		if (off + need <= seg->size) {
+			memcpy(seg->base + off, msg, len);
+			seg->base[off + len] = '\r';
+			seg->base[off + len + 1] = '\n';
+			__atomic_fetch_add(&seg->done, need, __ATOMIC_RELEASE);
+			return 0;
+		}
+
+		if (off <= seg->size) {
+			// 第一个放不下的线程负责换段. 新段从off所在的页开始, 文件里不留空洞
+			__atomic_store_n(&seg->end, off, __ATOMIC_RELEASE);
+			if (cloglMmapSwitch(opt, seg, need, -1)) {
+				cloglErr("mmapFile_append map error");
+			}
+			cloglSchedAt(apd, cloglNowMs()); // 回收旧段
+			continue;
+		}
+
+		while (__atomic_load_n(&opt->cur, __ATOMIC_ACQUIRE) == seg)
+			sched_yield();
+	}
+}
+/* 信号处理函数里不能换段, 当前段放不下就不写 */
+static int mmapFile_sig(cloglApd *apd, const char *msg, size_t len)
+{
+	cloglMmapFileOpt *opt = (cloglMmapFileOpt *)apd->opt;
+	cloglMmapSeg *seg = opt ? __atomic_load_n(&opt->cur, __ATOMIC_ACQUIRE) : NULL;
+	if (!msg) {
+		return 0;
+	}
+	if (!seg) {
+		return -1;
+	}
+
+	size_t need = len + 2;
+	size_t off = __atomic_load_n(&seg->pos, __ATOMIC_RELAXED);
+	do {
+		if (off + need > seg->size) {
+			return -1;
+		}
+	} while (!__atomic_compare_exchange_n(&seg->pos, &off, off + need, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	memcpy(seg->base + off, msg, len);
+	seg->base[off + len] = '\r';
+	seg->base[off + len + 1] = '\n';
+	__atomic_fetch_add(&seg->done, need, __ATOMIC_RELEASE);
+
+	return 0;
+}
+/* 回收写完的段, 按时间换文件. 改名和打开新文件在锁外 */
+static int mmapFile_event(cloglApd *apd)
+{
+	cloglMmapFileOpt *opt = (cloglMmapFileOpt *)apd->opt;
+	if (!opt) {
+		return -1;
+	}
+
+	int64_t again = cloglMmapReclaim(apd, 0);
+	if (again) {
+		cloglSchedAt(apd, again);
+	}
+
+	pthread_mutex_lock(&apd->pLock);
+	time_t opened = opt->now;
+	int due = apd->isOpen && opt->span && opt->now && time(NULL) - opt->now >= opt->span;
+	if (!due && apd->isOpen && opt->span && opt->now) {
+		cloglSchedAt(apd, (int64_t)(opt->now + opt->span) * 1000);
+	}
+	pthread_mutex_unlock(&apd->pLock);
+	if (!due) {
+		return 0;
+	}
+
+	// 备份文件. 写线程还可以往旧映射里写, 数据会在改名后的文件里
+	char *backup = cloglFileRename(opt->fileName, opened, "%Y-%m-%d %X");
+	int fd = open(opt->fileName, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		cloglErr("mmapFile_event open error");
+		cloglSchedAt(apd, cloglNowMs() + 1000); // 过一会儿再试
+		free(backup);
+		return -1;
+	}
+
+	// 写线程不拿pLock, 锁只是挡住同时关闭
+	pthread_mutex_lock(&apd->pLock);
+	cloglMmapSeg *seg = apd->isOpen ? cloglMmapSeal(opt) : NULL;
+	if (!seg || cloglMmapSwitch(opt, seg, 0, fd)) {
+		pthread_mutex_unlock(&apd->pLock);
+		close(fd); // 没有段用上它
+		free(backup);
+		return -1;
+	}
+	opt->now = time(NULL);
+	cloglSchedAt(apd, (int64_t)(opt->now + opt->span) * 1000);
+	pthread_mutex_unlock(&apd->pLock);
+
+	again = cloglMmapReclaim(apd, 0);
+	if (again) {
+		cloglSchedAt(apd, again);
+	}
+	free(backup); // 整理交给回收完旧段以后
+
+
+	return 0;
+}
+static int mmapFile_init(cloglApd *apd, const char *fileName)
+{
+	if (!fileName || !fileName[0]) {
+		return -1;
+	}
+
+	cloglMmapFileOpt *opt = (cloglMmapFileOpt *)calloc(1, sizeof(cloglMmapFileOpt));
+	if (!opt) {
+		return -1;
+	}
+	opt->fileName = strdup(fileName);
+	if (!opt->fileName) {
+		free(opt);
+		return -1;
+	}
+	opt->segSize = CLOGL_MMAP_SEGMENT;
+	pthread_mutex_init(&opt->rollLock, NULL);
+	apd->opt = opt;
+
+	return 0;
+}
+static int mmapFile_set(cloglApd *apd, const char *key, const char *value)
+{
+	cloglMmapFileOpt *opt = (cloglMmapFileOpt *)apd->opt;
+	if (!opt) {
+		return -1;
+	}
+
+	if (!strcmp(key, "span")) {
+		int hours = atoi(value);
+		if (hours < 0) {
+			return -1;
+		}
+		opt->span = (time_t)hours * 60 * 60;
+		return 0;
+	} else if (!strcmp(key, "segment")) {
+		int mb = atoi(value);
+		if (mb <= 0) {
+			return -1;
+		}
+		opt->segSize = (size_t)mb * 1024 * 1024;
+		return 0;
+	}
+
+	return -1;
+}
+/* 内存映射文件 <<< */
+
+/* 飞行记录器 >>> */
+/*
+  文件开头是文件头, 后面是slots个slotSize字节的槽. 写线程原子加next拿到票号, 写进票号对应的槽.
+  槽头的seq: 正在写时是票号*2+1, 写完是票号*2+2. 崩溃时写了一半的槽seq是奇数, 读的时候跳过
+ */
+#define CLOGL_FR_MAGIC        "CLOGLFR1"
+#define CLOGL_FR_TRUNC        0x100   // 槽头level里的标志: 日志太长被截断了
+
+typedef struct _clogl_fr_head
+{
+	char magic[8];                    // CLOGL_FR_MAGIC. 文件头其他字段写好后最后写
+	uint32_t slotSize;                // 每个槽的字节数, 包括槽头
+	uint32_t slots;                   // 槽数. 2的幂
+	uint64_t next __attribute__((aligned(64))); // 下一个票号. 写线程竞争
+} __attribute__((aligned(64))) cloglFrHead;
+
+typedef struct _clogl_fr_slot
+{
+	uint64_t seq;                     // 票号*2+2 写完; 奇数 正在写
+	uint32_t len;                     // 日志长度
+	uint32_t level;                   // 日志级别 | CLOGL_FR_TRUNC
+	char data[];                      // 日志内容. 不带换行
+} cloglFrSlot;
+
+static inline cloglFrSlot *cloglFrAt(cloglFrHead *head, uint64_t ticket)
+{
+	return (cloglFrSlot *)((char *)(head + 1) + (ticket & (head->slots - 1)) * head->slotSize);
+}
+
+static int flightRec_open(cloglApd *apd)
+{
+	cloglFlightRecOpt *opt = (cloglFlightRecOpt *)apd->opt;
+	if (!opt || !opt->fileName || !opt->fileName[0]) {
+		return -1;
+	}
+
+	// 上次的(可能是崩溃留下的)留着给clogl-dump看
+	char *prev = (char *)malloc(strlen(opt->fileName) + 3);
+	if (prev) {
+		sprintf(prev, "%s.1", opt->fileName);
+		(void)rename(opt->fileName, prev);
+		free(prev);
+	}
+
+	int fd = open(opt->fileName, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		return -1;
+	}
+	size_t size = sizeof(cloglFrHead) + opt->slots * opt->slotSize;
+	// 先分配好, 写的时候不会因为磁盘满收到SIGBUS
+	if (fallocate(fd, 0, 0, size) && ((EOPNOTSUPP != errno && ENOSYS != errno) || ftruncate(fd, size))) {
+		close(fd);
+		return -1;
+	}
+	void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (MAP_FAILED == base) {
+		return -1;
+	}
+
+	cloglFrHead *head = (cloglFrHead *)base;
+	head->slotSize = (uint32_t)opt->slotSize;
+	head->slots = (uint32_t)opt->slots;
+	__atomic_store_n(&head->next, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(head->magic, CLOGL_FR_MAGIC, sizeof(head->magic));
+
+	opt->mapSize = size;
+	__atomic_store_n(&opt->head, head, __ATOMIC_RELEASE);
+	__atomic_store_n(&apd->isOpen, 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+/* 关闭时已经没有写线程了: 重新加载配置不换有这个类型的链 */
+static int flightRec_close(cloglApd *apd)
+{
+	cloglFlightRecOpt *opt = (cloglFlightRecOpt *)apd->opt;
+	if (!opt) {
+		return -1;
+	}
+
+	cloglFrHead *head = __atomic_exchange_n(&opt->head, NULL, __ATOMIC_ACQ_REL);
+	if (head) {
+		munmap(head, opt->mapSize);
+	}
+	__atomic_store_n(&apd->isOpen, 0, __ATOMIC_RELEASE);
+
+	return 0;
+}
+static int flightRec_append(cloglApd *apd, int priority, const char *msg, size_t len)
+{
+	cloglFlightRecOpt *opt = (cloglFlightRecOpt *)apd->opt;
+	cloglFrHead *head = __atomic_load_n(&opt->head, __ATOMIC_ACQUIRE);
+	if (!head) {
+		return -1;
+	}
+
+	uint64_t ticket = __atomic_fetch_add(&head->next, 1, __ATOMIC_RELAXED);
+	cloglFrSlot *slot = cloglFrAt(head, ticket);
+	size_t room = opt->slotSize - sizeof(cloglFrSlot);
+	uint32_t level = (uint32_t)priority;
+	if (len > room) {
+		len = room;
+		level |= CLOGL_FR_TRUNC;
+	}
+
+	__atomic_store_n(&slot->seq, ticket * 2 + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(slot->data, msg, len);
+	slot->len = (uint32_t)len;
+	slot->level = level;
+	__atomic_store_n(&slot->seq, ticket * 2 + 2, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/* 本来就只是memcpy */
+static int flightRec_sig(cloglApd *apd, const char *msg, size_t len)
+{
+	return msg ? flightRec_append(apd, CLOGL_LEVEL_ERR, msg, len) : 0;
+}
+
+static int flightRec_init(cloglApd *apd, const char *fileName)
+{
+	if (!fileName || !fileName[0]) {
+		return -1;
+	}
+
+	cloglFlightRecOpt *opt = (cloglFlightRecOpt *)calloc(1, sizeof(cloglFlightRecOpt));
+	if (!opt) {
+		return -1;
+	}
+	opt->fileName = strdup(fileName);
+	if (!opt->fileName) {
+		free(opt);
+		return -1;
+	}
+	opt->slotSize = CLOGL_FR_SLOT;
+	opt->slots = CLOGL_FR_SLOTS;
+	apd->opt = opt;
+
+	return 0;
+}
+static int flightRec_set(cloglApd *apd, const char *key, const char *value)
+{
+	cloglFlightRecOpt *opt = (cloglFlightRecOpt *)apd->opt;
+	if (!opt || apd->isOpen) {
+		return -1;
+	}
+
+	if (!strcmp(key, "slotSize")) {
+		long n = atol(value);
+		if (n < 64 || n > 65536) {
+			return -1;
+		}
+		opt->slotSize = ((size_t)n + 7) & ~(size_t)7;
+		return 0;
+	} else if (!strcmp(key, "slots")) {
+		long n = atol(value);
+		if (n <= 0 || n > (1L << 24)) {
+			return -1;
+		}
+		size_t slots = 1;
+		while (slots < (size_t)n) {
+			slots <<= 1;
+		}
+		opt->slots = slots;
+		return 0;
+	}
+
+	return -1;
+}
+
+/*
+  按票号顺序输出还在环里的日志. 返回跳过的槽数(写了一半, 或者被后来的覆盖了)
+ */
+static int cloglFrDump(const uint8_t *base, size_t size, FILE *out)
+{
+	const cloglFrHead *head = (const cloglFrHead *)base;
+	if (size < sizeof(cloglFrHead) || head->slotSize < sizeof(cloglFrSlot) || !head->slots || (head->slots & (head->slots - 1))
+		|| (size - sizeof(cloglFrHead)) / head->slotSize < head->slots) {
+		return -1;
+	}
+
+	uint64_t next = head->next;
+	uint64_t ticket = (next > head->slots) ? next - head->slots : 0;
+	int bad = 0;
+	for (; ticket < next; ticket++) {
+		const cloglFrSlot *slot = cloglFrAt((cloglFrHead *)head, ticket);
+		if (slot->seq != ticket * 2 + 2 || slot->len > head->slotSize - sizeof(cloglFrSlot)) {
+			bad ++;
+			continue;
+		}
+		fwrite(slot->data, 1, slot->len, out);
+		fputs((slot->level & CLOGL_FR_TRUNC) ? "...\n" : "\n", out);
+	}
+
+	return bad;
+}
+/* 飞行记录器 <<< */
+
+/* io_uring文件 >>> */
+/*
+  io_uring和它的缓冲. 只在输出方向的pLock里用, 不用再加锁
+ */
+typedef struct _clogl_uring
+{
+	int ringFd;                              // io_uring_setup返回的fd
+	void *sqMap;                             // 提交队列的映射
+	size_t sqMapLen;
+	void *cqMap;                             // 完成队列的映射. IORING_FEAT_SINGLE_MMAP时和sqMap是同一个
+	size_t cqMapLen;
+	struct io_uring_sqe *sqes;               // 提交项数组
+	size_t sqesLen;
+	unsigned *sqTail, *sqMask, *sqArray;
+	unsigned *cqHead, *cqTail, *cqMask;
+	struct io_uring_cqe *cqes;
+	int fd;                                  // 日志文件. 注册成0号固定文件
+	off_t off;                               // 下一批写到文件的位置
+	char *bufs;                              // CLOGL_URING_BUFS个缓冲连在一起, 注册给内核
+	size_t bufSize;                          // 每个缓冲的字节数
+	int cur;                                 // 正在攒日志的缓冲
+	size_t used;                             // 正在攒的缓冲里的字节数
+	struct timespec first;                   // 正在攒的缓冲里最早一条日志的时间
+	int inflight;                            // 交给内核还没完成的批数
+	int busy[CLOGL_URING_BUFS];              // 缓冲正在被内核写
+	size_t len[CLOGL_URING_BUFS];            // 交给内核的长度
+	off_t at[CLOGL_URING_BUFS];              // 交给内核的文件位置
+} cloglUring;
+
+#define CLOGL_URING_DEPTH     (CLOGL_URING_BUFS * 2)   // 每批一个写加一个fsync
+#define CLOGL_URING_FSYNC     CLOGL_URING_BUFS         // fsync完成项的user_data
+
+static int cloglUringEnter(int ringFd, unsigned submit, unsigned wait, unsigned flags)
+{
+	int rst;
+	do {
+		rst = syscall(__NR_io_uring_enter, ringFd, submit, wait, flags, NULL, 0);
+	} while (rst < 0 && EINTR == errno);
+
+	return rst;
+}
+
+/*
+  在off处把buf全部写进fd
+ */
+static int cloglPwriteAll(int fd, const char *buf, size_t len, off_t off)
+{
+	while (len > 0) {
+		ssize_t n = pwrite(fd, buf, len, off);
+		if (n < 0) {
+			if (EINTR == errno) {
+				continue;
+			}
+			return -1;
+		}
+		buf += n;
+		len -= n;
+		off += n;
+	}
+
+	return 0;
+}
+
+static void cloglUringFree(cloglUring *r)
+{
+	if (r->ringFd >= 0) {
+		close(r->ringFd); // 关掉ring同时解除缓冲和文件的注册
+	}
+	if (r->sqes) {
+		munmap(r->sqes, r->sqesLen);
+	}
+	if (r->cqMap && r->cqMap != r->sqMap) {
+		munmap(r->cqMap, r->cqMapLen);
+	}
+	if (r->sqMap) {
+		munmap(r->sqMap, r->sqMapLen);
+	}
+	if (r->bufs) {
+		munmap(r->bufs, r->bufSize * CLOGL_URING_BUFS);
+	}
+	free(r);
+}
+
+/*
+  给fd建一个io_uring, 注册缓冲和文件. 内核不支持或者被禁用时返回NULL
+ */
+static cloglUring *cloglUringSetup(int fd, off_t off, size_t bufSize)
+{
+	cloglUring *r = (cloglUring *)calloc(1, sizeof(cloglUring));
+	if (!r) {
+		return NULL;
+	}
+	r->fd = fd;
+	r->off = off;
+
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	r->ringFd = syscall(__NR_io_uring_setup, CLOGL_URING_DEPTH, &p);
+	if (r->ringFd < 0) {
+		free(r);
+		return NULL;
+	}
+
+	r->sqMapLen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cqMapLen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (r->cqMapLen > r->sqMapLen) {
+			r->sqMapLen = r->cqMapLen;
+		}
+		r->cqMapLen = r->sqMapLen;
+	}
+	r->sqMap = mmap(NULL, r->sqMapLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->ringFd, IORING_OFF_SQ_RING);
+	if (MAP_FAILED == r->sqMap) {
+		r->sqMap = NULL;
+		goto err;
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		r->cqMap = r->sqMap;
+	} else {
+		r->cqMap = mmap(NULL, r->cqMapLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->ringFd, IORING_OFF_CQ_RING);
+		if (MAP_FAILED == r->cqMap) {
+			r->cqMap = NULL;
+			goto err;
+		}
+	}
+	r->sqesLen = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = (struct io_uring_sqe *)mmap(NULL, r->sqesLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->ringFd, IORING_OFF_SQES);
+	if (MAP_FAILED == (void *)r->sqes) {
+		r->sqes = NULL;
+		goto err;
+	}
+	r->sqTail = (unsigned *)((char *)r->sqMap + p.sq_off.tail);
+	r->sqMask = (unsigned *)((char *)r->sqMap + p.sq_off.ring_mask);
+	r->sqArray = (unsigned *)((char *)r->sqMap + p.sq_off.array);
+	r->cqHead = (unsigned *)((char *)r->cqMap + p.cq_off.head);
+	r->cqTail = (unsigned *)((char *)r->cqMap + p.cq_off.tail);
+	r->cqMask = (unsigned *)((char *)r->cqMap + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)((char *)r->cqMap + p.cq_off.cqes);
+
+	// 缓冲注册后内核不用每次再映射用户页
+	r->bufSize = bufSize;
+	r->bufs = (char *)mmap(NULL, bufSize * CLOGL_URING_BUFS, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (MAP_FAILED == r->bufs) {
+		r->bufs = NULL;
+		goto err;
+	}
+	struct iovec iov[CLOGL_URING_BUFS];
+	for (int i = 0; i < CLOGL_URING_BUFS; i++) {
+		iov[i].iov_base = r->bufs + i * bufSize;
+		iov[i].iov_len = bufSize;
+	}
+	if (syscall(__NR_io_uring_register, r->ringFd, IORING_REGISTER_BUFFERS, iov, CLOGL_URING_BUFS)) {
+		goto err;
+	}
+	if (syscall(__NR_io_uring_register, r->ringFd, IORING_REGISTER_FILES, &fd, 1)) {
+		goto err;
+	}
+
+	return r;
+
+err:
+	cloglUringFree(r);
+	return NULL;
+}
+
+/*
+  处理完成项. 出错或者只写了一部分的批, 剩下的同步补写
+ */
+static void cloglUringReap(cloglUring *r)
+{
+	unsigned head = *r->cqHead;
+	while (head != __atomic_load_n(r->cqTail, __ATOMIC_ACQUIRE)) {
+		struct io_uring_cqe *cqe = &r->cqes[head & *r->cqMask];
+		if (cqe->user_data < CLOGL_URING_BUFS) {
+			int i = (int)cqe->user_data;
+			size_t done = (cqe->res > 0) ? (size_t)cqe->res : 0;
+			if (done < r->len[i]) {
+				if (cloglPwriteAll(r->fd, r->bufs + i * r->bufSize + done, r->len[i] - done, r->at[i] + done)) {
+					cloglErr("cloglUringReap write error");
+				}
+			}
+			r->busy[i] = 0;
+			r->inflight --;
+		} else if (cqe->res < 0 && -ECANCELED != cqe->res) {
+			cloglErr("cloglUringReap fsync error");
+		}
+		head ++;
+	}
+	__atomic_store_n(r->cqHead, head, __ATOMIC_RELEASE);
+}
+
+/*
+  等内核完成至少一批
+ */
+static void cloglUringWait(cloglUring *r)
+{
+	if (r->inflight > 0) {
+		(void)cloglUringEnter(r->ringFd, 0, 1, IORING_ENTER_GETEVENTS);
+	}
+	cloglUringReap(r);
+}
+
+/*
+  把正在攒的缓冲交给内核, 换一个空闲缓冲接着攒. 只在没有空闲缓冲时等
+ */
+static int cloglUringSubmit(cloglUring *r, int fsync)
+{
+	if (0 == r->used) {
+		return 0;
+	}
+
+	unsigned tail = *r->sqTail;
+	unsigned mask = *r->sqMask;
+	struct io_uring_sqe *sqe = &r->sqes[tail & mask];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_WRITE_FIXED;
+	sqe->flags = IOSQE_FIXED_FILE | IOSQE_ASYNC | (fsync ? IOSQE_IO_LINK : 0); // 直接进内核工作线程, 提交不会卡在写回上
+	sqe->fd = 0;
+	sqe->addr = (uint64_t)(uintptr_t)(r->bufs + r->cur * r->bufSize);
+	sqe->len = r->used;
+	sqe->off = r->off;
+	sqe->buf_index = r->cur;
+	sqe->user_data = r->cur;
+	r->sqArray[tail & mask] = tail & mask;
+	tail ++;
+	unsigned n = 1;
+	if (fsync) {
+		sqe = &r->sqes[tail & mask];
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = IORING_OP_FSYNC;
+		sqe->flags = IOSQE_FIXED_FILE | IOSQE_ASYNC;
+		sqe->fd = 0;
+		sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+		sqe->user_data = CLOGL_URING_FSYNC;
+		r->sqArray[tail & mask] = tail & mask;
+		tail ++;
+		n ++;
+	}
+	__atomic_store_n(r->sqTail, tail, __ATOMIC_RELEASE);
+
+	r->busy[r->cur] = 1;
+	r->len[r->cur] = r->used;
+	r->at[r->cur] = r->off;
+	r->off += r->used;
+	r->used = 0;
+	r->inflight ++;
+
+	while (cloglUringEnter(r->ringFd, n, 0, 0) < 0) {
+		if (EAGAIN != errno && EBUSY != errno) {
+			cloglErr("cloglUringSubmit io_uring_enter error");
+			return -1;
+		}
+		cloglUringWait(r);
+	}
+
+	cloglUringReap(r);
+	while (1) {
+		for (int i = 1; i <= CLOGL_URING_BUFS; i++) {
+			int j = (r->cur + i) % CLOGL_URING_BUFS;
+			if (!r->busy[j]) {
+				r->cur = j;
+				return 0;
+			}
+		}
+		cloglUringWait(r);
+	}
+}
+
+/*
+  交出正在攒的缓冲并等所有批写完
+ */
+static int cloglUringDrain(cloglUring *r, int fsync)
+{
+	int rst = cloglUringSubmit(r, fsync);
+	while (r->inflight > 0) {
+		cloglUringWait(r);
+	}
+
+	return rst;
+}
+
+static int uringFile_open(cloglApd *apd)
+{
+	cloglUringFileOpt *opt = (cloglUringFileOpt *)apd->opt;
+	if (!opt || !opt->fileName || !opt->fileName[0]) {
+		return -1;
+	}
+
+	// 每批写在自己算好的位置上, 不能用O_APPEND. 同一个文件只能有这一个写者
+	int fd = open(opt->fileName, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		return -1;
+	}
+	struct stat st;
+	size_t bufSize = (apd->flushBytes > CLOGL_FILE_BUFF) ? apd->flushBytes : CLOGL_FILE_BUFF;
+	opt->ring = fstat(fd, &st) ? NULL : cloglUringSetup(fd, st.st_size, bufSize);
+	if (!opt->ring) {
+		// 没有io_uring, 退回普通文件
+		close(fd);
+		if (cloglFileOpen(&opt->out, opt->fileName)) {
+			return -1;
+		}
+	}
+
+	opt->now = time(NULL); // 打开时间
+	apd->isOpen = 1;
+	cloglSchedAt(apd, (int64_t)(opt->now + opt->span) * 1000);
+
+	return 0;
+}
+static int uringFile_close(cloglApd *apd)
+{
+	cloglUringFileOpt *opt = (cloglUringFileOpt *)apd->opt;
+	if (!opt) {
+		return -1;
+	}
+
+	int rst = 0;
+	if (opt->ring) {
+		rst = cloglUringDrain(opt->ring, opt->fsync);
+		int fd = opt->ring->fd;
+		cloglUringFree(opt->ring);
+		opt->ring = NULL;
+		if (close(fd)) {
+			rst = -1;
+		}
+	} else if (opt->out.fd >= 0) {
+		rst = cloglFileClose(&opt->out);
+	}
+	apd->isOpen = 0;
+
+	return rst;
+}
+static int uringFile_append(cloglApd *apd, int priority, const char *msg, size_t len)
+{
+	cloglUringFileOpt *opt = (cloglUringFileOpt *)apd->opt;
+	if (!opt || !msg) {
+		return -1;
+	}
+	if (!opt->ring) {
+		return cloglFileAppend(apd, &opt->out, priority, msg, len);
+	}
+
+	cloglUring *r = opt->ring;
+	if (r->used + len + 2 > r->bufSize) {
+		if (cloglUringSubmit(r, opt->fsync)) {
+			return -1;
+		}
+		if (len + 2 > r->bufSize) {
+			// 比缓冲还大的一条, 等前面的都写完直接写
+			(void)cloglUringDrain(r, 0);
+			if (cloglPwriteAll(r->fd, msg, len, r->off) || cloglPwriteAll(r->fd, "\r\n", 2, r->off + len)) {
+				return -1;
+			}
+			r->off += len + 2;
+			return 0;
+		}
+	}
+
+	if (0 == r->used) {
+		clock_gettime(CLOCK_MONOTONIC_COARSE, &r->first);
+		if (apd->flushMs > 0) {
+			cloglSchedAt(apd, cloglNowMs() + apd->flushMs);
+		}
+	}
+	char *buf = r->bufs + r->cur * r->bufSize;
+	memcpy(buf + r->used, msg, len);
+	buf[r->used + len] = '\r';
+	buf[r->used + len + 1] = '\n';
+	r->used += len + 2;
+
+	if ((0 == apd->flushBytes) || (r->used >= apd->flushBytes) || (priority != CLOGL_LEVEL_DATA && priority <= apd->flushLevel)) {
+		return cloglUringSubmit(r, opt->fsync);
+	}
+
+	return 0;
+}
+
+/* 正在攒的缓冲和这一条直接pwrite到后面. 已经交给内核的批内核会写完 */
+static int uringFile_sig(cloglApd *apd, const char *msg, size_t len)
+{
+	cloglUringFileOpt *opt = (cloglUringFileOpt *)apd->opt;
+	if (!opt) {
+		return -1;
+	}
+	if (!opt->ring) {
+		return cloglFileSig(&opt->out, msg, len);
+	}
+
+	cloglUring *r = opt->ring;
+	size_t used = r->used;
+	r->used = 0;
+	int rst = 0;
+	if (used) {
+		rst = cloglPwriteAll(r->fd, r->bufs + r->cur * r->bufSize, used, r->off);
+		r->off += used;
+	}
+	if (msg) {
+		if (cloglPwriteAll(r->fd, msg, len, r->off) || cloglPwriteAll(r->fd, "\r\n", 2, r->off + len)) {
+			rst = -1;
+		}
+		r->off += len + 2;
+	}
+
+	return rst;
+}
+
+/* 等所有批写完 */
+static int uringFile_flush(cloglApd *apd)
+{
+	cloglUringFileOpt *opt = (cloglUringFileOpt *)apd->opt;
+	if (!opt) {
+		return -1;
+	}
+	if (opt->ring) {
+		return cloglUringDrain(opt->ring, opt->fsync);
+	}
+
+	return cloglFileFlush(&opt->out);
+}
+/* 按时间的刷新策略, 按时间间隔换日志文件. 新文件和新io_uring在锁外准备好 */
+static int uringFile_event(cloglApd *apd)
+{
+	cloglUringFileOpt *opt = (cloglUringFileOpt *)apd->opt;
+	if (!opt) {
+		return -1;
+	}
+
+	pthread_mutex_lock(&apd->pLock);
+	if (0 == apd->isOpen) { // 还没记日志
+		pthread_mutex_unlock(&apd->pLock);
+		return 0;
+	}
+	cloglUring *r = opt->ring;
+	if (r) {
+		cloglUringReap(r);
+		if (r->used && apd->flushMs > 0) {
+			struct timespec ts;
+			clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+			long ms = (ts.tv_sec - r->first.tv_sec) * 1000 + (ts.tv_nsec - r->first.tv_nsec) / 1000000;
+			if (ms >= apd->flushMs) {
+				(void)cloglUringSubmit(r, opt->fsync);
+			} else {
+				cloglSchedAt(apd, cloglNowMs() + apd->flushMs - ms);
+			}
+		}
+	} else {
+		(void)cloglFileTick(apd, &opt->out);
+	}
+	time_t opened = opt->now;
+	int due = opt->now && opt->span && time(NULL) - opt->now >= opt->span;
+	if (!due && opt->now && opt->span) {
+		cloglSchedAt(apd, (int64_t)(opt->now + opt->span) * 1000);
+	}
+	size_t bufSize = (apd->flushBytes > CLOGL_FILE_BUFF) ? apd->flushBytes : CLOGL_FILE_BUFF;
+	pthread_mutex_unlock(&apd->pLock);
+	if (!due) {
+		return 0;
+	}
+
+	// 备份文件, 准备新文件
+	char *backup = cloglFileRename(opt->fileName, opened, "%Y-%m-%d %X");
+	cloglUring *ring = NULL;
+	int fd = open(opt->fileName, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+	if (fd >= 0) {
+		struct stat st;
+		ring = fstat(fd, &st) ? NULL : cloglUringSetup(fd, st.st_size, bufSize);
+		if (!ring) {
+			close(fd);
+			fd = cloglFileOpenFd(opt->fileName);
+		}
+	}
+	if (fd < 0) {
+		cloglErr("uringFile_event open error");
+		cloglSchedAt(apd, cloglNowMs() + 1000); // 过一会儿再试
+		free(backup);
+		return -1;
+	}
+
+	pthread_mutex_lock(&apd->pLock);
+	if (0 == apd->isOpen) { // 已经被关了
+		pthread_mutex_unlock(&apd->pLock);
+		if (ring) {
+			cloglUringFree(ring);
+		}
+		close(fd);
+		free(backup);
+		return 0;
+	}
+	cloglUring *oldRing = opt->ring;
+	int oldFd = -1;
+	if (oldRing) {
+		(void)cloglUringSubmit(oldRing, opt->fsync);
+	} else {
+		(void)cloglFileFlush(&opt->out);
+		oldFd = opt->out.fd;
+	}
+	opt->ring = ring;
+	opt->out.fd = ring ? -1 : fd;
+	opt->now = time(NULL);
+	cloglSchedAt(apd, (int64_t)(opt->now + opt->span) * 1000);
+	pthread_mutex_unlock(&apd->pLock);
+
+	// 旧的在锁外等写完再关
+	if (oldRing) {
+		(void)cloglUringDrain(oldRing, opt->fsync);
+		oldFd = oldRing->fd;
+		cloglUringFree(oldRing);
+	}
+	if (oldFd >= 0) {
+		close(oldFd);
+	}
+	cloglZipPush(apd, opt->fileName, backup);
+	free(backup);
+
+	return 0;
+}
+static int uringFile_init(cloglApd *apd, const char *fileName)
+{
+	if (!fileName || !fileName[0]) {
+		return -1;
+	}
+
+	cloglUringFileOpt *opt = (cloglUringFileOpt *)calloc(1, sizeof(cloglUringFileOpt));
+	if (!opt) {
+		return -1;
+	}
+	opt->fileName = strdup(fileName);
+	if (!opt->fileName) {
+		free(opt);
+		return -1;
+	}
+	opt->out.fd = -1;
+	opt->span = 1 * 60 * 60; // 默认简隔1小时
+	apd->opt = opt;
+
+	return 0;
+}
+static int uringFile_set(cloglApd *apd, const char *key, const char *value)
+{
+	cloglUringFileOpt *opt = (cloglUringFileOpt *)apd->opt;
+	if (!opt) {
+		return -1;
+	}
+
+	if (!strcmp(key, "span")) {
+		int hours = atoi(value);
+		if (hours <= 0) {
+			return -1;
+		}
+		opt->span = (time_t)hours * 60 * 60;
+		return 0;
+	} else if (!strcmp(key, "fsync")) {
+		opt->fsync = (atoi(value) != 0);
+		return 0;
+	}
+
+	return -1;
+}
+/* io_uring文件 <<< */
+
+/* 按文件大小产生新的文件. 单位兆 >>>*/
+#define CLOGL_SIZEFILE_CHECK  1       // 多少秒和路径比较一次inode
+
+static int sizeFile_open(cloglApd *apd)
+{
+	cloglSizeFileOpt *opt = (cloglSizeFileOpt *)apd->opt;
+	if (!opt || !opt->fileName || !opt->fileName[0]) {
+		return -1;
+	}
+
+	if (cloglFileOpen(&opt->out, opt->fileName)) {
+		return -1;
+	}
+	struct stat st;
+	if (fstat(opt->out.fd, &st)) {
+		(void)cloglFileClose(&opt->out);
+		return -1;
+	}
+	opt->size = st.st_size;
+	opt->dev = st.st_dev;
+	opt->ino = st.st_ino;
+	opt->checked = time(NULL);
+	opt->rolling = 0;
+	opt->rollFailed = 0;
+	apd->isOpen = 1;
+
+	return 0;
+}
+static int sizeFile_close(cloglApd *apd)
+{
+	cloglSizeFileOpt *opt = (cloglSizeFileOpt *)apd->opt;
+	if (!opt) {
+		return -1;
+	}
+
+	int rst = cloglFileClose(&opt->out);
+	apd->isOpen = 0;
+
+	return rst;
+}
+
+/*
+  备份往后挪一个: fileName.(N-1) -> fileName.N ... fileName -> fileName.1.
+  没有备份也先挪到fileName.1, 换完fd再删, 换fd之前写的日志不会写进已经删掉的文件里
+ */
+static int sizeFile_roll(cloglSizeFileOpt *opt)
+{
+	size_t len = strlen(opt->fileName) + 16;
+	char *from = (char *)malloc(len);
+	char *to = (char *)malloc(len);
+	if (!from || !to) {
+		free(from);
+		free(to);
+		return -1;
+	}
+
+	for (int i = opt->backups - 1; i >= 1; i--) {
+		snprintf(from, len, "%s.%d", opt->fileName, i);
+		snprintf(to, len, "%s.%d", opt->fileName, i + 1);
+		if (rename(from, to) && ENOENT != errno) {
+			cloglErr("sizeFile_roll rename error");
+		}
+	}
+	snprintf(to, len, "%s.1", opt->fileName);
+	int rst = rename(opt->fileName, to);
+
+	free(from);
+	free(to);
+
+	return rst;
+}
+
+static int sizeFile_append(cloglApd *apd, int priority, const char *msg, size_t len)
+{
+	cloglSizeFileOpt *opt = (cloglSizeFileOpt *)apd->opt;
+	if (!opt || !msg) {
+		return -1;
+	}
+
+	int rst = cloglFileAppend(apd, &opt->out, priority, msg, len);
+	if (0 == rst) {
+		// 写失败了文件没变大, 不能因此换文件
+		opt->size += len + 2;
+	}
+	if (opt->size >= opt->maxSize && !opt->rolling) {
+		// 写满了. 改名和打开新文件交给事件线程在锁外做, 换fd之前的日志还写旧文件
+		opt->rolling = 1;
+		cloglSchedAt(apd, cloglNowMs());
+	} else if (0 == __atomic_load_n(&apd->deadline, __ATOMIC_RELAXED)) {
+		// 有写才需要看文件还在不在
+		cloglSchedAt(apd, (int64_t)(opt->checked + CLOGL_SIZEFILE_CHECK) * 1000);
+	}
+
+	return rst;
+}
+
+static int sizeFile_sig(cloglApd *apd, const char *msg, size_t len)
+{
+	cloglSizeFileOpt *opt = (cloglSizeFileOpt *)apd->opt;
+	if (!opt) {
+		return -1;
+	}
+	int rst = cloglFileSig(&opt->out, msg, len);
+	if (msg && 0 == rst) {
+		opt->size += len + 2;
+	}
+	return rst;
+}
+
+static int sizeFile_flush(cloglApd *apd)
+{
+	cloglSizeFileOpt *opt = (cloglSizeFileOpt *)apd->opt;
+	if (!opt) {
+		return -1;
+	}
+
+	return cloglFileFlush(&opt->out);
+}
+/*
+  按时间的刷新策略. 写满了或者文件被删被移走了, 就在锁外改名和打开新文件, 锁里只换fd, 旧fd在锁外关
+ */
+static int sizeFile_event(cloglApd *apd)
+{
+	cloglSizeFileOpt *opt = (cloglSizeFileOpt *)apd->opt;
+	if (!opt) {
+		return -1;
+	}
+
+	pthread_mutex_lock(&apd->pLock);
+	if (0 == apd->isOpen || opt->out.fd < 0) { // 还没记日志
+		pthread_mutex_unlock(&apd->pLock);
+		return 0;
+	}
+	(void)cloglFileTick(apd, &opt->out);
+	time_t nowTime = time(NULL);
+	int roll = opt->rolling && (!opt->rollFailed || nowTime - opt->checked >= CLOGL_SIZEFILE_CHECK);
+	if (!roll && nowTime - opt->checked < CLOGL_SIZEFILE_CHECK) {
+		cloglSchedAt(apd, (int64_t)(opt->checked + CLOGL_SIZEFILE_CHECK) * 1000);
+		pthread_mutex_unlock(&apd->pLock);
+		return 0;
+	}
+	opt->checked = nowTime;
+	dev_t dev = opt->dev;
+	ino_t ino = opt->ino;
+	pthread_mutex_unlock(&apd->pLock);
+
+	struct stat st;
+	if (roll) {
+		if (sizeFile_roll(opt)) {
+			cloglErr("sizeFile_event roll error");
+			// 还写旧文件, 过CLOGL_SIZEFILE_CHECK秒再试. 不退避的话每条日志都会再挪一遍备份
+			pthread_mutex_lock(&apd->pLock);
+			opt->rollFailed = 1;
+			cloglSchedAt(apd, (int64_t)(opt->checked + CLOGL_SIZEFILE_CHECK) * 1000);
+			pthread_mutex_unlock(&apd->pLock);
+			return -1;
+		}
+	} else if (!stat(opt->fileName, &st) && st.st_dev == dev && st.st_ino == ino) {
+		return 0;
+	}
+
+	int fd = cloglFileOpenFd(opt->fileName);
+	if (fd < 0 || fstat(fd, &st)) {
+		if (fd >= 0) {
+			close(fd);
+		}
+		cloglErr("sizeFile_event open error");
+		pthread_mutex_lock(&apd->pLock);
+		opt->rolling = 0; // 文件已经挪走了, 过一会儿按文件不见了重新打开
+		pthread_mutex_unlock(&apd->pLock);
+		cloglSchedAt(apd, cloglNowMs() + 1000);
+		return -1;
+	}
+
+	pthread_mutex_lock(&apd->pLock);
+	if (0 == apd->isOpen || opt->out.fd < 0 || opt->dev != dev || opt->ino != ino) {
+		// 关了或者已经换过文件了
+		pthread_mutex_unlock(&apd->pLock);
+		close(fd);
+		return 0;
+	}
+	(void)cloglFileFlush(&opt->out); // 缓冲里的属于旧文件
+	int oldFd = opt->out.fd;
+	opt->out.fd = fd;
+	opt->size = st.st_size;
+	opt->dev = st.st_dev;
+	opt->ino = st.st_ino;
+	opt->rolling = 0;
+	opt->rollFailed = 0;
+	pthread_mutex_unlock(&apd->pLock);
+
+	close(oldFd);
+	if (roll) {
+		if (opt->backups <= 0) {
+			size_t len = strlen(opt->fileName) + 16;
+			char *old = (char *)malloc(len);
+			if (old) {
+				snprintf(old, len, "%s.1", opt->fileName);
+				(void)unlink(old);
+				free(old);
+			}
+		}
+		cloglZipPush(apd, opt->fileName, NULL);
+	}
+
+	return 0;
+}
+static int sizeFile_init(cloglApd *apd, const char *fileName)
+{
+	if (!fileName || !fileName[0]) {
+		return -1;
+	}
+
+	cloglSizeFileOpt *opt = (cloglSizeFileOpt *)calloc(1, sizeof(cloglSizeFileOpt));
+	if (!opt) {
+		return -1;
+	}
+	opt->fileName = strdup(fileName);
+	if (!opt->fileName) {
+		free(opt);
+		return -1;
+	}
+	opt->out.fd = -1;
+	opt->maxSize = (off_t)100 * 1024 * 1024; // 默认100兆
+	opt->backups = 5;
+	apd->opt = opt;
+
+	return 0;
+}
+static int sizeFile_set(cloglApd *apd, const char *key, const char *value)
+{
+	cloglSizeFileOpt *opt = (cloglSizeFileOpt *)apd->opt;
+	if (!opt) {
+		return -1;
+	}
+
+	if (!strcmp(key, "maxSize")) {
+		int mb = atoi(value);
+		if (mb <= 0) {
+			return -1;
+		}
+		opt->maxSize = (off_t)mb * 1024 * 1024;
+		return 0;
+	} else if (!strcmp(key, "backups")) {
+		int n = atoi(value);
+		if (n < 0) {
+			return -1;
+		}
+		opt->backups = n;
+		return 0;
+	}
+
+	return -1;
+}
+/* 按文件大小产生新的文件. 单位兆 <<<*/
+
+/* 二进制日志文件. 要用到后面延迟格式化的参数编码 */
+static int binFile_open(cloglApd *apd);
+static int binFile_append(cloglApd *apd, int priority, const char *msg, size_t len);
+static int binFile_close(cloglApd *apd);
+static int binFile_event(cloglApd *apd);
+static int binFile_flush(cloglApd *apd);
+static int binFile_init(cloglApd *apd, const char *fileName);
+static int binFile_set(cloglApd *apd, const char *key, const char *value);
+static int binFile_record(cloglApd *apd, const cloglRec *rec, int err, const char *args, size_t len);
+
+static cloglApdT cloglApdTypes[9] = {
+	{(char *)"Console", term_open, term_append, term_close, NULL, NULL, NULL, NULL, 0, NULL, term_sig},
+	{(char *)"TimeFile", timeFile_open, timeFile_append, timeFile_close, timeFile_event, timeFile_flush, timeFile_init, timeFile_set, 0, NULL, timeFile_sig},
+	{(char *)"HourFile", hourFile_open, timeFile_append, timeFile_close, hourFile_event, timeFile_flush, timeFile_init, timeFile_set, 0, NULL, timeFile_sig},
+	{(char *)"MmapFile", mmapFile_open, mmapFile_append, mmapFile_close, mmapFile_event, NULL, mmapFile_init, mmapFile_set, 1, NULL, mmapFile_sig},
+	{(char *)"UringFile", uringFile_open, uringFile_append, uringFile_close, uringFile_event, uringFile_flush, uringFile_init, uringFile_set, 0, NULL, uringFile_sig},
+	{(char *)"SizeFile", sizeFile_open, sizeFile_append, sizeFile_close, sizeFile_event, sizeFile_flush, sizeFile_init, sizeFile_set, 0, NULL, sizeFile_sig},
+	{(char *)"BinFile", binFile_open, binFile_append, binFile_close, binFile_event, binFile_flush, binFile_init, binFile_set, 0, binFile_record, NULL},
+	{(char *)"FlightRecorder", flightRec_open, flightRec_append, flightRec_close, NULL, NULL, flightRec_init, flightRec_set, 1, NULL, flightRec_sig},
+	{NULL , NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0, NULL, NULL}
+};
+
+static cloglApdT* cloglGetApd(const char *name)
+{
+	if (!name || !name[0])
+		return NULL;
+
+	for (cloglApdT *tmpapdt = &cloglApdTypes[0]; tmpapdt->name; tmpapdt++) {
+		if (!strcmp(name, tmpapdt->name)) {
+			return tmpapdt;
+		}
+	}
+
+	return NULL;
+}
+
+/* 读输出方向链 >>> */
+/*
+  重新加载配置时会换掉日志对象的输出方向链. 写日志的线程读链不加锁, 只在进出时写自己的读者槽;
+  换链的线程发布新链以后等所有在换链前进来的读者出去, 才能关掉释放旧链 (RCU)
+ */
+typedef struct _clogl_rcu_reader
+{
+	unsigned long gp;                 // 进来时的宽限期序号. 0 不在读
+	int nest;                         // 嵌套层数. 只有自己的线程改
+	int linked;                       // 在读者链里
+	struct _clogl_rcu_reader *next;
+	struct _clogl_rcu_reader **prev;
+} cloglRcuReader;
+
+static unsigned long cloglRcuGp = 1;                       // 宽限期序号. 只增不减
+static cloglRcuReader *cloglRcuReaders;                    // 所有读过的线程
+static pthread_mutex_t cloglRcuLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t cloglRcuKey;
+static pthread_once_t cloglRcuOnce = PTHREAD_ONCE_INIT;
+static __thread cloglRcuReader cloglRcuMe;
+
+/*
+  线程退出时把自己的读者槽摘下来. 槽在线程局部存储里, 线程没了槽也没了
+ */
+static void cloglRcuUnlink(void *parm)
+{
+	cloglRcuReader *r = (cloglRcuReader *)parm;
+
+	pthread_mutex_lock(&cloglRcuLock);
+	if (r->linked) {
+		if (r->next) {
+			r->next->prev = r->prev;
+		}
+		*r->prev = r->next;
+		r->linked = 0;
+	}
+	pthread_mutex_unlock(&cloglRcuLock);
+}
+
+/*
+  fork出来的子进程只有调fork的线程, 别的线程的槽作废
+ */
+static void cloglRcuAtfork()
+{
+	pthread_mutex_init(&cloglRcuLock, NULL);
+	cloglRcuReaders = NULL;
+	if (cloglRcuMe.linked) {
+		cloglRcuMe.next = NULL;
+		cloglRcuMe.prev = &cloglRcuReaders;
+		cloglRcuReaders = &cloglRcuMe;
+	}
+}
+
+static void cloglRcuInit()
+{
+	(void)pthread_key_create(&cloglRcuKey, cloglRcuUnlink);
+	(void)pthread_atfork(NULL, NULL, cloglRcuAtfork);
+}
+
+/*
+  线程第一次读时把槽挂到读者链上
+ */
+static void cloglRcuLink(cloglRcuReader *r)
+{
+	(void)pthread_once(&cloglRcuOnce, cloglRcuInit);
+
+	pthread_mutex_lock(&cloglRcuLock);
+	r->next = cloglRcuReaders;
+	r->prev = &cloglRcuReaders;
+	if (r->next) {
+		r->next->prev = &r->next;
+	}
+	cloglRcuReaders = r;
+	r->linked = 1;
+	pthread_mutex_unlock(&cloglRcuLock);
+	(void)pthread_setspecific(cloglRcuKey, r);
+}
+
+/*
+  进入读输出方向链的区间. 可以嵌套
+ */
+static inline void cloglRcuEnter()
+{
+	cloglRcuReader *r = &cloglRcuMe;
+
+	if (CLOGL_UNLIKELY(!r->linked)) {
+		cloglRcuLink(r);
+	}
+	if (0 == r->nest++) {
+		__atomic_store_n(&r->gp, __atomic_load_n(&cloglRcuGp, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST); // 先让换链的线程看到我在读, 再读链
+	}
+}
+
+static inline void cloglRcuExit()
+{
+	cloglRcuReader *r = &cloglRcuMe;
+
+	if (0 == --r->nest) {
+		__atomic_store_n(&r->gp, 0, __ATOMIC_RELEASE);
+	}
+}
+
+/*
+  开始一个宽限期, 返回它的序号. 在这之后进来的读者看得到调用前发布的东西
+ */
+static unsigned long cloglRcuMark()
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	return __atomic_add_fetch(&cloglRcuGp, 1, __ATOMIC_SEQ_CST);
+}
+
+/*
+  看cloglRcuMark开始的宽限期过去了没有: 在它之前进来的读者是不是都出去了. 不等
+  调的线程自己不算, 事件线程在读区间里回收
+ */
+static int cloglRcuPassed(unsigned long gp)
+{
+	int passed = 1;
+
+	pthread_mutex_lock(&cloglRcuLock);
+	for (cloglRcuReader *r = cloglRcuReaders; r; r = r->next) {
+		unsigned long cur = __atomic_load_n(&r->gp, __ATOMIC_ACQUIRE);
+		if (r != &cloglRcuMe && cur && cur < gp) {
+			passed = 0;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&cloglRcuLock);
+
+	return passed;
+}
+
+/*
+  等调用前进来的读者都出去. 不能在读区间里调
+  等的时候不拿锁, 新线程挂槽和退出的线程摘槽不会被挡住. 每次都从头看, 槽可能已经随线程没了
+ */
+static void cloglRcuSync()
+{
+	unsigned long gp = cloglRcuMark();
+	while (!cloglRcuPassed(gp)) {
+		(void)usleep(1000);
+	}
+}
+/* 读输出方向链 <<< */
+
+/* 合并重复日志 >>> */
+/*
+  连续的同一条日志只写第一条, 时间窗过了或者来了别的日志时写一行"last message repeated N times".
+  比的是去掉开头时间和pid tid的部分, 级别, 代码位置和消息都一样才算重复
+ */
+static uint64_t cloglDupHash(const char *str, size_t len)
+{
+	uint64_t h = 14695981039346656037ULL; // FNV-1a
+	for (size_t i = 0; i < len; i++) {
+		h = (h ^ (unsigned char)str[i]) * 1099511628211ULL;
+	}
+
+	return h | 1; // 0 表示没有上一条
+}
+
+/*
+  按输出方向的格式写一行库自己的提示. 持pLock调
+  线程的日志缓冲里可能是正要写给后面几个输出方向的日志, 提示行换一个缓冲格式化. 提示行很少, 缓冲用完就释放
+ */
+static void cloglApdNote(cloglApd *apd, clogl_t *log, int level, const char *format, ...)
+{
+	clogMsg side = {NULL, 0};
+
+	clogMsg *msg = getMsgBuff(log);
+	if (!msg) {
+		return;
+	}
+	clogMsg saved = *msg;
+	*msg = side;
+
+	cloglRec rec = {NULL, {0, 0}, 0, 0, {0,}, 0, level, NULL, 0};
+	const cloglRec *cur = cloglCur;
+	int head = cloglHeadLen;
+	cloglCur = &rec;
+	va_list va;
+	va_start(va, format);
+	char *line = cloglFmtRun(apd->fmt, log, format, va);
+	va_end(va);
+	if (line) {
+		(void)apd->apdType->append(apd, level, line, strlen(line));
+	}
+	cloglCur = cur;
+	cloglHeadLen = head;
+
+	free(msg->msgBuff);
+	*msg = saved;
+}
+
+/*
+  写汇总行. 持pLock调
+ */
+static void cloglDupSummary(cloglApd *apd)
+{
+	cloglApdNote(apd, apd->dupLog, apd->dupLevel, "last message repeated %lu times", apd->dupCount);
+	apd->dupCount = 0;
+}
+
+/*
+  事件线程调. 时间窗过了还没有别的日志来, 写汇总行
+ */
+static void cloglDupTick(cloglApd *apd, int64_t now)
+{
+	pthread_mutex_lock(&apd->pLock);
+	if (apd->dupCount && apd->isOpen) {
+		if (now >= apd->dupSince + apd->dedupMs) {
+			cloglDupSummary(apd);
+			apd->dupHash = 0;
+		} else {
+			cloglSchedAt(apd, apd->dupSince + apd->dedupMs);
+		}
+	}
+	pthread_mutex_unlock(&apd->pLock);
+}
+
+/*
+  开了合并的输出方向都走这里, MmapFile也要加锁. 持pLock调, 已经打开
+ */
+static int cloglDupWrite(cloglApd *apd, int priority, const char *logBuff, size_t len)
+{
+	size_t skip = ((size_t)cloglHeadLen < len) ? (size_t)cloglHeadLen : 0;
+	uint64_t h = cloglDupHash(logBuff + skip, len - skip);
+	int64_t now = cloglNowMs();
+
+	if (h == apd->dupHash && len - skip == apd->dupLen && priority == apd->dupLevel && now < apd->dupSince + apd->dedupMs) {
+		if (!apd->dupCount++) {
+			cloglSchedAt(apd, apd->dupSince + apd->dedupMs);
+		}
+		return 0;
+	}
+
+	if (apd->dupCount) {
+		cloglDupSummary(apd);
+	}
+	int rst = apd->apdType->append(apd, priority, logBuff, len);
+	apd->dupHash = h;
+	apd->dupLen = len - skip;
+	apd->dupLevel = priority;
+	apd->dupSince = now;
+	apd->dupLog = cloglOutLog;
+
+	return rst;
+}
+/* 合并重复日志 <<< */
+
+/* 过载策略 >>> */
+/*
+  输出方向忙时写日志的线程不等pLock, 把日志拷进暂存缓冲就返回; 拿着pLock的线程写完自己的再把暂存的写掉.
+  缓冲满了按策略丢, 丢掉的按级别计数, 缓冲写空以后写一行报告
+ */
+typedef struct _clogl_backlog_rec
+{
+	clogl_t *log;                     // 日志对象
+	int priority;                     // 日志级别
+	int head;                         // 日志开头的时间和pid tid的长度
+	size_t len;                       // 日志长度. 后面紧跟日志内容
+} cloglBacklogRec;
+
+typedef struct _clogl_backlog_buf
+{
+	char *buf;
+	size_t cap;                       // 缓冲大小
+	size_t start;                     // 最早一条的位置
+	size_t end;                       // 写到的位置
+} cloglBacklogBuf;
+
+typedef struct _clogl_backlog
+{
+	cloglBacklogBuf cur;              // 暂存的线程往这里放. qLock
+	cloglBacklogBuf spare;            // 写暂存日志时和cur交换. 只有拿着pLock的线程用
+	unsigned long count;              // cur里有几条
+} cloglBacklog;
+
+#define CLOGL_BACKLOG_REC(len) ((sizeof(cloglBacklogRec) + (len) + 7) & ~(size_t)7)
+
+static void cloglDropCount(cloglApd *apd, int priority)
+{
+	__atomic_add_fetch(&apd->dropped[priority], 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&apd->dropLog, cloglOutLog, __ATOMIC_RELAXED);
+}
+
+/*
+  把日志拷进暂存缓冲. 满了按策略丢一条, 丢的计数
+ */
+static void cloglBacklogPush(cloglApd *apd, int priority, const char *logBuff, size_t len)
+{
+	size_t need = CLOGL_BACKLOG_REC(len);
+	int dropped = priority;
+
+	pthread_mutex_lock(&apd->qLock);
+	cloglBacklog *b = apd->backlog;
+	if (!b) {
+		b = (cloglBacklog *)calloc(1, sizeof(cloglBacklog));
+		__atomic_store_n(&apd->backlog, b, __ATOMIC_RELEASE);
+	}
+	if (b) {
+		cloglBacklogBuf *q = &b->cur;
+		if (q->start == q->end && q->cap != apd->backlogBytes) {
+			free(q->buf);
+			q->buf = (char *)malloc(apd->backlogBytes);
+			q->cap = q->buf ? apd->backlogBytes : 0;
+			q->start = q->end = 0;
+		}
+		while (need <= q->cap && q->cap - q->end < need) {
+			if (q->start && q->cap - q->end + q->start >= need) {
+				memmove(q->buf, q->buf + q->start, q->end - q->start);
+				q->end -= q->start;
+				q->start = 0;
+				break;
+			}
+			if (CLOGL_OVERLOAD_OLDEST != apd->overload || q->start == q->end) {
+				break;
+			}
+			const cloglBacklogRec *old = (const cloglBacklogRec *)(q->buf + q->start);
+			cloglDropCount(apd, old->priority);
+			q->start += CLOGL_BACKLOG_REC(old->len);
+			__atomic_sub_fetch(&b->count, 1, __ATOMIC_RELAXED);
+			if (q->start == q->end) {
+				q->start = q->end = 0;
+			}
+		}
+		if (need <= q->cap - q->end) {
+			cloglBacklogRec *r = (cloglBacklogRec *)(q->buf + q->end);
+			r->log = cloglOutLog;
+			r->priority = priority;
+			r->head = cloglHeadLen;
+			r->len = len;
+			memcpy(r + 1, logBuff, len);
+			q->end += need;
+			__atomic_add_fetch(&b->count, 1, __ATOMIC_SEQ_CST);
+			dropped = -1;
+		}
+	}
+	pthread_mutex_unlock(&apd->qLock);
+
+	if (dropped >= 0) {
+		cloglDropCount(apd, dropped);
+	}
+}
+
+static inline unsigned long cloglBacklogCount(cloglApd *apd)
+{
+	cloglBacklog *b = __atomic_load_n(&apd->backlog, __ATOMIC_ACQUIRE);
+	return b ? __atomic_load_n(&b->count, __ATOMIC_SEQ_CST) : 0;
+}
+
+static int cloglApdWriteLocked(cloglApd *apd, int priority, const char *logBuff, size_t len);
+
+/*
+  写掉暂存的日志. 持pLock调
+ */
+static void cloglBacklogDrain(cloglApd *apd)
+{
+	cloglBacklog *b = __atomic_load_n(&apd->backlog, __ATOMIC_ACQUIRE);
+	if (!b || !__atomic_load_n(&b->count, __ATOMIC_ACQUIRE)) {
+		return;
+	}
+
+	pthread_mutex_lock(&apd->qLock);
+	cloglBacklogBuf q = b->cur;
+	b->cur = b->spare;
+	b->cur.start = b->cur.end = 0;
+	__atomic_store_n(&b->count, 0, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&apd->qLock);
+
+	clogl_t *outLog = cloglOutLog;
+	int head = cloglHeadLen;
+	for (size_t pos = q.start; pos < q.end; ) {
+		const cloglBacklogRec *r = (const cloglBacklogRec *)(q.buf + pos);
+		cloglOutLog = r->log;
+		cloglHeadLen = r->head;
+		(void)cloglApdWriteLocked(apd, r->priority, (const char *)(r + 1), r->len);
+		pos += CLOGL_BACKLOG_REC(r->len);
+	}
+	cloglOutLog = outLog;
+	cloglHeadLen = head;
+
+	q.start = q.end = 0;
+	b->spare = q;
+}
+
+/*
+  报过载丢掉的条数. 持pLock调. 离上次不到CLOGL_DROP_REPORT_MS的让事件线程到时候再报
+ */
+static void cloglDropReport(cloglApd *apd, int force)
+{
+	unsigned long total = 0;
+	for (int i = 0; i < CLOGL_LEVEL_UNKNOWN; i++) {
+		total += __atomic_load_n(&apd->dropped[i], __ATOMIC_RELAXED);
+	}
+	if (!total || !apd->isOpen) {
+		return;
+	}
+
+	int64_t now = cloglNowMs();
+	if (!force && now < apd->dropSince + CLOGL_DROP_REPORT_MS) {
+		cloglSchedAt(apd, apd->dropSince + CLOGL_DROP_REPORT_MS);
+		return;
+	}
+
+	char detail[128];
+	size_t pos = 0;
+	total = 0;
+	detail[0] = 0;
+	for (int i = 0; i < CLOGL_LEVEL_UNKNOWN; i++) {
+		unsigned long n = __atomic_exchange_n(&apd->dropped[i], 0, __ATOMIC_RELAXED);
+		if (n && pos < sizeof(detail)) {
+			int w = snprintf(detail + pos, sizeof(detail) - pos, "%s%s %lu", pos ? ", " : "", cloglLevelTag[i], n);
+			pos += (w > 0) ? (size_t)w : 0;
+		}
+		total += n;
+	}
+	if (total) {
+		cloglApdNote(apd, __atomic_load_n(&apd->dropLog, __ATOMIC_RELAXED), CLOGL_LEVEL_WARN,
+			"dropped %lu lines under overload (%s)", total, detail);
+	}
+	apd->dropSince = now;
+}
+
+/*
+  事件线程调. 没有别的线程来写时把暂存的写掉, 报丢掉的条数
+ */
+static void cloglOverloadTick(cloglApd *apd)
+{
+	pthread_mutex_lock(&apd->pLock);
+	if (apd->isOpen) {
+		cloglBacklogDrain(apd);
+		cloglDropReport(apd, 0);
+	}
+	pthread_mutex_unlock(&apd->pLock);
+}
+
+/*
+  不是CLOGL_OVERLOAD_BLOCK的输出方向走这里
+ */
+static int cloglOverloadWrite(cloglApd *apd, int priority, const char *logBuff, size_t len)
+{
+	int rst = 0;
+
+	if (pthread_mutex_trylock(&apd->pLock)) {
+		// 有线程在写. SHED的重要日志照样等, 别的暂存
+		if (CLOGL_OVERLOAD_SHED != apd->overload || priority > apd->shedLevel) {
+			cloglBacklogPush(apd, priority, logBuff, len);
+			__atomic_thread_fence(__ATOMIC_SEQ_CST);
+			if (pthread_mutex_trylock(&apd->pLock)) {
+				return 0; // 拿着锁的线程放锁后会看到暂存的
+			}
+			goto drain;
+		}
+		pthread_mutex_lock(&apd->pLock);
+	}
+
+	// 先写之前暂存的, 保持顺序
+	cloglBacklogDrain(apd);
+	rst = cloglApdWriteLocked(apd, priority, logBuff, len);
+
+drain:
+	do {
+		if (apd->isOpen) {
+			cloglBacklogDrain(apd);
+			cloglDropReport(apd, 0);
+		}
+		pthread_mutex_unlock(&apd->pLock);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	} while (cloglBacklogCount(apd) && !pthread_mutex_trylock(&apd->pLock));
+
+	return rst;
+}
+/* 过载策略 <<< */
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+  事件线程. 睡到最早的deadline, 只调deadline到了的输出方向的event
+ */
+static void *threadEvert(void *parm)
+{
+	parm = parm;
+
+	// deadline是按粗粒度时钟比的, 多睡一个粒度, 醒来时一定到了
+	struct timespec res = {0, 1000000L};
+	(void)clock_getres(CLOCK_REALTIME_COARSE, &res);
+	long slack = res.tv_sec * 1000 + (res.tv_nsec + 999999) / 1000000;
+
+	while (1) {
+		__atomic_store_n(&cloglSchedNext, 0, __ATOMIC_RELEASE); // 扫描时提前deadline的都要叫醒
+		int64_t now = cloglNowMs();
+		int64_t next = INT64_MAX;
+		cloglRcuEnter();
+		for (clogl_t *tmp = __atomic_load_n(&clogls, __ATOMIC_ACQUIRE); tmp; tmp = __atomic_load_n(&tmp->next, __ATOMIC_ACQUIRE)) {
+			for (cloglApd *tmpApd = __atomic_load_n(&tmp->apds, __ATOMIC_ACQUIRE); tmpApd; tmpApd = tmpApd->next) {
+				cloglApdT *tmpApt = tmpApd->apdType;
+				if (!tmpApt || (!tmpApt->event && !tmpApd->dedupMs && !tmpApd->overload)) {
+					continue;
+				}
+				int64_t when = __atomic_load_n(&tmpApd->deadline, __ATOMIC_ACQUIRE);
+				if (when && when <= now) {
+					// event自己只在改状态时加pLock, 改名和打开文件不挡写线程
+					__atomic_store_n(&tmpApd->deadline, 0, __ATOMIC_RELEASE);
+					if (tmpApd->dedupMs) {
+						cloglDupTick(tmpApd, now);
+					}
+					if (tmpApd->overload) {
+						cloglOverloadTick(tmpApd);
+					}
+					if (tmpApt->event) {
+						(void)tmpApt->event(tmpApd);
+					}
+					when = __atomic_load_n(&tmpApd->deadline, __ATOMIC_ACQUIRE);
+				}
+				if (when && when < next) {
+					next = when;
+				}
+			}
+		}
+		cloglRcuExit();
+
+		pthread_mutex_lock(&cloglSchedLock);
+		__atomic_store_n(&cloglSchedNext, next, __ATOMIC_RELEASE);
+		if (!cloglSchedKick) {
+			if (INT64_MAX == next) {
+				pthread_cond_wait(&cloglSchedCond, &cloglSchedLock);
+			} else {
+				struct timespec ts = {(next + slack) / 1000, ((next + slack) % 1000) * 1000000L};
+				pthread_cond_timedwait(&cloglSchedCond, &cloglSchedLock, &ts);
+			}
+		}
+		cloglSchedKick = 0;
+		pthread_mutex_unlock(&cloglSchedLock);
+	}
+
+	return (void *)0;
+}
+
+/*
+  打开并写一个输出方向. 持pLock调
+ */
+static int cloglApdWriteLocked(cloglApd *apd, int priority, const char *logBuff, size_t len)
+{
+	if (!apd->isOpen && cloglApdOpen(apd)) {
+		return -1;
+	}
+	if (apd->dedupMs) {
+		return cloglDupWrite(apd, priority, logBuff, len);
+	}
+
+	return apd->apdType->append(apd, priority, logBuff, len);
+}
+
+/*
+  加锁打开并写一个输出方向. 同步模式在调用线程执行, 异步模式在写线程执行
+ */
+static int cloglApdWrite(cloglApd *apd, int priority, const char *logBuff, size_t len)
+{
+	if (apd->apdType->lockFree && !apd->dedupMs) {
+		if (!__atomic_load_n(&apd->isOpen, __ATOMIC_ACQUIRE)) {
+			pthread_mutex_lock(&apd->pLock);
+			int rst = apd->isOpen ? 0 : cloglApdOpen(apd);
+			pthread_mutex_unlock(&apd->pLock);
+			if (rst) {
+				return -1;
+			}
+		}
+		return apd->apdType->append(apd, priority, logBuff, len);
+	}
+
+	if (apd->overload) {
+		return cloglOverloadWrite(apd, priority, logBuff, len);
+	}
+
+	pthread_mutex_lock(&apd->pLock);
+	cloglBacklogDrain(apd); // 刚改回CLOGL_OVERLOAD_BLOCK时可能还有暂存的
+	int rst = cloglApdWriteLocked(apd, priority, logBuff, len);
+	pthread_mutex_unlock(&apd->pLock);
+
+	return rst;
+}
+
+/*
+  加锁打开一个二进制输出方向, 把一条日志的调用处和保存的参数交给它
+ */
+static int cloglApdRecord(cloglApd *apd, const cloglRec *rec, int err, const char *data, size_t len)
+{
+	pthread_mutex_lock(&apd->pLock);
+	if (!apd->isOpen && cloglApdOpen(apd)) {
+		pthread_mutex_unlock(&apd->pLock);
+		return -1;
+	}
+	int rst = apd->apdType->record(apd, rec, err, data, len);
+	pthread_mutex_unlock(&apd->pLock);
+
+	return rst;
+}
+
+/*
+ * 功能:
+ *    向一个输出方向输出日志
+ * 入参:
+ *    apd:      一个输出方向结构
+ *    priority: 日志级别
+ *    logBuff:  存放格式化后日志信息的BUFF
+ *    len:      日志长度
+ * 出参:
+ *    NO
+ * 返回值:
+ *    OK 0, error -1
+ */
+static int cloglApdAppend(cloglApd *apd, int priority, char *logBuff, size_t len)
+{
+	if (!apd->apdType)
+		return -1;
+
+	if (!apd->apdType->append)
+		return -1;
+
+	if (apd->priority < priority && !cloglForce)
+		return 0;
+
+	return cloglApdWrite(apd, priority, logBuff, len);
+}
+
+/*
+  把所有输出方向缓冲的日志写出去
+ */
+static void cloglApdFlushAll()
+{
+	cloglRcuEnter();
+	for (clogl_t *tmp = __atomic_load_n(&clogls, __ATOMIC_ACQUIRE); tmp; tmp = __atomic_load_n(&tmp->next, __ATOMIC_ACQUIRE)) {
+		for (cloglApd *tmpApd = __atomic_load_n(&tmp->apds, __ATOMIC_ACQUIRE); tmpApd; tmpApd = tmpApd->next) {
+			if (tmpApd->apdType && (tmpApd->apdType->flush || tmpApd->dedupMs || tmpApd->backlog)) {
+				pthread_mutex_lock(&tmpApd->pLock);
+				if (tmpApd->isOpen) {
+					cloglBacklogDrain(tmpApd);
+					cloglDropReport(tmpApd, 1);
+				}
+				if (tmpApd->isOpen && tmpApd->dupCount) {
+					cloglDupSummary(tmpApd);
+					tmpApd->dupHash = 0;
+				}
+				if (tmpApd->isOpen && tmpApd->apdType->flush) {
+					(void)tmpApd->apdType->flush(tmpApd);
+				}
+				pthread_mutex_unlock(&tmpApd->pLock);
+			}
+		}
+	}
+	cloglRcuExit();
+}
+
+/*
+  进程退出时把缓冲的日志写完
+ */
+static void cloglExitFlush()
+{
+	(void)cloglFlush();
+}
+
+static void cloglExitAtexit()
+{
+	(void)atexit(cloglExitFlush);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+  异步队列单元里的日志种类
+ */
+#define CLOGL_CELL_TEXT       0                   // 格式化好的日志, 输出到apd
+#define CLOGL_CELL_ARGS       1                   // 延迟格式化的日志, 内容是参数的原始字节
+
+/*
+  异步队列的一个单元
+ */
+typedef struct _clogl_cell
+{
+	size_t seq;                       // 单元序号. 等于写位置时可写, 等于写位置+1时可读
+	int kind;                         // CLOGL_CELL_TEXT OR CLOGL_CELL_ARGS
+	int priority;                     // 日志级别
+	cloglApd *apd;                    // 第一个输出方向. TEXT
+	uint64_t mask;                    // 从apd数起, 要输出的输出方向. TEXT
+	clogl_t *log;                     // 日志对象. ARGS
+	cloglRec rec;                     // 调用处, 时间, 线程. ARGS
+	int err;                          // 调用时的errno, 给%m用. ARGS
+	int head;                         // 日志开头的时间和pid tid的长度. TEXT
+	size_t len;                       // 日志长度
+	char *data;                       // 日志内容. 指向inl或堆上分配的内存
+	char inl[CLOGL_ASYNC_INLINE];     // 短日志直接放在单元里
+} cloglCell;
+
+/*
+  异步日志队列. 有界, 多生产者无锁, 只有一个写线程消费
+ */
+static struct
+{
+	cloglCell *cells;                                  // 队列单元
+	size_t mask;                                       // 队列长度-1
+	size_t enq __attribute__((aligned(64)));           // 下一个写位置. 生产者竞争
+	size_t deq __attribute__((aligned(64)));           // 下一个读位置. 只有写线程修改
+	int sleeping __attribute__((aligned(64)));         // 写线程是否在等待
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} cloglAsyncQ = {NULL, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+static pthread_once_t cloglAsyncOnce = PTHREAD_ONCE_INIT;
+static int cloglAsyncOK; // 写线程是否已启动
+static pthread_mutex_t cloglAsyncStartLock = PTHREAD_MUTEX_INITIALIZER;
+
+static int cloglAsyncRun();
+
+/*
+  fork后的子进程里重新启动写线程
+ */
+static int cloglAsyncRestart()
+{
+	if (!cloglAsyncQ.cells) {
+		return -1;
+	}
+
+	pthread_mutex_lock(&cloglAsyncStartLock);
+	int rst = cloglAsyncOK ? 0 : cloglAsyncRun();
+	pthread_mutex_unlock(&cloglAsyncStartLock);
+
+	return rst;
+}
+
+/*
+  叫醒等待中的写线程
+ */
+static void cloglAsyncWake()
+{
+	pthread_mutex_lock(&cloglAsyncQ.lock);
+	pthread_cond_signal(&cloglAsyncQ.cond);
+	pthread_mutex_unlock(&cloglAsyncQ.lock);
+}
+
+/*
+  把一条日志拷贝进异步队列. head是单元头, data/len是内容. 队列满时让出CPU等写线程
+ */
+static int cloglAsyncPush(const cloglCell *head, const char *data, size_t len)
+{
+	if (__builtin_expect(!__atomic_load_n(&cloglAsyncOK, __ATOMIC_ACQUIRE), 0) && cloglAsyncRestart()) {
+		return -1;
+	}
+
+	char *heap = NULL;
+	if (len > CLOGL_ASYNC_INLINE) {
+		heap = (char *)malloc(len);
+		if (!heap) {
+			return -1;
+		}
+		memcpy(heap, data, len);
+	}
+
+	cloglCell *cell = NULL;
+	size_t pos = __atomic_load_n(&cloglAsyncQ.enq, __ATOMIC_RELAXED);
+	while (1) {
+		cell = &cloglAsyncQ.cells[pos & cloglAsyncQ.mask];
+		size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+		long dif = (long)(seq - pos);
+		if (0 == dif) {
+			if (__atomic_compare_exchange_n(&cloglAsyncQ.enq, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				break;
+			}
+		} else if (dif < 0) {
+			// 队列满了
+			if (__atomic_load_n(&cloglAsyncQ.sleeping, __ATOMIC_RELAXED)) {
+				cloglAsyncWake();
+			}
+			sched_yield();
+			pos = __atomic_load_n(&cloglAsyncQ.enq, __ATOMIC_RELAXED);
+		} else {
+			pos = __atomic_load_n(&cloglAsyncQ.enq, __ATOMIC_RELAXED);
+		}
+	}
+
+	cell->kind = head->kind;
+	cell->priority = head->priority;
+	cell->apd = head->apd;
+	cell->mask = head->mask;
+	cell->head = head->head;
+	cell->log = head->log;
+	cell->rec = head->rec;
+	cell->err = head->err;
+	cell->len = len;
+	if (heap) {
+		cell->data = heap;
+	} else {
+		memcpy(cell->inl, data, len);
+		cell->data = cell->inl;
+	}
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&cloglAsyncQ.sleeping, __ATOMIC_RELAXED)) {
+		cloglAsyncWake();
+	}
+
+	return 0;
+}
+
+/*
+  把一条格式化好的日志交给写线程. 输出到从apd数起mask里的各输出方向
+ */
+static int cloglAsyncText(cloglApd *apd, uint64_t mask, int priority, const char *logBuff, size_t len)
+{
+	cloglCell head;
+	memset(&head, 0, sizeof(head));
+	head.kind = CLOGL_CELL_TEXT;
+	head.priority = priority;
+	head.apd = apd;
+	head.mask = mask;
+	head.log = cloglOutLog;
+	head.head = cloglHeadLen;
+
+	return cloglAsyncPush(&head, logBuff, len + 1);
+}
+
+static void cloglDeferOut(cloglCell *cell);
+static void cloglDispatchf(clogl_t *log, int priority, int async, const char *format, ...);
+
+/*
+  取出队头的一条日志输出. 没有日志返回0
+ */
+static int cloglAsyncPop()
+{
+	size_t pos = cloglAsyncQ.deq;
+	cloglCell *cell = &cloglAsyncQ.cells[pos & cloglAsyncQ.mask];
+	if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != pos + 1) {
+		return 0;
+	}
+
+	if (CLOGL_CELL_ARGS == cell->kind) {
+		cloglDeferOut(cell);
+	} else {
+		// 同一条日志给用同一个格式的各输出方向共用
+		cloglOutLog = cell->log;
+		cloglHeadLen = cell->head;
+		int i = 0;
+		for (cloglApd *tmpapd = cell->apd; tmpapd && (cell->mask >> i); tmpapd = tmpapd->next, i++) {
+			if (cell->mask & (1ULL << i)) {
+				(void)cloglApdWrite(tmpapd, cell->priority, cell->data, cell->len - 1);
+			}
+		}
+	}
+	if (cell->data != cell->inl) {
+		free(cell->data);
+	}
+	cell->data = NULL;
+
+	__atomic_store_n(&cell->seq, pos + cloglAsyncQ.mask + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&cloglAsyncQ.deq, pos + 1, __ATOMIC_RELEASE);
+
+	return 1;
+}
+
+/*
+  异步写线程. 把队列里的日志输出到各输出方向
+ */
+static void *threadAsync(void *parm)
+{
+	parm = parm;
+	cloglIsWriter = 1;
+
+	while (1) {
+		int n = 0;
+		while (cloglAsyncPop()) {
+			n ++;
+		}
+		if (n > 0) {
+			continue;
+		}
+
+		// 队列空了, 睡一会儿. 生产者看到sleeping会叫醒
+		for (int i = 0; i < 64 && !n; i++) {
+			sched_yield();
+			n = cloglAsyncPop();
+		}
+		if (n) {
+			continue;
+		}
+
+		pthread_mutex_lock(&cloglAsyncQ.lock);
+		__atomic_store_n(&cloglAsyncQ.sleeping, 1, __ATOMIC_SEQ_CST);
+		size_t pos = cloglAsyncQ.deq;
+		cloglCell *cell = &cloglAsyncQ.cells[pos & cloglAsyncQ.mask];
+		if (__atomic_load_n(&cell->seq, __ATOMIC_SEQ_CST) != pos + 1) {
+			struct timespec ts;
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_nsec += CLOGL_EVENT_TIME * 1000000L;
+			if (ts.tv_nsec >= 1000000000L) {
+				ts.tv_sec ++;
+				ts.tv_nsec -= 1000000000L;
+			}
+			(void)pthread_cond_timedwait(&cloglAsyncQ.cond, &cloglAsyncQ.lock, &ts);
+		}
+		__atomic_store_n(&cloglAsyncQ.sleeping, 0, __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&cloglAsyncQ.lock);
+	}
+
+	return (void *)0;
+}
+
+/*
+  启动写线程
+ */
+static int cloglAsyncRun()
+{
+	pthread_t ptid = 0;
+	if (pthread_create(&ptid, NULL, threadAsync, NULL)) {
+		cloglErr("cloglAsyncRun pthread_create error");
+		return -1;
+	}
+	(void)pthread_detach(ptid);
+	__atomic_store_n(&cloglAsyncOK, 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/*
+  子进程里没有写线程了. 队列里是父进程的日志, 父进程自己会写, 这里清掉. 写线程等第一条日志时再启动
+ */
+static void cloglAsyncAtfork()
+{
+	for (size_t i = 0; i <= cloglAsyncQ.mask; i++) {
+		cloglCell *cell = &cloglAsyncQ.cells[i];
+		if (cell->data && cell->data != cell->inl) {
+			free(cell->data);
+		}
+		cell->data = NULL;
+		cell->seq = i;
+	}
+	cloglAsyncQ.enq = 0;
+	cloglAsyncQ.deq = 0;
+	cloglAsyncQ.sleeping = 0;
+	pthread_mutex_init(&cloglAsyncQ.lock, NULL);
+	pthread_cond_init(&cloglAsyncQ.cond, NULL);
+	pthread_mutex_init(&cloglAsyncStartLock, NULL);
+	cloglAsyncOK = 0;
+}
+
+/*
+  分配异步队列, 启动写线程. 只执行一次
+ */
+static void cloglAsyncStart()
+{
+	size_t n = CLOGL_ASYNC_QUEUE;
+	if (n < 2 || (n & (n - 1))) {
+		cloglErr("CLOGL_ASYNC_QUEUE must be a power of 2");
+		return;
+	}
+
+	cloglAsyncQ.cells = (cloglCell *)calloc(n, sizeof(cloglCell));
+	if (!cloglAsyncQ.cells) {
+		cloglErr("cloglAsyncStart calloc error");
+		return;
+	}
+	for (size_t i = 0; i < n; i++) {
+		cloglAsyncQ.cells[i].seq = i;
+	}
+	cloglAsyncQ.mask = n - 1;
+
+	if (cloglAsyncRun()) {
+		free(cloglAsyncQ.cells);
+		cloglAsyncQ.cells = NULL;
+		return;
+	}
+	(void)atexit(cloglExitFlush);
+	(void)pthread_atfork(NULL, NULL, cloglAsyncAtfork);
+}
+
+/*
+ * 功能:
+ *    等待调用前已经进入异步队列的日志全部输出
+ * 入参:
+ *    NO
+ * 出参:
+ *    NO
+ * 返回值:
+ *    0 OR -1
+ */
+int cloglFlush()
+{
+	if (!cloglAsyncOK) {
+		cloglApdFlushAll();
+		return 0;
+	}
+
+	size_t target = __atomic_load_n(&cloglAsyncQ.enq, __ATOMIC_ACQUIRE);
+	while ((long)(__atomic_load_n(&cloglAsyncQ.deq, __ATOMIC_ACQUIRE) - target) < 0) {
+		if (__atomic_load_n(&cloglAsyncQ.sleeping, __ATOMIC_RELAXED)) {
+			cloglAsyncWake();
+		}
+		(void)usleep(1000);
+	}
+	cloglApdFlushAll();
+
+	return 0;
+}
+
+/*
+ * 功能:
+ *    设置一个日志对象是否异步输出
+ * 入参:
+ *    log: 日志对象
+ *    on:  1 异步, 0 同步
+ * 出参:
+ *    NO
+ * 返回值:
+ *    0 OR -1
+ */
+int cloglSetAsync(clogl_t *log, int on)
+{
+	if (!log)
+		return -1;
+
+	if (on) {
+		(void)pthread_once(&cloglAsyncOnce, cloglAsyncStart);
+		if (!cloglAsyncOK && cloglAsyncRestart()) {
+			return -1;
+		}
+	}
+	__atomic_store_n(&log->async, on ? 1 : 0, __ATOMIC_RELEASE);
+
+	if (!on) {
+		(void)cloglFlush(); // 切回同步前把已经入队的写完, 保持顺序
+	}
+
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+  格式串里的一个转换说明
+ */
+typedef struct _clogl_spec
+{
+	char spec[32];                    // 转换说明原文, 如 "%-8.3lld"
+	char size;                        // 长度修饰: 0, 'H'(hh), 'h', 'l', 'q'(ll), 'L', 'j', 'z', 't'
+	char conv;                        // 转换字符
+	char starW;                       // 宽度是 *
+	char starP;                       // 精度是 *
+	int prec;                         // 精度. -1 没有
+} cloglSpec;
+
+/*
+  解析p处('%'后面)的一个转换说明. 返回说明后面的位置, 不支持的返回NULL
+ */
+static const char *cloglParseSpec(const char *p, cloglSpec *sp)
+{
+	const char *b = p - 1;
+	memset(sp, 0, sizeof(*sp));
+	sp->prec = -1;
+
+	while (*p && strchr("-+ #0'I", *p))
+		p ++;
+	if ('*' == *p) {
+		sp->starW = 1;
+		p ++;
+	} else {
+		while (*p >= '0' && *p <= '9')
+			p ++;
+	}
+	if ('$' == *p) {
+		return NULL; // 位置参数
+	}
+	if ('.' == *p) {
+		p ++;
+		sp->prec = 0;
+		if ('*' == *p) {
+			sp->starP = 1;
+			p ++;
+		} else {
+			while (*p >= '0' && *p <= '9')
+				sp->prec = sp->prec * 10 + (*p++ - '0');
+		}
+	}
+
+	switch (*p) {
+	case 'h':
+		sp->size = ('h' == p[1]) ? 'H' : 'h';
+		p += ('H' == sp->size) ? 2 : 1;
+		break;
+	case 'l':
+		sp->size = ('l' == p[1]) ? 'q' : 'l';
+		p += ('q' == sp->size) ? 2 : 1;
+		break;
+	case 'q':
+		sp->size = 'q';
+		p ++;
+		break;
+	case 'L': case 'j': case 'z': case 't':
+		sp->size = *p++;
+		break;
+	case 'Z':
+		sp->size = 'z';
+		p ++;
+		break;
+	}
+
+	sp->conv = *p;
+	if (!sp->conv) {
+		return NULL;
+	}
+	p ++;
+
+	if ((size_t)(p - b) >= sizeof(sp->spec)) {
+		return NULL;
+	}
+	memcpy(sp->spec, b, p - b);
+	sp->spec[p - b] = 0;
+
+	return p;
+}
+
+/*
+  把缓冲区扩大到至少size字节
+ */
+static int cloglGrow(clogMsg *buff, size_t size)
+{
+	if (size <= buff->msgSize) {
+		return 0;
+	}
+
+	size_t n = buff->msgSize ? buff->msgSize : 1024;
+	while (n < size)
+		n *= 2;
+	char *nb = (char *)realloc(buff->msgBuff, n);
+	if (!nb) {
+		return -1;
+	}
+	buff->msgBuff = nb;
+	buff->msgSize = n;
+
+	return 0;
+}
+
+/*
+  往缓冲区里追加bytes字节. 不够就扩大
+ */
+static int cloglPut(clogMsg *buff, size_t *pos, const void *bytes, size_t n)
+{
+	if (cloglGrow(buff, *pos + n + 1)) {
+		return -1;
+	}
+	memcpy(buff->msgBuff + *pos, bytes, n);
+	*pos += n;
+
+	return 0;
+}
+
+/*
+  参数按8字节对齐保存. 补齐pos
+ */
+static int cloglPad(clogMsg *buff, size_t *pos)
+{
+	static const char zero[8] = {0,};
+	size_t pad = (8 - (*pos & 7)) & 7;
+
+	return pad ? cloglPut(buff, pos, zero, pad) : 0;
+}
+
+static int cloglPutArg(clogMsg *buff, size_t *pos, const void *v, size_t n)
+{
+	if (cloglPut(buff, pos, v, n)) {
+		return -1;
+	}
+
+	return cloglPad(buff, pos);
+}
+
+/*
+  按格式串把va_list里的参数原始字节拷贝到buff. 不支持的格式返回-1
+ */
+static int cloglArgsPack(clogMsg *buff, size_t *pos, const char *format, va_list args)
+{
+	cloglSpec sp;
+	const char *p = format;
+
+	while ((p = strchr(p, '%'))) {
+		p ++;
+		if ('%' == *p) {
+			p ++;
+			continue;
+		}
+		p = cloglParseSpec(p, &sp);
+		if (!p) {
+			return -1;
+		}
+
+		int rst = 0;
+		if (sp.starW) {
+			int w = va_arg(args, int);
+			rst |= cloglPutArg(buff, pos, &w, sizeof(w));
+		}
+		if (sp.starP) {
+			int pr = va_arg(args, int);
+			rst |= cloglPutArg(buff, pos, &pr, sizeof(pr));
+			sp.prec = pr;
+		}
+
+		switch (sp.conv) {
+		case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': case 'c': {
+			if ('c' == sp.conv && sp.size) {
+				return -1; // 宽字符
+			}
+			long long v = 0;
+			switch (sp.size) {
+			case 'l': v = va_arg(args, long); break;
+			case 'q': v = va_arg(args, long long); break;
+			case 'j': v = va_arg(args, intmax_t); break;
+			case 'z': v = va_arg(args, size_t); break;
+			case 't': v = va_arg(args, ptrdiff_t); break;
+			default:  v = va_arg(args, int); break;
+			}
+			rst |= cloglPutArg(buff, pos, &v, sizeof(v));
+			break;
+		}
+		case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+			if ('L' == sp.size) {
+				long double v = va_arg(args, long double);
+				rst |= cloglPutArg(buff, pos, &v, sizeof(v));
+			} else {
+				double v = va_arg(args, double);
+				rst |= cloglPutArg(buff, pos, &v, sizeof(v));
+			}
+			break;
+		case 's': {
+			if (sp.size) {
+				return -1; // 宽字符串
+			}
+			const char *v = va_arg(args, const char *);
+			unsigned int n = 0xFFFFFFFF; // NULL
+			if (v) {
+				n = (sp.prec >= 0) ? strnlen(v, sp.prec) : strlen(v);
+			}
+			rst |= cloglPut(buff, pos, &n, sizeof(n));
+			if (v) {
+				rst |= cloglPut(buff, pos, v, n);
+			}
+			rst |= cloglPad(buff, pos);
+			break;
+		}
+		case 'p': {
+			void *v = va_arg(args, void *);
+			rst |= cloglPutArg(buff, pos, &v, sizeof(v));
+			break;
+		}
+		case 'm':
+			break;
+		default:
+			return -1; // %n 等
+		}
+
+		if (rst) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+  按一个转换说明格式化一个参数, 追加到buff
+ */
+static int cloglPutf(clogMsg *buff, size_t *pos, const char *spec, ...)
+{
+	while (1) {
+		size_t room = (buff->msgSize > *pos) ? buff->msgSize - *pos : 0;
+		va_list va;
+		va_start(va, spec);
+		int n = vsnprintf(room ? buff->msgBuff + *pos : NULL, room, spec, va);
+		va_end(va);
+		if (n < 0) {
+			return -1;
+		}
+		if ((size_t)n < room) {
+			*pos += n;
+			return 0;
+		}
+		if (cloglGrow(buff, *pos + n + 1)) {
+			return -1;
+		}
+	}
+}
+
+/*
+  用cloglArgsPack保存的参数把format格式化到buff. 在写线程执行
+ */
+static int cloglArgsRender(clogMsg *buff, const char *format, const char *data, size_t len)
+{
+	size_t pos = 0;
+	const char *end = data + len;
+	const char *p = format;
+	cloglSpec sp;
+
+	while (*p) {
+		const char *q = strchr(p, '%');
+		if (!q) {
+			q = p + strlen(p);
+		}
+		if (q > p && cloglPut(buff, &pos, p, q - p)) {
+			return -1;
+		}
+		if (!*q) {
+			break;
+		}
+		p = q + 1;
+		if ('%' == *p) {
+			if (cloglPut(buff, &pos, "%", 1)) {
+				return -1;
+			}
+			p ++;
+			continue;
+		}
+		p = cloglParseSpec(p, &sp);
+		if (!p) {
+			return -1;
+		}
+
+		int w = 0, pr = 0;
+		if (sp.starW) {
+			if (data + 8 > end) return -1;
+			memcpy(&w, data, sizeof(w));
+			data += 8;
+		}
+		if (sp.starP) {
+			if (data + 8 > end) return -1;
+			memcpy(&pr, data, sizeof(pr));
+			data += 8;
+		}
+
+#define CLOGL_PUTF(v) (sp.starW && sp.starP ? cloglPutf(buff, &pos, sp.spec, w, pr, v) : \
+			sp.starW ? cloglPutf(buff, &pos, sp.spec, w, v) : \
+			sp.starP ? cloglPutf(buff, &pos, sp.spec, pr, v) : \
+			cloglPutf(buff, &pos, sp.spec, v))
+
+		int rst = 0;
+		switch (sp.conv) {
+		case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': case 'c': {
+			long long v = 0;
+			if (data + 8 > end) return -1;
+			memcpy(&v, data, sizeof(v));
+			data += 8;
+			switch (sp.size) {
+			case 'l': rst = CLOGL_PUTF((long)v); break;
+			case 'q': rst = CLOGL_PUTF(v); break;
+			case 'j': rst = CLOGL_PUTF((intmax_t)v); break;
+			case 'z': rst = CLOGL_PUTF((size_t)v); break;
+			case 't': rst = CLOGL_PUTF((ptrdiff_t)v); break;
+			default:  rst = CLOGL_PUTF((int)v); break;
+			}
+			break;
+		}
+		case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+			if ('L' == sp.size) {
+				long double v;
+				if (data + sizeof(v) > end) return -1;
+				memcpy(&v, data, sizeof(v));
+				data += (sizeof(v) + 7) & ~7;
+				rst = CLOGL_PUTF(v);
+			} else {
+				double v;
+				if (data + 8 > end) return -1;
+				memcpy(&v, data, sizeof(v));
+				data += 8;
+				rst = CLOGL_PUTF(v);
+			}
+			break;
+		case 's': {
+			unsigned int n = 0;
+			if (data + sizeof(n) > end) return -1;
+			memcpy(&n, data, sizeof(n));
+			const char *v = data + sizeof(n);
+			size_t skip = sizeof(n) + ((0xFFFFFFFF == n) ? 0 : n);
+			data += (skip + 7) & ~7;
+			if (data > end) return -1;
+			if (0xFFFFFFFF == n) {
+				rst = CLOGL_PUTF((const char *)NULL);
+			} else {
+				// 拷贝时已经按精度截断, 这里用 %.*s 不再依赖结尾的0
+				char fmt2[40];
+				const char *dot = strchr(sp.spec, '.');
+				size_t hl = dot ? (size_t)(dot - sp.spec) : strlen(sp.spec) - 1;
+				memcpy(fmt2, sp.spec, hl);
+				strcpy(fmt2 + hl, ".*s");
+				if (sp.starW) {
+					rst = cloglPutf(buff, &pos, fmt2, w, (int)n, v);
+				} else {
+					rst = cloglPutf(buff, &pos, fmt2, (int)n, v);
+				}
+			}
+			break;
+		}
+		case 'p': {
+			void *v = NULL;
+			if (data + 8 > end) return -1;
+			memcpy(&v, data, sizeof(v));
+			data += 8;
+			rst = CLOGL_PUTF(v);
+			break;
+		}
+		case 'm':
+			rst = cloglPutf(buff, &pos, sp.spec);
+			break;
+		default:
+			return -1;
+		}
+#undef CLOGL_PUTF
+
+		if (rst) {
+			return -1;
+		}
+	}
+
+	if (cloglPut(buff, &pos, "", 0)) {
+		return -1;
+	}
+	buff->msgBuff[pos] = 0;
+
+	return 0;
+}
+
+/* 二进制日志文件 >>> */
+/*
+  文件由块组成. 块头: "CLGB" 版本(1字节) 保留(3字节) pid(4) 内容长度(4) 内容的CRC32(4), 整数都是小端
+  内容是一串帧: 帧长(varint) 类型(1字节) 帧体. 调用处编号和时间差每块重新开始, 坏块跳过不影响后面的
+    SITE: 编号 级别 行号 文件名 函数名 格式串. 块里第一次用到一个调用处时写
+    REC:  时间差(微秒, zigzag) 级别 线程号 调用处编号 参数
+    TEXT: 格式化好的一条. 不是CLOGL_*宏记的日志
+  参数的类型由格式串决定, 不另外存: 整数 zigzag varint, double 8字节, long double 按本机大小,
+  字符串 长度+1(0是NULL)和内容, 指针 varint, * 宽度精度 zigzag varint, %m 存errno
+ */
+#define CLOGL_BIN_MAGIC       "CLGB"
+#define CLOGL_BIN_VERSION     1
+#define CLOGL_BIN_HEAD        20                  // 块头字节数
+
+#define CLOGL_BIN_SITE        1                   // 帧类型
+#define CLOGL_BIN_REC         2
+#define CLOGL_BIN_TEXT        3
+
+/*
+  块里定义过的一个调用处. 按site指针开放定址
+ */
+typedef struct _clogl_bin_site
+{
+	const cloglSite *site;            // 调用处
+	unsigned int gen;                 // 在哪一块定义的. 不是opt->gen的是空位
+	unsigned int id;                  // 块里的编号
+} cloglBinSite;
+
+static uint32_t cloglCrcTab[256];
+static pthread_once_t cloglCrcOnce = PTHREAD_ONCE_INIT;
+
+static void cloglCrcInit()
+{
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t c = i;
+		for (int k = 0; k < 8; k++) {
+			c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+		}
+		cloglCrcTab[i] = c;
+	}
+}
+
+/*
+  CRC32. 和zlib的crc32一样
+ */
+static uint32_t cloglCrc32(const void *data, size_t len)
+{
+	(void)pthread_once(&cloglCrcOnce, cloglCrcInit);
+
+	const uint8_t *p = (const uint8_t *)data;
+	uint32_t c = 0xFFFFFFFF;
+	while (len--) {
+		c = cloglCrcTab[(c ^ *p++) & 0xFF] ^ (c >> 8);
+	}
+
+	return c ^ 0xFFFFFFFF;
+}
+
+static void cloglPutLe32(char *p, uint32_t v)
+{
+	p[0] = (char)v;
+	p[1] = (char)(v >> 8);
+	p[2] = (char)(v >> 16);
+	p[3] = (char)(v >> 24);
+}
+
+static uint32_t cloglGetLe32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline uint64_t cloglZig(int64_t v)
+{
+	return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t cloglUnzig(uint64_t v)
+{
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+/*
+  v编码成varint写到b, 最多10字节. 返回长度
+ */
+static int cloglVarEnc(uint8_t *b, uint64_t v)
+{
+	int n = 0;
+	while (v >= 0x80) {
+		b[n++] = (uint8_t)v | 0x80;
+		v >>= 7;
+	}
+	b[n++] = (uint8_t)v;
+
+	return n;
+}
+
+static int cloglPutVar(clogMsg *buff, size_t *pos, uint64_t v)
+{
+	uint8_t b[10];
+
+	return cloglPut(buff, pos, b, cloglVarEnc(b, v));
+}
+
+static int cloglPutStr(clogMsg *buff, size_t *pos, const char *s)
+{
+	size_t n = s ? strlen(s) : 0;
+
+	return cloglPutVar(buff, pos, n) || cloglPut(buff, pos, s ? s : "", n);
+}
+
+static int cloglGetVar(const uint8_t **p, const uint8_t *end, uint64_t *v)
+{
+	*v = 0;
+	for (int shift = 0; shift < 64 && *p < end; shift += 7) {
+		uint8_t b = *(*p)++;
+		*v |= (uint64_t)(b & 0x7F) << shift;
+		if (!(b & 0x80)) {
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/*
+  把cloglArgsPack保存的参数按格式串重新编成紧凑的, 追加到buff
+ */
+static int cloglBinArgs(clogMsg *buff, size_t *pos, const char *format, int err, const char *data, size_t len)
+{
+	const char *end = data + len;
+	const char *p = format;
+	cloglSpec sp;
+
+	while ((p = strchr(p, '%'))) {
+		p ++;
+		if ('%' == *p) {
+			p ++;
+			continue;
+		}
+		p = cloglParseSpec(p, &sp);
+		if (!p) {
+			return -1;
+		}
+
+		int rst = 0;
+		for (int i = sp.starW + sp.starP; i > 0; i--) {
+			int v = 0;
+			if (data + 8 > end) return -1;
+			memcpy(&v, data, sizeof(v));
+			data += 8;
+			rst |= cloglPutVar(buff, pos, cloglZig(v));
+		}
+
+		switch (sp.conv) {
+		case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': case 'c': {
+			long long v = 0;
+			if (data + 8 > end) return -1;
+			memcpy(&v, data, sizeof(v));
+			data += 8;
+			rst |= cloglPutVar(buff, pos, cloglZig(v));
+			break;
+		}
+		case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A': {
+			size_t n = ('L' == sp.size) ? sizeof(long double) : sizeof(double);
+			if (data + n > end) return -1;
+			rst |= cloglPut(buff, pos, data, n);
+			data += (n + 7) & ~7;
+			break;
+		}
+		case 's': {
+			unsigned int n = 0;
+			if (data + sizeof(n) > end) return -1;
+			memcpy(&n, data, sizeof(n));
+			if (0xFFFFFFFF == n) {
+				rst |= cloglPutVar(buff, pos, 0);
+				data += 8;
+				break;
+			}
+			if (data + sizeof(n) + n > end) return -1;
+			rst |= cloglPutVar(buff, pos, (uint64_t)n + 1);
+			rst |= cloglPut(buff, pos, data + sizeof(n), n);
+			data += (sizeof(n) + n + 7) & ~7;
+			break;
+		}
+		case 'p': {
+			void *v = NULL;
+			if (data + 8 > end) return -1;
+			memcpy(&v, data, sizeof(v));
+			data += 8;
+			rst |= cloglPutVar(buff, pos, (uintptr_t)v);
+			break;
+		}
+		case 'm':
+			rst |= cloglPutVar(buff, pos, (unsigned int)err);
+			break;
+		default:
+			return -1;
+		}
+
+		if (rst) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+  cloglBinArgs的反过程: 把*q处的紧凑参数还原成cloglArgsPack的样子, 给cloglArgsRender用
+ */
+static int cloglBinUnargs(clogMsg *buff, size_t *pos, const char *format, int *err, const uint8_t **q, const uint8_t *end)
+{
+	const char *p = format;
+	cloglSpec sp;
+	uint64_t v = 0;
+
+	while ((p = strchr(p, '%'))) {
+		p ++;
+		if ('%' == *p) {
+			p ++;
+			continue;
+		}
+		p = cloglParseSpec(p, &sp);
+		if (!p) {
+			return -1;
+		}
+
+		int rst = 0;
+		for (int i = sp.starW + sp.starP; i > 0; i--) {
+			if (cloglGetVar(q, end, &v)) return -1;
+			int w = (int)cloglUnzig(v);
+			rst |= cloglPutArg(buff, pos, &w, sizeof(w));
+		}
+
+		switch (sp.conv) {
+		case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': case 'c': {
+			if (cloglGetVar(q, end, &v)) return -1;
+			long long n = cloglUnzig(v);
+			rst |= cloglPutArg(buff, pos, &n, sizeof(n));
+			break;
+		}
+		case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A': {
+			size_t n = ('L' == sp.size) ? sizeof(long double) : sizeof(double);
+			if ((size_t)(end - *q) < n) return -1;
+			rst |= cloglPutArg(buff, pos, *q, n);
+			*q += n;
+			break;
+		}
+		case 's': {
+			if (cloglGetVar(q, end, &v)) return -1;
+			unsigned int n = 0xFFFFFFFF; // NULL
+			if (v) {
+				if (v - 1 > (uint64_t)(end - *q)) return -1;
+				n = (unsigned int)(v - 1);
+			}
+			rst |= cloglPut(buff, pos, &n, sizeof(n));
+			if (v) {
+				rst |= cloglPut(buff, pos, *q, n);
+				*q += n;
+			}
+			rst |= cloglPad(buff, pos);
+			break;
+		}
+		case 'p': {
+			if (cloglGetVar(q, end, &v)) return -1;
+			void *ptr = (void *)(uintptr_t)v;
+			rst |= cloglPutArg(buff, pos, &ptr, sizeof(ptr));
+			break;
+		}
+		case 'm':
+			if (cloglGetVar(q, end, &v)) return -1;
+			*err = (int)v;
+			break;
+		default:
+			return -1;
+		}
+
+		if (rst) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+  填好块头, 把块写进文件
+ */
+static int cloglBinFlush(cloglBinFileOpt *opt)
+{
+	if (opt->out.used <= CLOGL_BIN_HEAD) {
+		opt->out.used = 0;
+		return 0;
+	}
+
+	char *h = opt->out.buf;
+	size_t n = opt->out.used - CLOGL_BIN_HEAD;
+	memcpy(h, CLOGL_BIN_MAGIC, 4);
+	h[4] = CLOGL_BIN_VERSION;
+	h[5] = h[6] = h[7] = 0;
+	cloglPutLe32(h + 8, (uint32_t)opt->pid);
+	cloglPutLe32(h + 12, (uint32_t)n);
+	cloglPutLe32(h + 16, cloglCrc32(h + CLOGL_BIN_HEAD, n));
+
+	return cloglFileFlush(&opt->out);
+}
+
+/*
+  块是空的就开始一个新块: 留出块头, 调用处编号和时间差重新开始. fork出的子进程先把父进程的块写掉
+ */
+static int cloglBinBegin(cloglApd *apd, cloglBinFileOpt *opt, pid_t pid)
+{
+	if (opt->out.used && opt->pid != pid) {
+		(void)cloglBinFlush(opt);
+	}
+	if (opt->out.used) {
+		return 0;
+	}
+
+	if (!opt->out.buf) {
+		opt->out.size = (apd->flushBytes > CLOGL_FILE_BUFF) ? apd->flushBytes : CLOGL_FILE_BUFF;
+		opt->out.buf = (char *)malloc(opt->out.size);
+		if (!opt->out.buf) {
+			opt->out.size = 0;
+			return -1;
+		}
+	}
+	opt->out.used = CLOGL_BIN_HEAD;
+	opt->pid = pid;
+	opt->lastUs = 0;
+	opt->siteCount = 0;
+	opt->gen ++;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &opt->out.first);
+	if (apd->flushMs > 0) {
+		cloglSchedAt(apd, cloglNowMs() + apd->flushMs);
+	}
+
+	return 0;
+}
+
+/*
+  opt->frame里编好的n字节作为一帧放进块. 块不会在一条记录中间断开, 放不下就把缓冲扩大
+ */
+static int cloglBinFrame(cloglBinFileOpt *opt, size_t n)
+{
+	size_t need = opt->out.used + 10 + n;
+	if (need > opt->out.size) {
+		size_t size = opt->out.size;
+		while (size < need)
+			size *= 2;
+		char *nb = (char *)realloc(opt->out.buf, size);
+		if (!nb) {
+			return -1;
+		}
+		opt->out.buf = nb;
+		opt->out.size = size;
+	}
+
+	opt->out.used += cloglVarEnc((uint8_t *)opt->out.buf + opt->out.used, n);
+	memcpy(opt->out.buf + opt->out.used, opt->frame.msgBuff, n);
+	opt->out.used += n;
+
+	return 0;
+}
+
+/*
+  一条记录放进块后按输出方向的刷新策略决定写不写
+ */
+static int cloglBinCommit(cloglApd *apd, cloglBinFileOpt *opt, int priority)
+{
+	if (0 == apd->flushBytes || opt->out.used >= apd->flushBytes
+	    || (priority != CLOGL_LEVEL_DATA && priority <= apd->flushLevel)) {
+		return cloglBinFlush(opt);
+	}
+
+	return 0;
+}
+
+/*
+  调用处在这一块里的编号. 第一次用到时先写一个SITE帧
+ */
+static int cloglBinSiteId(cloglBinFileOpt *opt, const cloglSite *site, unsigned int *id)
+{
+	if ((opt->siteCount + 1) * 2 > opt->siteCap) {
+		unsigned int cap = opt->siteCap ? opt->siteCap * 2 : 64;
+		cloglBinSite *ns = (cloglBinSite *)calloc(cap, sizeof(cloglBinSite));
+		if (!ns) {
+			return -1;
+		}
+		for (unsigned int i = 0; i < opt->siteCap; i++) {
+			cloglBinSite *e = &opt->sites[i];
+			if (!e->site || e->gen != opt->gen) {
+				continue;
+			}
+			unsigned int h = (unsigned int)(((uintptr_t)e->site * 0x9E3779B97F4A7C15ULL) >> 32) & (cap - 1);
+			while (ns[h].site)
+				h = (h + 1) & (cap - 1);
+			ns[h] = *e;
+		}
+		free(opt->sites);
+		opt->sites = ns;
+		opt->siteCap = cap;
+	}
+
+	unsigned int mask = opt->siteCap - 1;
+	unsigned int h = (unsigned int)(((uintptr_t)site * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+	while (opt->sites[h].site && opt->sites[h].gen == opt->gen) {
+		if (opt->sites[h].site == site) {
+			*id = opt->sites[h].id;
+			return 0;
+		}
+		h = (h + 1) & mask;
+	}
+
+	size_t pos = 0;
+	uint8_t type = CLOGL_BIN_SITE;
+	uint8_t level = (uint8_t)site->level;
+	int rst = cloglPut(&opt->frame, &pos, &type, 1);
+	rst |= cloglPutVar(&opt->frame, &pos, opt->siteCount);
+	rst |= cloglPut(&opt->frame, &pos, &level, 1);
+	rst |= cloglPutVar(&opt->frame, &pos, (unsigned int)site->line);
+	rst |= cloglPutStr(&opt->frame, &pos, site->file);
+	rst |= cloglPutStr(&opt->frame, &pos, site->func);
+	rst |= cloglPutStr(&opt->frame, &pos, site->format);
+	if (rst || cloglBinFrame(opt, pos)) {
+		return -1;
+	}
+
+	opt->sites[h].site = site;
+	opt->sites[h].gen = opt->gen;
+	opt->sites[h].id = opt->siteCount ++;
+	*id = opt->sites[h].id;
+
+	return 0;
+}
+
+static int binFile_open(cloglApd *apd)
+{
+	cloglBinFileOpt *opt = (cloglBinFileOpt *)apd->opt;
+	if (!opt) {
+		return -1;
+	}
+	if (!opt->fileName || !opt->fileName[0]) {
+		return -1;
+	}
+
+	if (cloglFileOpen(&opt->out, opt->fileName)) {
+		return -1;
+	}
+
+	opt->now = time(NULL);
+	opt->next = opt->span ? opt->now + opt->span : 0;
+	apd->isOpen = 1;
+	if (opt->next) {
+		cloglSchedAt(apd, (int64_t)opt->next * 1000);
+	}
+
+	return 0;
+}
+
+static int binFile_close(cloglApd *apd)
+{
+	cloglBinFileOpt *opt = (cloglBinFileOpt *)apd->opt;
+	if (!opt) {
+		return -1;
+	}
+
+	if (opt->out.fd >= 0) {
+		int rst = cloglBinFlush(opt);
+		if (cloglFileClose(&opt->out) || rst) {
+			return -1;
+		}
+		apd->isOpen = 0;
+	}
+
+	return 0;
+}
+
+/*
+  不是CLOGL_*宏记的, 或者参数不能保存的日志, 存格式化好的
+ */
+static int binFile_append(cloglApd *apd, int priority, const char *msg, size_t len)
+{
+	if (!msg) {
+		return -1;
+	}
+
+	cloglBinFileOpt *opt = (cloglBinFileOpt *)apd->opt;
+	if (!opt || opt->out.fd < 0) {
+		return -1;
+	}
+
+	if (cloglBinBegin(apd, opt, cloglSelf()->pid)) {
+		return -1;
+	}
+	size_t pos = 0;
+	uint8_t type = CLOGL_BIN_TEXT;
+	if (cloglPut(&opt->frame, &pos, &type, 1) || cloglPut(&opt->frame, &pos, msg, len) || cloglBinFrame(opt, pos)) {
+		return -1;
+	}
+
+	return cloglBinCommit(apd, opt, priority);
+}
+
+/*
+  CLOGL_*宏记的日志: 不格式化, 存调用处编号和参数
+ */
+static int binFile_record(cloglApd *apd, const cloglRec *rec, int err, const char *args, size_t len)
+{
+	cloglBinFileOpt *opt = (cloglBinFileOpt *)apd->opt;
+	if (!opt || opt->out.fd < 0) {
+		return -1;
+	}
+
+	const cloglSite *site = rec->site;
+	unsigned int id = 0;
+	if (cloglBinBegin(apd, opt, rec->pid) || cloglBinSiteId(opt, site, &id)) {
+		return -1;
+	}
+
+	int64_t us = (int64_t)rec->ts.tv_sec * 1000000 + rec->ts.tv_nsec / 1000;
+	size_t pos = 0;
+	uint8_t type = CLOGL_BIN_REC;
+	uint8_t level = (uint8_t)site->level;
+	int rst = cloglPut(&opt->frame, &pos, &type, 1);
+	rst |= cloglPutVar(&opt->frame, &pos, cloglZig(us - opt->lastUs)); // 延迟格式化时不一定按时间顺序
+	rst |= cloglPut(&opt->frame, &pos, &level, 1);
+	rst |= cloglPutVar(&opt->frame, &pos, (uint32_t)rec->tid);
+	rst |= cloglPutVar(&opt->frame, &pos, id);
+	rst |= cloglBinArgs(&opt->frame, &pos, site->format, err, args, len);
+	if (rst || cloglBinFrame(opt, pos)) {
+		return -1;
+	}
+	opt->lastUs = us;
+
+	return cloglBinCommit(apd, opt, site->level);
+}
+
+static int binFile_flush(cloglApd *apd)
+{
+	cloglBinFileOpt *opt = (cloglBinFileOpt *)apd->opt;
+	if (!opt) {
+		return -1;
+	}
+
+	return cloglBinFlush(opt);
+}
+
+/*
+  块里最早的记录超过flushMs就写. 到了opt->next换文件, 和TimeFile一样改名和打开都在锁外
+ */
+static int binFile_event(cloglApd *apd)
+{
+	cloglBinFileOpt *opt = (cloglBinFileOpt *)apd->opt;
+	if (!opt) {
+		return -1;
+	}
+
+	pthread_mutex_lock(&apd->pLock);
+	if (0 == apd->isOpen || opt->out.fd < 0) {
+		pthread_mutex_unlock(&apd->pLock);
+		return 0;
+	}
+	if (opt->out.used && apd->flushMs > 0) {
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+		long ms = (ts.tv_sec - opt->out.first.tv_sec) * 1000 + (ts.tv_nsec - opt->out.first.tv_nsec) / 1000000;
+		if (ms >= apd->flushMs) {
+			(void)cloglBinFlush(opt);
+		} else {
+			cloglSchedAt(apd, cloglNowMs() + apd->flushMs - ms);
+		}
+	}
+	time_t opened = opt->now;
+	int due = opt->next && time(NULL) >= opt->next;
+	if (!due && opt->next) {
+		cloglSchedAt(apd, (int64_t)opt->next * 1000);
+	}
+	pthread_mutex_unlock(&apd->pLock);
+	if (!due) {
+		return 0;
+	}
+
+	char *backup = cloglFileRename(opt->fileName, opened, "%Y-%m-%d %X");
+	int fd = cloglFileOpenFd(opt->fileName);
+	if (fd < 0) {
+		cloglErr("binFile_event open error");
+		free(backup);
+		cloglSchedAt(apd, cloglNowMs() + 1000); // 过一会儿再试
+		return -1;
+	}
+
+	pthread_mutex_lock(&apd->pLock);
+	if (0 == apd->isOpen || opt->out.fd < 0) { // 已经被关了
+		pthread_mutex_unlock(&apd->pLock);
+		close(fd);
+		free(backup);
+		return 0;
+	}
+	(void)cloglBinFlush(opt); // 块里的属于旧文件
+	int oldFd = opt->out.fd;
+	opt->out.fd = fd;
+	opt->now = time(NULL);
+	opt->next = opt->now + opt->span;
+	cloglSchedAt(apd, (int64_t)opt->next * 1000);
+	pthread_mutex_unlock(&apd->pLock);
+
+	close(oldFd);
+	cloglZipPush(apd, opt->fileName, backup);
+	free(backup);
+
+	return 0;
+}
+
+static int binFile_init(cloglApd *apd, const char *fileName)
+{
+	if (!fileName || !fileName[0]) {
+		return -1;
+	}
+
+	cloglBinFileOpt *opt = (cloglBinFileOpt *)calloc(1, sizeof(cloglBinFileOpt));
+	if (!opt) {
+		return -1;
+	}
+	opt->fileName = strdup(fileName);
+	if (!opt->fileName) {
+		free(opt);
+		return -1;
+	}
+	opt->out.fd = -1;
+	opt->span = 1 * 60 * 60; // 默认简隔1小时
+	apd->opt = opt;
+
+	// 按块写才有CRC的意义, 默认攒一块或一秒
+	apd->flushBytes = CLOGL_FILE_BUFF;
+	apd->flushMs = 1000;
+
+	return 0;
+}
+
+static int binFile_set(cloglApd *apd, const char *key, const char *value)
+{
+	cloglBinFileOpt *opt = (cloglBinFileOpt *)apd->opt;
+	if (!opt) {
+		return -1;
+	}
+
+	if (!strcmp(key, "span")) {
+		int hours = atoi(value);
+		if (hours < 0) {
+			return -1;
+		}
+		opt->span = (time_t)hours * 60 * 60; // 0 不换文件
+		return 0;
+	}
+
+	return -1;
+}
+
+/*
+  解码时块里的一个调用处. 字符串拷出来加上结尾的0
+ */
+typedef struct _clogl_dump_site
+{
+	cloglSite site;
+	char *mem;                        // file, func, format放在一起
+} cloglDumpSite;
+
+static char *cloglFmtf(cloglFmt *fmt, clogl_t *log, const char *format, ...)
+{
+	va_list va;
+	va_start(va, format);
+	char *msg = cloglFmtRun(fmt, log, format, va);
+	va_end(va);
+
+	return msg;
+}
+
+/*
+  解码一个块里的帧并输出. 块内容不对返回-1, 已经输出的不收回
+ */
+static int cloglDumpBlock(clogl_t *log, cloglFmt *fmt, FILE *out, pid_t pid, const uint8_t *p, const uint8_t *end)
+{
+	cloglThreadBuf *bufs = cloglThreadBufs();
+	if (!bufs) {
+		return -1;
+	}
+	clogMsg *pack = &bufs->pack;
+	clogMsg *body = &bufs->dump;
+	cloglDumpSite *sites = NULL;
+	unsigned int count = 0;
+	int64_t us = 0;
+	int rst = 0;
+
+	while (p < end && !rst) {
+		uint64_t n = 0;
+		if (cloglGetVar(&p, end, &n) || 0 == n || n > (uint64_t)(end - p)) {
+			rst = -1;
+			break;
+		}
+		const uint8_t *q = p;
+		const uint8_t *fend = p + n;
+		p = fend;
+
+		uint64_t id = 0, v = 0, tid = 0;
+		switch (*q++) {
+		case CLOGL_BIN_SITE: {
+			uint64_t line = 0, sl[3];
+			const uint8_t *sp[3];
+			if (cloglGetVar(&q, fend, &id) || id != count || q >= fend) {
+				rst = -1;
+				break;
+			}
+			int level = *q++;
+			if (cloglGetVar(&q, fend, &line)) {
+				rst = -1;
+				break;
+			}
+			for (int i = 0; i < 3 && !rst; i++) {
+				if (cloglGetVar(&q, fend, &sl[i]) || sl[i] > (uint64_t)(fend - q)) {
+					rst = -1;
+				} else {
+					sp[i] = q;
+					q += sl[i];
+				}
+			}
+			cloglDumpSite *ns = rst ? NULL : (cloglDumpSite *)realloc(sites, (count + 1) * sizeof(cloglDumpSite));
+			if (!ns) {
+				rst = -1;
+				break;
+			}
+			sites = ns;
+			char *mem = (char *)malloc(sl[0] + sl[1] + sl[2] + 3);
+			if (!mem) {
+				rst = -1;
+				break;
+			}
+			char *s[3];
+			for (int i = 0, off = 0; i < 3; i++) {
+				s[i] = mem + off;
+				memcpy(s[i], sp[i], sl[i]);
+				s[i][sl[i]] = 0;
+				off += sl[i] + 1;
+			}
+			cloglSite site = {level, s[0], (int)line, s[1], s[2]};
+			sites[count].site = site;
+			sites[count].mem = mem;
+			count ++;
+			break;
+		}
+		case CLOGL_BIN_REC: {
+			if (cloglGetVar(&q, fend, &v) || q >= fend) {
+				rst = -1;
+				break;
+			}
+			int level = *q++;
+			if (cloglGetVar(&q, fend, &tid) || cloglGetVar(&q, fend, &id) || id >= count) {
+				rst = -1;
+				break;
+			}
+			us += cloglUnzig(v);
+
+			const cloglSite *site = &sites[id].site;
+			size_t pos = 0;
+			int err = 0;
+			if (cloglBinUnargs(pack, &pos, site->format, &err, &q, fend)) {
+				rst = -1;
+				break;
+			}
+			errno = err;
+			if (cloglArgsRender(body, site->format, pack->msgBuff ? pack->msgBuff : "", pos)) {
+				rst = -1;
+				break;
+			}
+
+			cloglRec rec;
+			memset(&rec, 0, sizeof(rec));
+			rec.site = site;
+			rec.level = level;
+			rec.ts.tv_sec = us / 1000000;
+			rec.ts.tv_nsec = (us % 1000000) * 1000;
+			rec.pid = pid;
+			rec.tid = (pid_t)tid;
+			snprintf(rec.ids, sizeof(rec.ids), " <%5d %5d>", (int)pid, (int)tid);
+
+			cloglCur = &rec;
+			char *msg = cloglFmtf((CLOGL_LEVEL_DATA == level) ? &cloglFmts[0] : fmt, log, "%s", body->msgBuff);
+			cloglCur = NULL;
+			if (msg) {
+				fprintf(out, "%s\n", msg);
+			}
+			break;
+		}
+		case CLOGL_BIN_TEXT:
+			fwrite(q, 1, fend - q, out);
+			fputc('\n', out);
+			break;
+		default:
+			break; // 以后加的帧类型
+		}
+	}
+
+	for (unsigned int i = 0; i < count; i++) {
+		free(sites[i].mem);
+	}
+	free(sites);
+
+	return rst;
+}
+
+/*
+ * 功能:
+ *    把"BinFile"输出方向写的二进制日志文件还原成文本, 和用fmt格式的文本输出方向写的一样
+ *    CRC不对的块(写了一半, 被改过)跳过, 从下一个块头接着读
+ *    "FlightRecorder"的文件按写的顺序输出环里还在的日志, 写了一半和被覆盖的槽算坏块. 不用fmt
+ * 入参:
+ *    fileName: 二进制日志文件名或飞行记录器文件名
+ *    out:      输出到哪
+ *    fmt:      日志格式名. "defFmt", "ptidFmt", "jsonFmt". NULL 用"ptidFmt"
+ * 出参:
+ *    NO
+ * 返回值:
+ *    跳过的坏块个数, 打不开文件返回 -1
+ */
+int cloglDump(const char *fileName, FILE *out, const char *fmt)
+{
+	if (!fileName || !out) {
+		return -1;
+	}
+
+	cloglFmt *format = cloglGetFmt(fmt ? fmt : "ptidFmt");
+	if (!format) {
+		return -1;
+	}
+	clogl_t *log = cloglGet("clogl-dump"); // 只用它的线程私有缓冲区
+	if (!log) {
+		log = cloglNew("clogl-dump", CLOGL_LEVEL_DEBUG);
+	}
+	if (!log) {
+		return -1;
+	}
+
+	int fd = open(fileName, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return -1;
+	}
+	struct stat st;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return -1;
+	}
+	if (0 == st.st_size) {
+		close(fd);
+		return 0;
+	}
+	uint8_t *base = (uint8_t *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (MAP_FAILED == (void *)base) {
+		return -1;
+	}
+
+	if ((size_t)st.st_size >= sizeof(cloglFrHead) && !memcmp(base, CLOGL_FR_MAGIC, 8)) {
+		int bad = cloglFrDump(base, st.st_size, out);
+		munmap(base, st.st_size);
+		return bad;
+	}
+
+	const uint8_t *p = base;
+	const uint8_t *end = base + st.st_size;
+	int bad = 0;
+	while (p < end) {
+		size_t left = end - p;
+		uint32_t n = 0;
+		int ok = left >= CLOGL_BIN_HEAD && !memcmp(p, CLOGL_BIN_MAGIC, 4) && CLOGL_BIN_VERSION == p[4];
+		if (ok) {
+			n = cloglGetLe32(p + 12);
+			ok = n <= left - CLOGL_BIN_HEAD && cloglCrc32(p + CLOGL_BIN_HEAD, n) == cloglGetLe32(p + 16);
+		}
+		if (!ok) { // 找下一个块头
+			bad ++;
+			const uint8_t *next = (const uint8_t *)memmem(p + 1, left - 1, CLOGL_BIN_MAGIC, 4);
+			p = next ? next : end;
+			continue;
+		}
+
+		if (cloglDumpBlock(log, format, out, (pid_t)cloglGetLe32(p + 8), p + CLOGL_BIN_HEAD, p + CLOGL_BIN_HEAD + n)) {
+			bad ++;
+		}
+		p += CLOGL_BIN_HEAD + n;
+	}
+	munmap(base, st.st_size);
+
+	return bad;
+}
+/* 二进制日志文件 <<< */
+
+static int cloglWantsText(clogl_t *log, int priority);
+static int cloglRecordAll(clogl_t *log, const cloglRec *rec, int err, const char *data, size_t len);
+
+/*
+  写线程里格式化并输出一条延迟格式化的日志. 格式化由各输出方向原来的日志格式完成
+ */
+static void cloglDeferOut(cloglCell *cell)
+{
+	static clogMsg body; // 只有写线程用
+
+	// 二进制输出方向直接要保存的参数
+	cloglRcuEnter();
+	cloglCur = &cell->rec;
+	if (cloglRecordAll(cell->log, &cell->rec, cell->err, cell->data, cell->len)) {
+		cell->rec.binDone = 1;
+	}
+	if (!cloglWantsText(cell->log, cell->priority)) {
+		goto out;
+	}
+
+	errno = cell->err;
+	if (cloglArgsRender(&body, cell->rec.site->format, cell->data, cell->len)) {
+		cloglErr("cloglDeferOut render error");
+		goto out;
+	}
+
+	cloglDispatchf(cell->log, cell->priority, 0, "%s", body.msgBuff);
+out:
+	cloglCur = NULL;
+	cloglRcuExit();
+}
+
+/*
+  调用线程保存参数, 放进异步队列. 不支持的格式返回-1, 由调用线程自己格式化
+ */
+static int cloglDeferPush(clogl_t *log, const cloglSite *site, va_list args)
+{
+	cloglThreadBuf *bufs = cloglThreadBufs(); // 各线程的二进制日志记录
+	if (!bufs) {
+		return -1;
+	}
+
+	cloglCell head;
+	memset(&head, 0, sizeof(head));
+	head.kind = CLOGL_CELL_ARGS;
+	head.priority = site->level;
+	head.log = log;
+	head.err = errno;
+	head.rec.site = site;
+	head.rec.level = site->level;
+	const cloglIds *self = cloglSelf();
+	head.rec.pid = self->pid;
+	head.rec.tid = self->tid;
+	memcpy(head.rec.ids, self->str, self->len + 1);
+	clock_gettime(CLOCK_REALTIME, &head.rec.ts);
+
+	size_t len = 0;
+	if (cloglArgsPack(&bufs->pack, &len, site->format, args)) {
+		return -1;
+	}
+
+	return cloglAsyncPush(&head, bufs->pack.msgBuff ? bufs->pack.msgBuff : "", len);
+}
+
+/*
+  输出方向是否要这个级别的日志
+ */
+static inline int cloglApdWants(cloglApd *apd, int priority)
+{
+	return apd->fmt && (apd->fmt->format || apd->fmt->layout) && apd->apdType && apd->apdType->append && (apd->priority >= priority || cloglForce)
+		&& !(apd->apdType->record && cloglCur && cloglCur->binDone);
+}
+
+/*
+  还有没有输出方向要格式化好的日志
+ */
+static int cloglWantsText(clogl_t *log, int priority)
+{
+	for (cloglApd *tmpapd = __atomic_load_n(&log->apds, __ATOMIC_ACQUIRE); tmpapd; tmpapd = tmpapd->next) {
+		if (cloglApdWants(tmpapd, priority))
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+  有没有二进制输出方向要这个级别的日志
+ */
+static int cloglWantsRecord(clogl_t *log, int priority)
+{
+	for (cloglApd *tmpapd = __atomic_load_n(&log->apds, __ATOMIC_ACQUIRE); tmpapd; tmpapd = tmpapd->next) {
+		if (tmpapd->apdType && tmpapd->apdType->record && (tmpapd->priority >= priority || cloglForce))
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+  把保存的参数交给所有要这个级别日志的二进制输出方向. 返回交给了几个
+ */
+static int cloglRecordAll(clogl_t *log, const cloglRec *rec, int err, const char *data, size_t len)
+{
+	int n = 0;
+	for (cloglApd *tmpapd = __atomic_load_n(&log->apds, __ATOMIC_ACQUIRE); tmpapd; tmpapd = tmpapd->next) {
+		if (tmpapd->apdType && tmpapd->apdType->record && (tmpapd->priority >= rec->site->level || cloglForce)) {
+			(void)cloglApdRecord(tmpapd, rec, err, data, len);
+			n ++;
+		}
+	}
+
+	return n;
+}
+
+/*
+  输出方向对这个级别日志用的格式
+ */
+static inline cloglFmt *cloglApdFmt(cloglApd *apd, int priority)
+{
+	/* DATA级别的日志特别处理 !!! JSON的还是JSON */
+	return (CLOGL_LEVEL_DATA == priority && apd->fmt->format != cloglJsonFmt) ? &cloglFmts[0] : apd->fmt;
+}
+
+/*
+  格式化日志并发送到各输出方向. 先按级别过滤, 每个不同的格式只格式化一次, 结果给用这个格式的输出方向共用
+  要在读区间里调. 链只读一次, 重新加载配置换了链也走完旧链
+ */
+static void cloglDispatch(clogl_t *log, int priority, int async, const char *format, va_list args)
+{
+	cloglApd *head = __atomic_load_n(&log->apds, __ATOMIC_ACQUIRE);
+	cloglOutLog = log;
+	for (cloglApd *tmpapd = head; tmpapd; tmpapd = tmpapd->next) {	
+		if (!cloglApdWants(tmpapd, priority))
+			continue;
+
+		// 前面有用同样格式的, 已经输出过了
+		cloglFmt *fmt = cloglApdFmt(tmpapd, priority);
+		cloglApd *prev = head;
+		while (prev != tmpapd && !(cloglApdWants(prev, priority) && cloglApdFmt(prev, priority) == fmt))
+			prev = prev->next;
+		if (prev != tmpapd)
+			continue;
+
+		// 格式化日志信息. 最长512K
+		va_list va;
+		va_copy(va, args);
+		char *logMsg = cloglFmtRun(fmt, log, format, va);
+		va_end(va);
+
+		if (!logMsg)
+			continue;
+		size_t len = strlen(logMsg);
+
+		uint64_t mask = 0;
+		int i = 0;
+		for (cloglApd *same = tmpapd; same; same = same->next, i++) {
+			if (!cloglApdWants(same, priority) || cloglApdFmt(same, priority) != fmt)
+				continue;
+
+			if (!async) {
+				(void)cloglApdAppend(same, priority, logMsg, len); // 输出日志
+			} else if (i < 64) {
+				mask |= 1ULL << i;
+			} else {
+				(void)cloglAsyncText(same, 1, priority, logMsg, len);
+			}
+		}
+		if (mask) {
+			(void)cloglAsyncText(tmpapd, mask, priority, logMsg, len); // 交给写线程输出
+		}
+	}
+}
+
+static void cloglDispatchf(clogl_t *log, int priority, int async, const char *format, ...)
+{
+	va_list va;
+	va_start(va, format);
+	cloglDispatch(log, priority, async, format, va);
+	va_end(va);
+}
+
+/*
+ * 功能:
+ *    给用户调用的记录日志函数
+ * 入参:
+ *    log:      日志结构对象
+ *    priority: 日志级别
+ *    format:   日志信息
+ * 出参:
+ *    NO
+ * 返回值:
+ *    NO
+ */
+void clogLogger(clogl_t *log, int priority, const char *format, ...)
+{	
+	if (!log)
+		return;
+
+	if (!log->apds)
+		return;
+
+	if (log->priority < priority)
+		return;
+
+	cloglRec rec = {NULL, {0, 0}, 0, 0, {0,}, 0, priority, NULL, 0};
+	cloglRcuEnter();
+	cloglCur = &rec;
+	va_list va;
+	va_start(va, format);
+	cloglDispatch(log, priority, __atomic_load_n(&log->async, __ATOMIC_ACQUIRE), format, va);
+	va_end(va);
+	cloglCur = NULL;
+	cloglRcuExit();
+}
+
+/*
+  结构化日志: 消息当格式串传给各格式, 它们看到cloglCur->fields就不做printf格式化
+ */
+static void cloglDispatchKV(clogl_t *log, cloglRec *rec, const char *msg, const cloglField *fields, int n)
+{
+	static const cloglField none[1] = {{NULL, CLOGL_FIELD_INT, {0}}};
+
+	rec->fields = (fields && n > 0) ? fields : none;
+	rec->nfields = (fields && n > 0) ? n : 0;
+	cloglRcuEnter();
+	cloglCur = rec;
+	cloglDispatchf(log, rec->level, __atomic_load_n(&log->async, __ATOMIC_ACQUIRE), msg ? msg : "");
+	cloglCur = NULL;
+	cloglRcuExit();
+}
+
+/*
+ * 功能:
+ *    记录一条结构化日志: 一句消息加上若干带类型的字段. 不做printf格式化, 不分配内存
+ *    "jsonFmt"格式输出成一行JSON, 其他格式在消息后面加上" key=value"
+ * 入参:
+ *    log:      日志结构对象
+ *    priority: 日志级别
+ *    msg:      消息. 原样输出, 不是格式串
+ *    fields:   字段数组
+ *    n:        字段个数
+ * 出参:
+ *    NO
+ * 返回值:
+ *    NO
+ */
+void clogLoggerKV(clogl_t *log, int priority, const char *msg, const cloglField *fields, int n)
+{
+	if (!log)
+		return;
+
+	if (!log->apds)
+		return;
+
+	if (log->priority < priority)
+		return;
+
+	cloglRec rec = {NULL, {0, 0}, 0, 0, {0,}, 0, priority, NULL, 0};
+	cloglDispatchKV(log, &rec, msg, fields, n);
+}
+
+/*
+ * 功能:
+ *    CLOGL_KV宏调用的结构化日志函数. 级别和消息都在site里
+ * 入参:
+ *    log:    日志结构对象
+ *    site:   调用处信息. format是消息
+ *    fields: 字段数组
+ *    n:      字段个数
+ * 出参:
+ *    NO
+ * 返回值:
+ *    NO
+ */
+void clogLoggerKVSite(clogl_t *log, const cloglSite *site, const cloglField *fields, int n)
+{
+	if (!log || !site)
+		return;
+
+	if (!log->apds)
+		return;
+
+	if (log->priority < site->level)
+		return;
+
+	cloglRec rec = {site, {0, 0}, 0, 0, {0,}, 0, site->level, NULL, 0};
+	cloglDispatchKV(log, &rec, site->format, fields, n);
+}
+
+static int cloglSiteOn(const cloglSite *site);
+
+/*
+ * 功能:
+ *    限流和抽样宏放行一条日志时, 带上前面丢掉的条数. 在调用线程格式化, 后面加" suppressed=N"
+ * 入参:
+ *    log:     日志结构对象
+ *    site:    调用处信息
+ *    dropped: 丢掉的条数
+ * 出参:
+ *    NO
+ * 返回值:
+ *    NO
+ */
+void clogLoggerDropped(clogl_t *log, const cloglSite *site, long dropped, ...)
+{
+	if (!log || !site)
+		return;
+
+	if (!log->apds)
+		return;
+
+	int force = cloglSiteOn(site); // cloglSiteSet打开了的INFO DEBUG限流宏
+	if (log->priority < site->level && !force)
+		return;
+
+	cloglThreadBuf *bufs = cloglThreadBufs();
+	if (!bufs)
+		return;
+
+	// 格式化好的消息当结构化日志的消息, 丢掉的条数当字段
+	clogMsg *msg = &bufs->text;
+	int err = errno;
+	va_list va;
+	va_start(va, dropped);
+	int len = vsnprintf(msg->msgBuff, msg->msgSize, site->format, va);
+	va_end(va);
+	if (len >= 0 && (size_t)len >= msg->msgSize) {
+		if (cloglGrow(msg, ((size_t)len < CLOGL_MSG_MAX) ? (size_t)len + 1 : CLOGL_MSG_MAX)) {
+			return;
+		}
+		errno = err;
+		va_start(va, dropped);
+		len = vsnprintf(msg->msgBuff, msg->msgSize, site->format, va);
+		va_end(va);
+	}
+	if (len < 0) {
+		return;
+	}
+
+	const cloglField field = CLOGL_INT("suppressed", dropped);
+	cloglRec rec = {site, {0, 0}, 0, 0, {0,}, 0, site->level, NULL, 0};
+	cloglForce = force;
+	cloglDispatchKV(log, &rec, msg->msgBuff, &field, 1);
+	cloglForce = 0;
+	errno = err;
+}
+
+/*
+ * 功能:
+ *    CLOGL_*宏调用的记录日志函数. 级别和格式都在site里
+ * 入参:
+ *    log:  日志结构对象
+ *    site: 调用处信息
+ * 出参:
+ *    NO
+ * 返回值:
+ *    NO
+ */
+static void cloglSiteOut(clogl_t *log, const cloglSite *site, va_list args)
+{
+	va_list va;
+	if (!cloglForce && __atomic_load_n(&log->deferred, __ATOMIC_ACQUIRE)) {
+		va_copy(va, args);
+		int rst = cloglDeferPush(log, site, va);
+		va_end(va);
+		if (!rst) {
+			return;
+		}
+		// 格式里有不能延迟的转换, 在本线程格式化
+	}
+
+	cloglRec rec = {site, {0, 0}, 0, 0, {0,}, 0, site->level, NULL, 0};
+	cloglRcuEnter();
+	if (cloglWantsRecord(log, site->level)) {
+		// 二进制输出方向只要参数, 在本线程保存好交给它们
+		cloglThreadBuf *bufs = cloglThreadBufs();
+		clogMsg *pack = bufs ? &bufs->pack : NULL;
+		int err = errno;
+		size_t len = 0;
+		va_copy(va, args);
+		int rst = pack ? cloglArgsPack(pack, &len, site->format, va) : -1;
+		va_end(va);
+		if (!rst) {
+			const cloglIds *self = cloglSelf();
+			rec.pid = self->pid;
+			rec.tid = self->tid;
+			clock_gettime(CLOCK_REALTIME, &rec.ts);
+			rec.binDone = cloglRecordAll(log, &rec, err, pack->msgBuff ? pack->msgBuff : "", len) > 0;
+		}
+		errno = err;
+	}
+
+	cloglCur = &rec;
+	va_copy(va, args);
+	cloglDispatch(log, site->level, __atomic_load_n(&log->async, __ATOMIC_ACQUIRE), site->format, va);
+	va_end(va);
+	cloglCur = NULL;
+	cloglRcuExit();
+}
+
+void clogLoggerSite(clogl_t *log, const cloglSite *site, ...)
+{
+	if (!log || !site)
+		return;
+
+	if (!log->apds)
+		return;
+
+	if (log->priority < site->level)
+		return;
+
+	va_list va;
+	va_start(va, site);
+	cloglSiteOut(log, site, va);
+	va_end(va);
+}
+
+/*
+ * 功能:
+ *    cloglSiteSet打开了的调用处用的记录日志函数. 不管日志对象和输出方向的级别, 在调用线程格式化
+ * 入参:
+ *    log:  日志结构对象
+ *    site: 调用处信息
+ * 出参:
+ *    NO
+ * 返回值:
+ *    NO
+ */
+void clogLoggerForce(clogl_t *log, const cloglSite *site, ...)
+{
+	if (!log || !site)
+		return;
+
+	if (!log->apds)
+		return;
+
+	va_list va;
+	va_start(va, site);
+	cloglForce = 1;
+	cloglSiteOut(log, site, va);
+	cloglForce = 0;
+	va_end(va);
+}
+
+/*
+ * 功能:
+ *    设置一个日志对象是否延迟格式化
+ * 入参:
+ *    log: 日志对象
+ *    on:  1 延迟格式化, 0 在调用线程格式化
+ * 出参:
+ *    NO
+ * 返回值:
+ *    0 OR -1
+ */
+int cloglSetDeferred(clogl_t *log, int on)
+{
+	if (!log)
+		return -1;
+
+	if (on && cloglSetAsync(log, 1)) {
+		return -1;
+	}
+	__atomic_store_n(&log->deferred, on ? 1 : 0, __ATOMIC_RELEASE);
+
+	if (!on) {
+		(void)cloglFlush();
+	}
+
+	return 0;
+}
+
+
+/*
+ * 功能:
+ *    初始化日志模块
+ * 入参:
+ *    NO
+ * 出参:
+ *    NO
+ * 返回值:
+ *    -1 OR 0
+ */
+int cloglInit()
+{
+	// 启动事件线程
+	pthread_t ptid = 0;
+	int rst = pthread_create(&ptid, NULL, threadEvert, NULL);
+	if (rst) {
+		return -1;
+	}
+	// 使线程处于分离状态
+	rst = pthread_detach(ptid);
+	if (rst) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * 功能:
+ *    设置日志对象里文件输出方向的刷新策略
+ * 入参:
+ *    log:     日志对象
+ *    apdName: 输出方向名. NULL 所有输出方向
+ *    bytes:   缓冲超过这么多字节. 0 不缓冲, 每条都写
+ *    ms:      缓冲里最早的日志超过这么多毫秒. 0 不按时间
+ *    level:   ERR到这个级别的日志立即写. -1 不按级别
+ * 出参:
+ *    NO
+ * 返回值:
+ *    0 OR -1
+ */
+int cloglSetFlush(clogl_t *log, const char *apdName, size_t bytes, int ms, int level)
+{
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+	if (!log || ms < 0 || level >= CLOGL_LEVEL_UNKNOWN)
+		return -1;
+
+	int found = 0;
+	cloglRcuEnter();
+	for (cloglApd *tmpapd = __atomic_load_n(&log->apds, __ATOMIC_ACQUIRE); tmpapd; tmpapd = tmpapd->next) {
+		if (apdName && (!tmpapd->name || strcmp(apdName, tmpapd->name)))
+			continue;
+
+		pthread_mutex_lock(&tmpapd->pLock);
+		tmpapd->flushBytes = bytes;
+		tmpapd->flushMs = ms;
+		tmpapd->flushLevel = (level < 0) ? -1 : level;
+		if (0 == bytes && tmpapd->isOpen && tmpapd->apdType->flush) {
+			(void)tmpapd->apdType->flush(tmpapd);
+		}
+		pthread_mutex_unlock(&tmpapd->pLock);
+		found ++;
+	}
+	cloglRcuExit();
+	if (!found)
+		return -1;
+
+	(void)pthread_once(&once, cloglExitAtexit);
+
+	return 0;
+}
+
+/*
+ * 功能:
+ *    设置日志时间的精度
+ * 入参:
+ *    digits: 秒后面的位数. 0 秒, 3 毫秒, 6 微秒
+ * 出参:
+ *    NO
+ * 返回值:
+ *    0 OR -1
+ */
+int cloglSetTimePrecision(int digits)
+{
+	if (0 != digits && 3 != digits && 6 != digits)
+		return -1;
+
+	__atomic_store_n(&cloglTsDigits, digits, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+/*
+ * 功能:
+ *    设置ptidFmt格式里是否带线程名
+ * 入参:
+ *    on: 1 带, 0 不带
+ * 出参:
+ *    NO
+ * 返回值:
+ *    0
+ */
+int cloglSetThreadName(int on)
+{
+	__atomic_store_n(&cloglIdName, on ? 1 : 0, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&cloglForkGen, 1, __ATOMIC_RELAXED); // 各线程重新生成缓存
+
+	return 0;
+}
+
+/*
+ * 功能:
+ *    设置后台压缩线程的CPU预算
+ * 入参:
+ *    percent: 最多用一个CPU的百分之几. 1 - 100
+ * 出参:
+ *    NO
+ * 返回值:
+ *    0 OR -1
+ */
+int cloglSetZipBudget(int percent)
+{
+	if (percent < 1 || percent > 100) {
+		return -1;
+	}
+	__atomic_store_n(&cloglZipBudget, percent, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+/*
+ * 功能:
+ *    设置一个日志对象的输出级别
+ * 入参:
+ *    log: 日志对象
+ *    p: 输出级别
+ * 出参:
+ *    NO
+ * 返回值:
+ *    0 OR -1
+ */
+int setLogPriority(clogl_t *log, int p)
+{
+	if (p < CLOGL_LEVEL_ERR || p >= CLOGL_LEVEL_UNKNOWN)
+		return -1;
+	if(!log)
+		return -1;
+
+	log->priority = p;
+
+	cloglRcuEnter();
+	for (cloglApd *tmpapd = __atomic_load_n(&log->apds, __ATOMIC_ACQUIRE); tmpapd; tmpapd = tmpapd->next) {
+		tmpapd->priority = p;
+	}
+	cloglRcuExit();
+
+	return 0;
+}
+
+/*
+  释放日志缓冲区资源
+ */
+void freeMsgBuff(void *msgp)
+{
+	cloglThreadBuf *bufs = (cloglThreadBuf *)msgp;
+	(void)free(bufs->msg.msgBuff);
+	(void)free(bufs->body.msgBuff);
+	(void)free(bufs->pack.msgBuff);
+	(void)free(bufs->text.msgBuff);
+	(void)free(bufs->dump.msgBuff);
+	(void)free(bufs);
+	bufs = NULL;
+}
+
+/* 日志对象表 >>> */
+/*
+  按名字找日志对象的哈希表, 线性探测. 查的线程不加锁, 在读区间里读当前的表;
+  加的线程持cloglRegLock, 用到一半时建一张两倍大的表整个换上, 旧表等读的线程都出去再释放. 只加不删
+ */
+typedef struct _clogl_reg
+{
+	size_t mask;                      // 槽数-1
+	size_t count;                     // 用了的槽数
+	clogl_t *slots[];
+} cloglReg;
+
+static cloglReg *cloglRegTab;
+static clogl_t **cloglRegTail = &clogls; // clogls链尾
+static pthread_mutex_t cloglRegLock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline uint64_t cloglRegHash(const char *name)
+{
+	uint64_t h = 14695981039346656037ULL; // FNV-1a
+	for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+		h = (h ^ *p) * 1099511628211ULL;
+	}
+
+	return h;
+}
+
+static clogl_t *cloglRegFind(const cloglReg *tab, const char *name)
+{
+	if (!tab) {
+		return NULL;
+	}
+
+	// 最多用一半的槽, 一定会碰到空槽
+	for (size_t i = cloglRegHash(name) & tab->mask; ; i = (i + 1) & tab->mask) {
+		clogl_t *log = __atomic_load_n(&tab->slots[i], __ATOMIC_ACQUIRE);
+		if (!log || !strcmp(log->name, name)) {
+			return log;
+		}
+	}
+}
+
+static void cloglRegPut(cloglReg *tab, clogl_t *log)
+{
+	size_t i = cloglRegHash(log->name) & tab->mask;
+	while (tab->slots[i]) {
+		i = (i + 1) & tab->mask;
+	}
+	__atomic_store_n(&tab->slots[i], log, __ATOMIC_RELEASE);
+	tab->count ++;
+}
+
+/*
+  登记一个新日志对象并挂到clogls链尾. 已经有同名的返回-1
+ */
+static int cloglRegAdd(clogl_t *log)
+{
+	pthread_mutex_lock(&cloglRegLock);
+	cloglReg *tab = cloglRegTab, *old = NULL;
+	if (cloglRegFind(tab, log->name)) {
+		pthread_mutex_unlock(&cloglRegLock);
+		return -1;
+	}
+	if (!tab || (tab->count + 1) * 2 > tab->mask + 1) {
+		size_t slots = tab ? (tab->mask + 1) * 2 : CLOGL_REG_SLOTS;
+		cloglReg *grown = (cloglReg *)calloc(1, sizeof(cloglReg) + slots * sizeof(clogl_t *));
+		if (!grown) {
+			pthread_mutex_unlock(&cloglRegLock);
+			return -1;
+		}
+		grown->mask = slots - 1;
+		for (size_t i = 0; tab && i <= tab->mask; i++) {
+			if (tab->slots[i]) {
+				cloglRegPut(grown, tab->slots[i]);
+			}
+		}
+		old = tab;
+		tab = grown;
+	}
+	cloglRegPut(tab, log);
+	__atomic_store_n(&cloglRegTab, tab, __ATOMIC_RELEASE);
+
+	// 事件线程不加锁在读clogls
+	__atomic_store_n(cloglRegTail, log, __ATOMIC_RELEASE);
+	cloglRegTail = &log->next;
+	pthread_mutex_unlock(&cloglRegLock);
+
+	if (old) {
+		cloglRcuSync();
+		free(old);
+	}
+
+	return 0;
+}
+/* 日志对象表 <<< */
+
+/*
+ * 功能:
+ *    获得一个按时间产生新的日志文件的默认日志对象指针
+ * 入参:
+ *    日志对象名
+ * 出参:
+ *    NO
+ * 返回值:
+ *    成功返回日志对象指针, 出错返回 NULL
+ */
+clogl_t *cloglGetDftTimeFile(const char *name)
+{
+	static int only; // 系统中只能有一个相同的日志对象存在
+	if (only)
+		return NULL;
+
+	if (!name || !name[0])
+		return NULL;
+
+	clogl_t *tmpLog = (clogl_t*)calloc(1, sizeof(clogl_t));
+	if (!tmpLog)
+		return NULL;
+
+	// 日志对象名
+	tmpLog->name = (char*)calloc(strlen(name)+1, sizeof(char));
+	if (!tmpLog->name) {
+		free(tmpLog);
+		return NULL;
+	}
+	(void)strcpy(tmpLog->name, name);
+
+	// 输出级别
+	tmpLog->priority =  CLOGL_LEVEL_DEBUG;
+
+	/* 输出方向 */
+	cloglApd *tmpApd = (cloglApd *)calloc(1, sizeof(cloglApd));
+	if (!tmpApd) {
+		free(tmpLog->name);
+		free(tmpLog);
+		return NULL;
+	}
+	// 输出方向名
+	tmpApd->name = (char *)calloc(16, sizeof(char));
+	if (!tmpApd->name) {
+		free(tmpLog->name);
+		free(tmpLog);
+		free(tmpApd);
+		return NULL;
+	}
+	(void)strcpy(tmpApd->name, "dftTimeFileApd");
+	// 输出方输出级别
+	tmpApd->priority = CLOGL_LEVEL_DEBUG;
+	// 刷新策略. 默认每条日志都写
+	tmpApd->flushBytes = 0;
+	tmpApd->flushMs = 0;
+	tmpApd->flushLevel = CLOGL_LEVEL_ERR;
+	// 未打开状态
+	tmpApd->isOpen = 0;
+	// 输出方向类型
+	tmpApd->apdType = cloglGetApd("HourFile");
+	if (!tmpApd->apdType) {
+		free(tmpLog->name);
+		free(tmpLog);
+		free(tmpApd);
+		return NULL;
+	}
+	// 格式
+	tmpApd->fmt = cloglGetFmt("ptidFmt");
+	// 忙时策略. 默认等
+	tmpApd->shedLevel = CLOGL_LEVEL_WARN;
+	tmpApd->backlogBytes = CLOGL_BACKLOG_BYTES;
+	// 初始化线程锁
+	pthread_mutex_init(&tmpApd->pLock, NULL);
+	pthread_mutex_init(&tmpApd->qLock, NULL);
+
+	/* 属性 */
+	cloglTimeFileOpt *tmpOpt = (cloglTimeFileOpt *)calloc(1, sizeof(cloglTimeFileOpt));
+	if (!tmpOpt) {
+		free(tmpLog->name);
+		free(tmpLog);
+		free(tmpApd->name);
+		free(tmpApd);
+		return NULL;
+	}
+	// 日志文件名. 默认当前进程可执行文件所在目录下的logs目录, 文件名与可执行文件名相同
+	pid_t pid = getpid();
+	char procf[32] = {0,};
+	char exe[2048] = {0,};
+	(void)snprintf(procf, sizeof(procf), "%s%d%s", "/proc/", pid, "/exe");
+	ssize_t err = readlink(procf, exe, sizeof(exe));
+	if (-1 == err) {
+		free(tmpLog->name);
+		free(tmpLog);
+		free(tmpApd->name);
+		free(tmpApd);
+		free(tmpOpt);
+		return NULL;
+	}
+	char *exep = strrchr(exe, '/');
+	if (!exep) {
+		free(tmpLog->name);
+		free(tmpLog);
+		free(tmpApd->name);
+		free(tmpApd);
+		free(tmpOpt);
+		return NULL;
+	}
+	char execname[256] = {0}; // 可执行文件名
+	strncpy(execname, exep+1, sizeof(execname));
+
+	// 建logs目录
+	strcpy(exep+1, "logs");
+	if (!access(exe, F_OK)) {
+		// 如果存在, 是不是目录?
+		struct stat filestat;
+		if (stat(exe, &filestat)) {
+			free(tmpLog->name);
+			free(tmpLog);
+			free(tmpApd->name);
+			free(tmpApd);
+			free(tmpOpt);
+			return NULL;
+		}
+		if (!S_ISDIR(filestat.st_mode))	{
+			if (-1 == mkdir(exe, 0755)) {
+				free(tmpLog->name);
+				free(tmpLog);
+				free(tmpApd->name);
+				free(tmpApd);
+				free(tmpOpt);
+				return NULL;
+			}
+		}
+	} else {
+		// 如果不存在, mkdir
+		if (-1 == mkdir(exe, 0755)) {
+			free(tmpLog->name);
+			free(tmpLog);
+			free(tmpApd->name);
+			free(tmpApd);
+			free(tmpOpt);
+			return NULL;
+		}
+	}
+
+	// 日志文件名
+	int len = strlen(exe) + strlen(execname) + 64;
+	tmpOpt->fileName = (char *)calloc(len, sizeof(char));
+	if (!tmpOpt->fileName) {
+
+	}
+	snprintf(tmpOpt->fileName, len, "%s/%s%s", exe, execname, ".log");
+
+	// 默认简隔1小时
+	tmpOpt->span = 1 * 60 * 60;
+	tmpOpt->out.fd = -1;
+
+	// 赋值属性
+	tmpApd->opt = tmpOpt;
+
+	tmpLog->apds = tmpApd;
+
+	// 加到系统日志对象链中. 别的线程可能同时建了同名的
+	if (cloglRegAdd(tmpLog)) {
+		free(tmpLog->name);
+		free(tmpLog);
+		free(tmpApd->name);
+		free(tmpApd);
+		free(tmpOpt->fileName);
+		free(tmpOpt);
+		return NULL;
+	}
+
+	only ++;
+
+	return tmpLog;
+}
+
+/*
+ * 功能:
+ *    获得一个日志对象指针. 按名字哈希, 不加锁
+ * 入参:
+ *    日志对象名
+ * 出参:
+ *    NO
+ * 返回值:
+ *    成功返回日志对象指针, 出错返回 NULL
+ */
+clogl_t *cloglGet(const char *name)
+{
+	if (!name || !name[0]) {
+		return NULL;
+	}
+
+	cloglRcuEnter();
+	clogl_t *tmplog = cloglRegFind(__atomic_load_n(&cloglRegTab, __ATOMIC_ACQUIRE), name);
+	cloglRcuExit();
+
+	return tmplog;
+}
+
+/*
+ * 功能:
+ *    新建一个没有输出方向的日志对象, 加到系统日志对象链中. 可以在多个线程里同时建和找
+ * 入参:
+ *    name:     日志对象名. 不能和已有的重复
+ *    priority: 输出级别
+ * 出参:
+ *    NO
+ * 返回值:
+ *    成功返回日志对象指针, 出错返回 NULL
+ */
+clogl_t *cloglNew(const char *name, int priority)
+{
+	if (!name || !name[0] || cloglGet(name)) {
+		return NULL;
+	}
+
+	clogl_t *tmpLog = (clogl_t*)calloc(1, sizeof(clogl_t));
+	if (!tmpLog)
+		return NULL;
+
+	tmpLog->name = strdup(name);
+	if (!tmpLog->name) {
+		free(tmpLog);
+		return NULL;
+	}
+	tmpLog->priority = priority;
+
+	// 加到系统日志对象链中. 同名的可能刚被别的线程加了
+	if (cloglRegAdd(tmpLog)) {
+		free(tmpLog->name);
+		free(tmpLog);
+		return NULL;
+	}
+
+	return tmpLog;
+}
+
+/*
+  新建一个还没挂到日志对象上的输出方向
+ */
+static cloglApd *cloglApdNew(const char *name, const char *type, const char *fmt, int priority, const char *fileName)
+{
+	if (!name || !name[0]) {
+		return NULL;
+	}
+
+	cloglApdT *apdType = cloglGetApd(type);
+	cloglFmt *apdFmt = cloglGetFmt(fmt);
+	if (!apdType || !apdFmt) {
+		return NULL;
+	}
+
+	cloglApd *tmpApd = (cloglApd *)calloc(1, sizeof(cloglApd));
+	if (!tmpApd) {
+		return NULL;
+	}
+	tmpApd->name = strdup(name);
+	if (!tmpApd->name) {
+		free(tmpApd);
+		return NULL;
+	}
+	tmpApd->priority = priority;
+	tmpApd->apdType = apdType;
+	tmpApd->fmt = apdFmt;
+	// 刷新策略. 默认每条日志都写
+	tmpApd->flushLevel = CLOGL_LEVEL_ERR;
+	// 忙时策略. 默认等
+	tmpApd->shedLevel = CLOGL_LEVEL_WARN;
+	tmpApd->backlogBytes = CLOGL_BACKLOG_BYTES;
+	pthread_mutex_init(&tmpApd->pLock, NULL);
+	pthread_mutex_init(&tmpApd->qLock, NULL);
+
+	// 类型特有的属性
+	if (apdType->init && apdType->init(tmpApd, fileName)) {
+		pthread_mutex_destroy(&tmpApd->qLock);
+		pthread_mutex_destroy(&tmpApd->pLock);
+		free(tmpApd->name);
+		free(tmpApd);
+		return NULL;
+	}
+
+	return tmpApd;
+}
+
+/*
+ * 功能:
+ *    给日志对象加一个输出方向
+ * 入参:
+ *    log:      日志对象
+ *    name:     输出方向名
+ *    type:     输出方向类型名. "Console", "TimeFile", "HourFile", "MmapFile", "UringFile", "SizeFile", "BinFile", "FlightRecorder"
+ *    fmt:      日志格式名. "defFmt", "ptidFmt", "jsonFmt", 或cloglAddLayout加的
+ *    priority: 输出级别
+ *    fileName: 日志文件名. Console不用
+ * 出参:
+ *    NO
+ * 返回值:
+ *    成功返回输出方向指针, 出错返回 NULL
+ */
+cloglApd *cloglAddApd(clogl_t *log, const char *name, const char *type, const char *fmt, int priority, const char *fileName)
+{
+	if (!log) {
+		return NULL;
+	}
+
+	cloglApd *tmpApd = cloglApdNew(name, type, fmt, priority, fileName);
+	if (!tmpApd) {
+		return NULL;
+	}
+
+	// 写日志的线程不加锁在读链
+	cloglApd **tmp = &log->apds;
+	while (*tmp)
+		tmp = &((*tmp)->next);
+	__atomic_store_n(tmp, tmpApd, __ATOMIC_RELEASE);
+
+	return tmpApd;
+}
+
+/*
+ * 功能:
+ *    设置输出方向类型特有的属性. 要在第一条日志之前设置
+ * 入参:
+ *    apd:   输出方向
+ *    key:   属性名
+ *    value: 属性值
+ * 出参:
+ *    NO
+ * 返回值:
+ *    0 OR -1
+ */
+int cloglApdSet(cloglApd *apd, const char *key, const char *value)
+{
+	if (!apd || !key || !value) {
+		return -1;
+	}
+
+	if (!strcmp(key, "compress")) {
+		if (!strcmp(value, "gz")) {
+#ifdef CLOGL_HAVE_ZLIB
+			apd->compress = CLOGL_ZIP_GZ;
+#else
+			apd->compress = CLOGL_ZIP_LZ4; // 没有zlib
+#endif
+		} else if (!strcmp(value, "lz4")) {
+			apd->compress = CLOGL_ZIP_LZ4;
+		} else if (!strcmp(value, "none")) {
+			apd->compress = CLOGL_ZIP_NONE;
+		} else {
+			return -1;
+		}
+		return 0;
+	} else if (!strcmp(key, "keepFiles")) {
+		int n = atoi(value);
+		if (n < 0) {
+			return -1;
+		}
+		apd->keepFiles = n;
+		return 0;
+	} else if (!strcmp(key, "keepMB")) {
+		int mb = atoi(value);
+		if (mb < 0) {
+			return -1;
+		}
+		apd->keepBytes = (off_t)mb * 1024 * 1024;
+		return 0;
+	} else if (!strcmp(key, "keepHours")) {
+		int hours = atoi(value);
+		if (hours < 0) {
+			return -1;
+		}
+		apd->keepAge = (time_t)hours * 60 * 60;
+		return 0;
+	} else if (!strcmp(key, "dedupMs")) {
+		int ms = atoi(value);
+		if (ms < 0) {
+			return -1;
+		}
+		apd->dedupMs = ms;
+		return 0;
+	} else if (!strcmp(key, "overload")) {
+		if (!strcmp(value, "block")) {
+			apd->overload = CLOGL_OVERLOAD_BLOCK;
+		} else if (!strcmp(value, "dropNewest")) {
+			apd->overload = CLOGL_OVERLOAD_NEWEST;
+		} else if (!strcmp(value, "dropOldest")) {
+			apd->overload = CLOGL_OVERLOAD_OLDEST;
+		} else if (!strcmp(value, "shed")) {
+			apd->overload = CLOGL_OVERLOAD_SHED;
+		} else {
+			return -1;
+		}
+		return 0;
+	} else if (!strcmp(key, "shedLevel")) {
+		clogl_level level = cloglLevel(value);
+		if (CLOGL_LEVEL_UNKNOWN == level) {
+			return -1;
+		}
+		apd->shedLevel = (level < CLOGL_LEVEL_ERR) ? CLOGL_LEVEL_ERR : level; // ERR和DATA总是不丢
+		return 0;
+	} else if (!strcmp(key, "backlogKB")) {
+		int kb = atoi(value);
+		if (kb <= 0) {
+			return -1;
+		}
+		pthread_mutex_lock(&apd->qLock);
+		apd->backlogBytes = (size_t)kb * 1024; // 缓冲空了时换大小
+		pthread_mutex_unlock(&apd->qLock);
+		return 0;
+	}
+	if (!apd->apdType->set) {
+		return -1;
+	}
+
+	pthread_mutex_lock(&apd->pLock);
+	int rst = apd->apdType->set(apd, key, value);
+	pthread_mutex_unlock(&apd->pLock);
+
+	return rst;
+}
+
+/*
+ * 功能:
+ *    获得一个系统默认日志对象指针
+ * 入参:
+ *    NO
+ * 出参:
+ *    NO
+ * 返回值:
+ *    成功返回日志对象指针, 出错返回 NULL
+ */
+clogl_t *cloglGetDft()
+{
+#define DEFAULT_LOG_NAME "noname"  // 系统中默认日志对象名
+
+	clogl_t *tmpLog = cloglGet(DEFAULT_LOG_NAME);
+
+	if (!tmpLog)
+		tmpLog = cloglGetDftTimeFile(DEFAULT_LOG_NAME);
+	if (!tmpLog)
+		tmpLog = cloglGet(DEFAULT_LOG_NAME); // 别的线程先建了
+
+	return tmpLog;
+}
+
+/*
+ * 功能：
+ *    日志级别从字符串转换为clogl_level
+ * 入参：
+ *    字符串形式的日志级别
+ * 出参：
+ *    NO
+ * 返回值：
+ *     clogl_level形式的日志级别
+ */
+clogl_level cloglLevel(const char *lvl)
+{
+	if (!lvl || !lvl[0]) {
+		return CLOGL_LEVEL_UNKNOWN;
+	}
+		
+	if(0 == strcmp(lvl, "DATA")) {
+		return CLOGL_LEVEL_DATA;
+	} else if(0 == strcmp(lvl, "ERROR")) {
+		return CLOGL_LEVEL_ERR;
+	} else if(0 == strcmp(lvl, "WARN")) {
+		return CLOGL_LEVEL_WARN;
+	} else if(0 == strcmp(lvl, "INFO")) {
+		return CLOGL_LEVEL_INFO;
+	} else if(0 == strcmp(lvl, "DEBUG")) {
+		return CLOGL_LEVEL_DEBUG;
+	}
+
+	return CLOGL_LEVEL_UNKNOWN;
+}
+
+/* 配置文件 >>> */
+/*
+  INI格式, 一节一个对象, 节名是 [format:名字] [logger:名字] [appender:名字]. #或;开头的行是注释
+  重新加载时级别, 格式, 刷新策略原地改; 输出方向增删, 换类型, 换文件, 改属性要换一条新链
+ */
+typedef struct _clogl_conf_kv
+{
+	char *key;
+	char *value;
+	int line;                         // 在文件里的行号, 报错用
+	struct _clogl_conf_kv *next;
+} cloglConfKV;
+
+typedef struct _clogl_conf_sec
+{
+	char kind;                        // 'f' 格式, 'l' 日志对象, 'a' 输出方向
+	char *name;
+	cloglConfKV *kvs;                 // 按文件里的顺序
+	struct _clogl_conf_sec *next;
+} cloglConfSec;
+
+/*
+  配置文件管的日志对象. 记下装上的链, 链被cloglAddApd改过就不再当成配置文件装的
+ */
+typedef struct _clogl_conf_log
+{
+	clogl_t *log;
+	cloglApd *apds;                   // 装上的链头
+	cloglApd *head;                   // 这次要换上的新链
+	cloglApd *old;                    // 换下来的旧链
+	int level;
+	int rebuild;                      // 要换链
+	struct _clogl_conf_log *next;
+} cloglConfLog;
+
+static cloglConfSec *cloglConfLast;   // 上次装上的配置
+static cloglConfLog *cloglConfLogs;   // 上次装上的日志对象
+static pthread_mutex_t cloglConfLock = PTHREAD_MUTEX_INITIALIZER; // 一次只加载一个
+static char *cloglConfWatched;        // inotify盯着的文件
+
+static void cloglConfFree(cloglConfSec *sec)
+{
+	while (sec) {
+		cloglConfSec *next = sec->next;
+		for (cloglConfKV *kv = sec->kvs, *tmp; kv; kv = tmp) {
+			tmp = kv->next;
+			free(kv->key);
+			free(kv->value);
+			free(kv);
+		}
+		free(sec->name);
+		free(sec);
+		sec = next;
+	}
+}
+
+static void cloglConfLogFree(cloglConfLog *cl)
+{
+	while (cl) {
+		cloglConfLog *next = cl->next;
+		free(cl);
+		cl = next;
+	}
+}
+
+/*
+  出错写到cloglErr, 带上文件名和行号
+ */
+static void cloglConfErr(const char *fileName, int line, const char *what, const char *name)
+{
+	char buff[1024];
+	(void)snprintf(buff, sizeof(buff), "cloglLoadConfig %s:%d %s '%s'", fileName, line, what, name ? name : "");
+	cloglErr(buff);
+}
+
+/*
+  去掉两头的空白
+ */
+static char *cloglConfTrim(char *str)
+{
+	while (' ' == *str || '\t' == *str) {
+		str ++;
+	}
+	size_t len = strlen(str);
+	while (len && strchr(" \t\r\n", str[len - 1])) {
+		str[--len] = '\0';
+	}
+
+	return str;
+}
+
+static const char *cloglConfGet(const cloglConfSec *sec, const char *key)
+{
+	const char *value = NULL;
+	for (const cloglConfKV *kv = sec->kvs; kv; kv = kv->next) {
+		if (!strcmp(kv->key, key)) {
+			value = kv->value; // 重复的以后面的为准
+		}
+	}
+
+	return value;
+}
+
+static cloglConfSec *cloglConfFind(cloglConfSec *conf, char kind, const char *name)
+{
+	for (cloglConfSec *sec = conf; sec; sec = sec->next) {
+		if (kind == sec->kind && !strcmp(name, sec->name)) {
+			return sec;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+  读配置文件. 格式错返回-1
+ */
+static int cloglConfParse(const char *fileName, cloglConfSec **out)
+{
+	FILE *fp = fopen(fileName, "r");
+	if (!fp) {
+		cloglConfErr(fileName, 0, "open error", strerror(errno));
+		return -1;
+	}
+
+	cloglConfSec *conf = NULL, **tail = &conf, *sec = NULL;
+	cloglConfKV **kvTail = NULL;
+	char *line = NULL;
+	size_t cap = 0;
+	int lineNo = 0, rst = 0;
+	while (!rst && getline(&line, &cap, fp) >= 0) {
+		lineNo ++;
+		char *str = cloglConfTrim(line);
+		if (!str[0] || '#' == str[0] || ';' == str[0]) {
+			continue;
+		}
+
+		if ('[' == str[0]) {
+			char *end = strchr(str, ']');
+			char *colon = strchr(str, ':');
+			if (!end || end[1] || !colon || colon > end) {
+				cloglConfErr(fileName, lineNo, "bad section", str);
+				rst = -1;
+				break;
+			}
+			*end = '\0';
+			*colon = '\0';
+			char *kind = cloglConfTrim(str + 1);
+			char *name = cloglConfTrim(colon + 1);
+			char k = !strcmp(kind, "format") ? 'f' : !strcmp(kind, "logger") ? 'l' : !strcmp(kind, "appender") ? 'a' : 0;
+			if (!k || !name[0] || cloglConfFind(conf, k, name)) {
+				cloglConfErr(fileName, lineNo, "bad or duplicate section", name);
+				rst = -1;
+				break;
+			}
+			sec = (cloglConfSec *)calloc(1, sizeof(cloglConfSec));
+			if (!sec || !(sec->name = strdup(name))) {
+				free(sec);
+				rst = -1;
+				break;
+			}
+			sec->kind = k;
+			*tail = sec;
+			tail = &sec->next;
+			kvTail = &sec->kvs;
+			continue;
+		}
+
+		char *eq = strchr(str, '=');
+		if (!sec || !eq) {
+			cloglConfErr(fileName, lineNo, "expect key = value in a section", str);
+			rst = -1;
+			break;
+		}
+		*eq = '\0';
+		char *key = cloglConfTrim(str);
+		char *value = cloglConfTrim(eq + 1);
+		cloglConfKV *kv = (cloglConfKV *)calloc(1, sizeof(cloglConfKV));
+		if (!kv || !(kv->key = strdup(key)) || !(kv->value = strdup(value))) {
+			if (kv) {
+				free(kv->key);
+				free(kv);
+			}
+			rst = -1;
+			break;
+		}
+		kv->line = lineNo;
+		*kvTail = kv;
+		kvTail = &kv->next;
 	}
-	pthread_mutex_unlock(&apd->pLock);
+	free(line);
+	fclose(fp);
 
-	if (!opt->fp)
+	if (rst) {
+		cloglConfFree(conf);
 		return -1;
+	}
+	*out = conf;
 
 	return 0;
 }
-static inline int sizeFile_close(cloglApd *apd)
-{
 
-	cloglRollFileOpt *opt = apd->opt;
- 	if (!opt)
- 		return 0;
+/*
+  原地能改的输出方向属性
+ */
+static int cloglConfHot(const char *key)
+{
+	return !strcmp(key, "level") || !strcmp(key, "fmt") || !strcmp(key, "flushBytes")
+		|| !strcmp(key, "flushMs") || !strcmp(key, "flushLevel");
+}
 
-	pthread_mutex_lock(&apd->pLock);
- 	if (opt->fp) {
-		fclose(opt->fp);
-		opt->fp = NULL;
-		apd->isOpen = 0;
+/*
+  两个输出方向除了原地能改的属性以外都一样
+ */
+static int cloglConfSame(const cloglConfSec *a, const cloglConfSec *b)
+{
+	if (strcmp(a->name, b->name)) {
+		return 0;
 	}
-	pthread_mutex_unlock(&apd->pLock);
 
-	return 0;
+	const cloglConfKV *x = a->kvs, *y = b->kvs;
+	while (1) {
+		while (x && cloglConfHot(x->key)) {
+			x = x->next;
+		}
+		while (y && cloglConfHot(y->key)) {
+			y = y->next;
+		}
+		if (!x || !y) {
+			return x == y;
+		}
+		if (strcmp(x->key, y->key) || strcmp(x->value, y->value)) {
+			return 0;
+		}
+		x = x->next;
+		y = y->next;
+	}
 }
-static int sizeFile_append(cloglApd *apd, const char *msg)
-{
-	cloglRollFileOpt *opt = apd->opt;
- 	if (!opt || !opt->fp)
- 		return -1;
 
-	pthread_mutex_lock(&apd->pLock);
-	if (opt->fp) {
-		fprintf(opt->fp, "%s\n", msg);
-		fflush(opt->fp);
+/*
+  日志对象的输出方向是不是和上次装的一样, 可以原地改
+ */
+static int cloglConfKeep(cloglConfSec *conf, const char *logName)
+{
+	cloglConfSec *a = conf, *b = cloglConfLast;
+	while (1) {
+		while (a && !('a' == a->kind && !strcmp(cloglConfGet(a, "logger"), logName))) {
+			a = a->next;
+		}
+		while (b && !('a' == b->kind && !strcmp(cloglConfGet(b, "logger"), logName))) {
+			b = b->next;
+		}
+		if (!a || !b) {
+			return a == b;
+		}
+		if (!cloglConfSame(a, b)) {
+			return 0;
+		}
+		a = a->next;
+		b = b->next;
 	}
-	pthread_mutex_unlock(&apd->pLock);
+}
 
-	return 0;
+static int cloglConfLevel(const cloglConfSec *sec, const char *key, int dft)
+{
+	const char *value = cloglConfGet(sec, key);
+	if (!value) {
+		return dft;
+	}
 
+	return cloglLevel(value);
 }
-static int sizeFile_event(cloglApd *apd)
-{
-	pthread_mutex_lock(&apd->pLock);
-	cloglRollFileOpt *opt = (cloglRollFileOpt*)apd->opt;
 
-	// 判断存在
-	if (!access(opt->fileName, F_OK)) {
-		// 如果存在, 是否是原文件？
-		// @@
-	} else {
-		// 如果不存在, 重新打开
+/*
+  释放一条链. 打开了的先写完缓冲再关
+  opt不释放: 各类型没有释放opt的接口, 只在重新加载配置换链时漏一点
+ */
+static void cloglConfDrop(cloglApd *apd)
+{
+	while (apd) {
+		cloglApd *next = apd->next;
+		pthread_mutex_lock(&apd->pLock);
 		if (apd->isOpen) {
-			fclose(opt->fp);
-			opt->fp = NULL;
-			apd->isOpen = 0;
+			cloglBacklogDrain(apd);
+			cloglDropReport(apd, 1);
+			if (apd->apdType->flush) {
+				(void)apd->apdType->flush(apd);
+			}
+			(void)cloglApdClose(apd);
 		}
-		opt->fp = fopen(opt->fileName, "a");
-		apd->isOpen ++;
 		pthread_mutex_unlock(&apd->pLock);
-		return;
+		pthread_mutex_destroy(&apd->pLock);
+		pthread_mutex_destroy(&apd->qLock);
+		if (apd->backlog) {
+			free(apd->backlog->cur.buf);
+			free(apd->backlog->spare.buf);
+			free(apd->backlog);
+		}
+		free(apd->name);
+		free(apd);
+		apd = next;
 	}
+}
 
-
-	// 判断大小
-	struct stat buff;
-	int rst = stat(opt->fileName, &buff);
-	if (-1 == rst)
-		return;
-
-	if (buff.st_size >= opt->maxSize*1024*1024) {
-		// 如果超大了， 重新打开新文件
-		if (apd->isOpen) {
-			fclose(opt->fp);
-			opt->fp = NULL;
-			apd->isOpen = 0;
+/*
+  按配置建一个日志对象的新链. 还没挂上去, 写日志的线程看不到
+ */
+static int cloglConfBuild(const char *fileName, cloglConfSec *conf, cloglConfLog *cl)
+{
+	cloglApd **tail = &cl->head;
+	for (cloglConfSec *sec = conf; sec; sec = sec->next) {
+		if ('a' != sec->kind || strcmp(cloglConfGet(sec, "logger"), cl->log->name)) {
+			continue;
 		}
+		const char *fmt = cloglConfGet(sec, "fmt");
+		cloglApd *apd = cloglApdNew(sec->name, cloglConfGet(sec, "type"), fmt ? fmt : "ptidFmt",
+			cloglConfLevel(sec, "level", cl->level), cloglConfGet(sec, "file"));
+		if (!apd) {
+			cloglConfErr(fileName, sec->kvs ? sec->kvs->line : 0, "bad appender", sec->name);
+			return -1;
+		}
+		*tail = apd;
+		tail = &apd->next;
 
-		char cmd[600] = {0,};
-		sprintf(cmd, "%s%s%s%s%s%s%s%s%s", "mv -f ", opt->fileName, ".b ", opt->fileName, ".c &>/dev/null && mv -f ", opt->fileName, "  ", opt->fileName, ".b &>/dev/null;");
-		if (-1 == system(cmd))
-			fprintf(stderr, "roolFileEvent error!!!\n\n");
-
-		opt->fp = fopen(opt->fileName, "a");
-		apd->isOpen ++;
-
+		for (cloglConfKV *kv = sec->kvs; kv; kv = kv->next) {
+			if (cloglConfHot(kv->key) || !strcmp(kv->key, "logger") || !strcmp(kv->key, "type") || !strcmp(kv->key, "file")) {
+				continue;
+			}
+			if (cloglApdSet(apd, kv->key, kv->value)) {
+				cloglConfErr(fileName, kv->line, "bad appender option", kv->key);
+				return -1;
+			}
+		}
 	}
-	pthread_mutex_unlock(&apd->pLock);
 
 	return 0;
 }
-//cloglApdT clogl_apdType_sizeFile = {(char *)"SizeFile", sizeFile_open, sizeFile_append, sizeFile_close, sizeFile_event};
-按文件大小产生新的文件. 单位兆 <<< */
-
-static cloglApdT cloglApdTypes[4] = {
-	{(char *)"Console", term_open, term_append, term_close, NULL},
-	{(char *)"TimeFile", timeFile_open, timeFile_append, timeFile_close, timeFile_event},
-	{(char *)"HourFile", timeFile_open, timeFile_append, timeFile_close, hourFile_event},
-	{NULL , NULL, NULL, NULL, NULL}
-};
 
-static cloglApdT* cloglGetApd(const char *name)
+/*
+  新链挂上去以后设置刷新策略. 原地改的也走这里
+ */
+static void cloglConfFlush(cloglConfSec *conf, cloglConfLog *cl)
 {
-	if (!name || !name[0])
-		return NULL;
-
-	for (cloglApdT *tmpapdt = &cloglApdTypes[0]; tmpapdt->name; tmpapdt++) {
-		if (!strcmp(name, tmpapdt->name)) {
-			return tmpapdt;
+	for (cloglConfSec *sec = conf; sec; sec = sec->next) {
+		if ('a' != sec->kind || strcmp(cloglConfGet(sec, "logger"), cl->log->name)) {
+			continue;
+		}
+		const char *bytes = cloglConfGet(sec, "flushBytes");
+		const char *ms = cloglConfGet(sec, "flushMs");
+		if (!bytes && !ms && !cloglConfGet(sec, "flushLevel")) {
+			continue;
 		}
+		(void)cloglSetFlush(cl->log, sec->name, bytes ? strtoull(bytes, NULL, 10) : 0, ms ? atoi(ms) : 0,
+			cloglConfLevel(sec, "flushLevel", -1));
 	}
-
-	return NULL;
 }
 
-////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////
+/*
+  原地改级别和格式. 写日志的线程可能同时在读, 一个字一个字地改
+ */
+static void cloglConfTune(cloglConfSec *conf, cloglConfLog *cl)
+{
+	for (cloglConfSec *sec = conf; sec; sec = sec->next) {
+		if ('a' != sec->kind || strcmp(cloglConfGet(sec, "logger"), cl->log->name)) {
+			continue;
+		}
+		for (cloglApd *apd = cl->log->apds; apd; apd = apd->next) {
+			if (strcmp(apd->name, sec->name)) {
+				continue;
+			}
+			const char *fmt = cloglConfGet(sec, "fmt");
+			__atomic_store_n(&apd->priority, cloglConfLevel(sec, "level", cl->level), __ATOMIC_RELEASE);
+			__atomic_store_n(&apd->fmt, cloglGetFmt(fmt ? fmt : "ptidFmt"), __ATOMIC_RELEASE);
+		}
+	}
+}
 
 /*
-  启动一个线程， 定时查看得日志输出方向的状态
+  先检查和建好所有新链, 都成功了再一起换上. 出错时什么都不改(新格式和新日志对象除外)
  */
-static void *threadEvert(void *parm)
+static int cloglConfApply(const char *fileName, cloglConfSec *conf)
 {
-	parm = parm;
-	
-	useconds_t sleepTime = CLOGL_EVENT_TIME * 1000;
+	// 检查
+	for (cloglConfSec *sec = conf; sec; sec = sec->next) {
+		int line = sec->kvs ? sec->kvs->line : 0;
+		if ('f' == sec->kind) {
+			if (!cloglConfGet(sec, "pattern") || cloglLayoutPut(sec->name, cloglConfGet(sec, "pattern"), 1)) {
+				cloglConfErr(fileName, line, "bad format", sec->name);
+				return -1;
+			}
+		} else if ('l' == sec->kind) {
+			if (CLOGL_LEVEL_UNKNOWN == cloglConfLevel(sec, "level", CLOGL_LEVEL_DEBUG)) {
+				cloglConfErr(fileName, line, "bad level", sec->name);
+				return -1;
+			}
+		} else {
+			const char *logName = cloglConfGet(sec, "logger");
+			const char *fmt = cloglConfGet(sec, "fmt");
+			if (!logName || !cloglConfFind(conf, 'l', logName) || !cloglGetApd(cloglConfGet(sec, "type"))
+				|| (fmt && !cloglGetFmt(fmt)) || CLOGL_LEVEL_UNKNOWN == cloglConfLevel(sec, "level", CLOGL_LEVEL_DEBUG)
+				|| CLOGL_LEVEL_UNKNOWN == cloglConfLevel(sec, "flushLevel", CLOGL_LEVEL_DEBUG)) {
+				cloglConfErr(fileName, line, "bad appender", sec->name);
+				return -1;
+			}
+		}
+	}
 
-	sleep(5); // 等一下业务线程
+	// 建新链
+	cloglConfLog *logs = NULL, **tail = &logs;
+	int rst = 0;
+	for (cloglConfSec *sec = conf; sec && !rst; sec = sec->next) {
+		if ('l' != sec->kind) {
+			continue;
+		}
+		cloglConfLog *cl = (cloglConfLog *)calloc(1, sizeof(cloglConfLog));
+		if (!cl) {
+			rst = -1;
+			break;
+		}
+		*tail = cl;
+		tail = &cl->next;
+		cl->level = cloglConfLevel(sec, "level", CLOGL_LEVEL_DEBUG);
+		cl->log = cloglGet(sec->name);
+		if (!cl->log && !(cl->log = cloglNew(sec->name, cl->level))) {
+			rst = -1;
+			break;
+		}
 
-	while (1) {
-		(void)usleep(sleepTime);
-		for (clogl_t *tmp = clogls; tmp; tmp = tmp->next) {
-			for (cloglApd *tmpApd = tmp->apds; tmpApd; tmpApd = tmpApd->next) {
-				cloglApdT *tmpApt = tmpApd->apdType;
-				if (tmpApt && tmpApt->event) {
-					pthread_mutex_lock(&tmpApd->pLock);
-					(void)tmpApt->event(tmpApd);
-					pthread_mutex_unlock(&tmpApd->pLock);
-				}
+		const cloglConfLog *last = cloglConfLogs;
+		while (last && last->log != cl->log) {
+			last = last->next;
+		}
+		cl->apds = cl->log->apds;
+		if (last && last->apds == cl->log->apds && cloglConfKeep(conf, sec->name)) {
+			continue;
+		}
+		// 第一次装, 或者链改了
+		for (cloglApd *apd = cl->log->apds; apd; apd = apd->next) {
+			if (apd->apdType->lockFree) {
+				// 新旧两个MmapFile会在同一个文件上抢位置, FlightRecorder换链会丢掉环里的日志, 只改级别和格式
+				cloglConfErr(fileName, 0, "can not replace appenders with MmapFile or FlightRecorder, logger", sec->name);
+				cl->apds = NULL;
+				break;
 			}
 		}
+		if (!cl->apds && cl->log->apds) {
+			continue;
+		}
+		cl->rebuild = 1;
+		rst = cloglConfBuild(fileName, conf, cl);
+	}
+	if (rst) {
+		for (cloglConfLog *cl = logs; cl; cl = cl->next) {
+			cloglConfDrop(cl->head);
+		}
+		cloglConfLogFree(logs);
+		return -1;
 	}
 
-	return (void *)0;
+	// 换上
+	int retire = 0;
+	for (cloglConfLog *cl = logs; cl; cl = cl->next) {
+		cloglConfSec *sec = cloglConfFind(conf, 'l', cl->log->name);
+		if (cl->rebuild) {
+			cl->old = cl->log->apds;
+			cl->apds = cl->head;
+			__atomic_store_n(&cl->log->apds, cl->head, __ATOMIC_RELEASE);
+			retire ++;
+		} else {
+			cloglConfTune(conf, cl);
+		}
+		__atomic_store_n(&cl->log->priority, cl->level, __ATOMIC_RELEASE);
+		cloglConfFlush(conf, cl);
+
+		const char *deferred = cloglConfGet(sec, "deferred");
+		const char *async = cloglConfGet(sec, "async");
+		if (deferred && atoi(deferred)) {
+			(void)cloglSetDeferred(cl->log, 1);
+		} else {
+			if (deferred) {
+				(void)cloglSetDeferred(cl->log, 0);
+			}
+			if (async) {
+				(void)cloglSetAsync(cl->log, atoi(async) ? 1 : 0);
+			}
+		}
+	}
+
+	// 等读旧链的线程都出去, 队列里指着旧链的日志都写完, 再关掉旧链
+	if (retire) {
+		cloglRcuSync();
+		(void)cloglFlush();
+		for (cloglConfLog *cl = logs; cl; cl = cl->next) {
+			cloglConfDrop(cl->old);
+			cl->old = NULL;
+		}
+	}
+
+	cloglConfLogFree(cloglConfLogs);
+	cloglConfLogs = logs;
+
+	return 0;
 }
 
 /*
- * 功能:
- *    向一个输出方向输出日志
- * 入参:
- *    apd:      一个输出方向结构
- *    priority: 日志级别
- *    logBuff:  存放格式化后日志信息的BUFF
- *    format:   日志信息
- * 出参:
- *    logBuff:  存放格式化后日志信息的BUFF
- * 返回值:
- *    OK 0, error -1
+  读配置文件并装上. 出错时保留原来的配置
  */
-static int cloglApdAppend(cloglApd *apd, int priority, char *logBuff)
+static int cloglConfLoad(const char *fileName)
 {
-	if (!apd->apdType)
-		return -1;
-
-	if (!apd->apdType->append)
+	cloglConfSec *conf = NULL;
+	if (cloglConfParse(fileName, &conf)) {
 		return -1;
+	}
 
-	if (apd->priority < priority)
-		return 0;
-
-	pthread_mutex_lock(&apd->pLock);
-	if (!apd->isOpen) { 
-		if (cloglApdOpen(apd)) {
-			pthread_mutex_unlock(&apd->pLock);
-			return -1;
-		}
-	}	
-	int rst = apd->apdType->append(apd, logBuff);
-	pthread_mutex_unlock(&apd->pLock);
+	pthread_mutex_lock(&cloglConfLock);
+	int rst = cloglConfApply(fileName, conf);
+	if (!rst) {
+		cloglConfFree(cloglConfLast);
+		cloglConfLast = conf;
+	} else {
+		cloglConfFree(conf);
+	}
+	pthread_mutex_unlock(&cloglConfLock);
 
 	return rst;
 }
 
 /*
- * 功能:
- *    给用户调用的记录日志函数
- * 入参:
- *    log:      日志结构对象
- *    priority: 日志级别
- *    format:   日志信息
- * 出参:
- *    NO
- * 返回值:
- *    NO
+  配置文件线程. 盯着文件所在目录, 编辑器改名覆盖也能看到. 文件改完静下来100毫秒再加载
  */
-void clogLogger(clogl_t *log, int priority, const char *format, ...)
-{	
-	if (!log)
-		return;
+static void *threadConf(void *parm)
+{
+	const char *fileName = (const char *)parm;
 
-	if (!log->apds)
-		return;
+	char dir[PATH_MAX];
+	const char *base = strrchr(fileName, '/');
+	if (base) {
+		(void)snprintf(dir, sizeof(dir), "%.*s", (int)(base - fileName) ? (int)(base - fileName) : 1, fileName);
+		base ++;
+	} else {
+		strcpy(dir, ".");
+		base = fileName;
+	}
 
-	if (log->priority < priority)
-		return;
+	int fd = inotify_init1(IN_CLOEXEC);
+	if (fd < 0 || inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0) {
+		cloglErr("threadConf inotify error");
+		if (fd >= 0) {
+			close(fd);
+		}
+		return (void *)0;
+	}
 
-	// 格式化日志信息. 最长512K
-	char *logMsg = NULL;
+	char buff[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	while (1) {
+		ssize_t n = read(fd, buff, sizeof(buff));
+		if (n <= 0) {
+			if (n < 0 && EINTR == errno) {
+				continue;
+			}
+			break;
+		}
 
-	// 发送到多个输出方向
-	for (cloglApd *tmpapd = log->apds; tmpapd; tmpapd = tmpapd->next) {	
-		if (!tmpapd->fmt)
-			continue;
-		if (!tmpapd->fmt->format)
+		int hit = 0;
+		for (char *p = buff; p < buff + n; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len) {
+			const struct inotify_event *ev = (const struct inotify_event *)p;
+			if (ev->len && !strcmp(ev->name, base)) {
+				hit = 1;
+			}
+		}
+		if (!hit) {
 			continue;
-
-		logMsg = NULL;
-
-		va_list va;
-		va_start(va, format);
-		if (CLOGL_LEVEL_DATA == priority) {
-			logMsg = cloglDefFmt(log, format, va);  /* DATA级别的日志特别处理 !!! */
-		} else {
-			logMsg = tmpapd->fmt->format(log, format, va);
 		}
-		va_end(va);
 
-		(void)cloglApdAppend(tmpapd, priority, logMsg); // 输出日志
+		// 编辑器可能分几次写完, 等它静下来
+		struct pollfd pfd = {fd, POLLIN, 0};
+		while (poll(&pfd, 1, 100) > 0) {
+			if (read(fd, buff, sizeof(buff)) <= 0) {
+				break;
+			}
+		}
+		(void)cloglConfLoad(fileName);
 	}
-}
+	close(fd);
 
+	return (void *)0;
+}
 
 /*
  * 功能:
- *    初始化日志模块
+ *    按配置文件建立或修改日志对象, 格式和输出方向. 可以反复调, 每次按文件的内容改
+ *    级别, 格式和刷新策略原地改; 输出方向有增删或别的属性改了, 换一条新链, 写日志的线程不用等锁
+ *    有MmapFile或FlightRecorder输出方向的日志对象不换链, 只改级别和格式. 配置文件里删掉的日志对象不动
+ *    [format:名字]    pattern = 布局串
+ *    [logger:名字]    level = 级别  async = 0/1  deferred = 0/1
+ *    [appender:名字]  logger = 日志对象名  type = 类型  fmt = 格式名  level = 级别  file = 文件名
+ *                     flushBytes flushMs flushLevel 同cloglSetFlush, 其他键同cloglApdSet
  * 入参:
- *    NO
+ *    fileName: 配置文件名
+ *    watch:    1 用inotify盯着文件, 改了就重新加载. 只能盯一个文件
  * 出参:
  *    NO
  * 返回值:
- *    -1 OR 0
+ *    0 OR -1. 出错的原因写到cloglErr, 原来的配置不变
  */
-int cloglInit()
+int cloglLoadConfig(const char *fileName, int watch)
 {
-	// 启动事件线程
-	pthread_t ptid = 0;
-	int rst = pthread_create(&ptid, NULL, threadEvert, NULL);
-	if (rst) {
+	if (!fileName || !fileName[0]) {
 		return -1;
 	}
-	// 使线程处于分离状态
-	rst = pthread_detach(ptid);
-	if (rst) {
+
+	if (cloglConfLoad(fileName)) {
+		return -1;
+	}
+	if (!watch) {
+		return 0;
+	}
+
+	pthread_mutex_lock(&cloglConfLock);
+	if (cloglConfWatched) {
+		int rst = strcmp(cloglConfWatched, fileName) ? -1 : 0;
+		pthread_mutex_unlock(&cloglConfLock);
+		return rst;
+	}
+	cloglConfWatched = strdup(fileName);
+	pthread_t ptid = 0;
+	if (!cloglConfWatched || pthread_create(&ptid, NULL, threadConf, cloglConfWatched)) {
+		free(cloglConfWatched);
+		cloglConfWatched = NULL;
+		pthread_mutex_unlock(&cloglConfLock);
 		return -1;
 	}
+	(void)pthread_detach(ptid);
+	pthread_mutex_unlock(&cloglConfLock);
 
 	return 0;
 }
+/* 配置文件 <<< */
 
+/* 调用处开关 >>> */
 /*
- * 功能:
- *    设置一个日志对象的输出级别
- * 入参:
- *    log: 日志对象
- *    p: 输出级别
- * 出参:
- *    NO
- * 返回值:
- *    0 OR -1
+  CLOGL_INFO和CLOGL_DEBUG的调用处, 包括它们的限流抽样宏, 都放在clogl_sites段里, 链接器给出段的首尾.
+  没有用这两个宏的程序没有这个段, 首尾是弱符号, 为NULL
  */
-int setLogPriority(clogl_t *log, int p)
+extern cloglDynSite __start_clogl_sites[] __attribute__((weak));
+extern cloglDynSite __stop_clogl_sites[] __attribute__((weak));
+
+/*
+  site是被cloglSiteSet打开了的调用处. 不在clogl_sites里的都不是
+ */
+static int cloglSiteOn(const cloglSite *site)
 {
-	if (p < CLOGL_LEVEL_ERR || p >= CLOGL_LEVEL_UNKNOWN)
-		return -1;
-	if(!log)
-		return -1;
+	const cloglDynSite *dyn = (const cloglDynSite *)site; // site是cloglDynSite的第一个成员
+	if (!__start_clogl_sites || dyn < __start_clogl_sites || dyn >= __stop_clogl_sites) {
+		return 0;
+	}
 
-	log->priority = p;
+	return CLOGL_DYN_ON == __atomic_load_n(&dyn->state, __ATOMIC_RELAXED);
+}
 
-	for (cloglApd *tmpapd = log->apds; tmpapd; tmpapd = tmpapd->next) {
-		tmpapd->priority = p;
+static int cloglSiteMatch(const cloglDynSite *dyn, const char *file, const char *func, int line)
+{
+	if (file && file[0]) {
+		const char *base = strrchr(dyn->site.file, '/');
+		base = base ? base + 1 : dyn->site.file;
+		if (fnmatch(file, dyn->site.file, 0) && fnmatch(file, base, 0)) {
+			return 0;
+		}
+	}
+	if (func && func[0] && fnmatch(func, dyn->site.func, 0)) {
+		return 0;
 	}
 
-	return 0;
+	return line <= 0 || line == dyn->site.line;
 }
 
 /*
-  释放日志缓冲区资源
+ * 功能:
+ *    按源文件, 函数, 行号打开或关闭CLOGL_INFO/CLOGL_DEBUG调用处(包括_RATELIMITED/_SAMPLED, 打开了还是限流), 不用改日志对象的级别
+ * 入参:
+ *    file:  源文件名通配符, 比对完整路径或文件名. NULL或""不限
+ *    func:  函数名通配符. NULL或""不限
+ *    line:  行号. 0 不限
+ *    state: CLOGL_DYN_ON 不管级别都输出; CLOGL_DYN_OFF 不输出; CLOGL_DYN_DEFAULT 跟日志对象的级别
+ * 出参:
+ *    NO
+ * 返回值:
+ *    改了的调用处个数 OR -1
  */
-void freeMsgBuff(void *msgp)
+int cloglSiteSet(const char *file, const char *func, int line, int state)
 {
-	clogMsg *msg = (clogMsg *)msgp;
-	(void)free(msg->msgBuff);
-	(void)free(msg);
-	msg = NULL;
+	if (CLOGL_DYN_DEFAULT != state && CLOGL_DYN_ON != state && CLOGL_DYN_OFF != state) {
+		return -1;
+	}
+
+	int n = 0;
+	for (cloglDynSite *dyn = __start_clogl_sites; dyn && dyn < __stop_clogl_sites; dyn++) {
+		if (cloglSiteMatch(dyn, file, func, line)) {
+			__atomic_store_n(&dyn->state, (unsigned char)state, __ATOMIC_RELAXED);
+			n ++;
+		}
+	}
+
+	return n;
 }
 
 /*
  * 功能:
- *    获得一个按时间产生新的日志文件的默认日志对象指针
+ *    列出所有CLOGL_INFO/CLOGL_DEBUG调用处和开关, 一行一个: "文件:行号 [函数] 开关 级别 格式"
+ *    开关: = 跟级别, + 打开, - 关闭
  * 入参:
- *    日志对象名
+ *    out: 输出到这里
  * 出参:
  *    NO
  * 返回值:
- *    成功返回日志对象指针, 出错返回 NULL
+ *    调用处个数 OR -1
  */
-clogl_t *cloglGetDftTimeFile(const char *name)
+int cloglSiteDump(FILE *out)
 {
-	static int only; // 系统中只能有一个相同的日志对象存在
-	if (only)
-		return NULL;
+	if (!out) {
+		return -1;
+	}
 
-	if (!name || !name[0])
-		return NULL;
+	int n = 0;
+	for (const cloglDynSite *dyn = __start_clogl_sites; dyn && dyn < __stop_clogl_sites; dyn++) {
+		unsigned char state = __atomic_load_n(&dyn->state, __ATOMIC_RELAXED);
+		fprintf(out, "%s:%d [%s] %c %s \"%s\"\n", dyn->site.file, dyn->site.line, dyn->site.func,
+			(CLOGL_DYN_ON == state) ? '+' : (CLOGL_DYN_OFF == state) ? '-' : '=',
+			cloglLevelTag[dyn->site.level], dyn->site.format);
+		n ++;
+	}
 
-	clogl_t *tmpLog = (clogl_t*)calloc(1, sizeof(clogl_t));
-	if (!tmpLog)
-		return NULL;
+	return n;
+}
+/* 调用处开关 <<< */
 
-	// 日志对象名
-	tmpLog->name = (char*)calloc(strlen(name)+1, sizeof(char));
-	if (!tmpLog->name) {
-		free(tmpLog);
-		return NULL;
-	}
-	(void)strcpy(tmpLog->name, name);
+/* 信号处理 >>> */
+/*
+  信号处理函数里能用的记日志: 不分配内存, 不加锁, 不用stdio和localtime, 格式化在栈上, 直接write各输出方向的文件
+ */
+static const int cloglCrashSigs[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+static struct sigaction cloglCrashOld[sizeof(cloglCrashSigs) / sizeof(cloglCrashSigs[0])];
+static int cloglCrashOn;
+static char cloglCrashStack[CLOGL_SIG_STACK]; // 栈溢出时信号处理函数用的栈. 只给调cloglCrashHandler的线程
 
-	// 输出级别
-	tmpLog->priority =  CLOGL_LEVEL_DEBUG;
+typedef struct _clogl_sig_buf
+{
+	char *buf;
+	size_t size;
+	size_t len;
+} cloglSigBuf;
 
-	// 日志缓冲区
-	int rst = pthread_key_create(&tmpLog->msgp, freeMsgBuff);
-	if (rst){
-		free(tmpLog->name);
-		free(tmpLog);
-		return NULL;
+static void cloglSigPut(cloglSigBuf *b, const char *str, size_t len)
+{
+	while (len-- > 0 && b->len < b->size) {
+		b->buf[b->len++] = *str++;
 	}
+}
 
-	/* 输出方向 */
-	cloglApd *tmpApd = (cloglApd *)calloc(1, sizeof(cloglApd));
-	if (!tmpApd) {
-		free(tmpLog->name);
-		free(tmpLog);
-		return NULL;
-	}
-	// 输出方向名
-	tmpApd->name = (char *)calloc(16, sizeof(char));
-	if (!tmpApd->name) {
-		free(tmpLog->name);
-		free(tmpLog);
-		free(tmpApd);
-		return NULL;
-	}
-	(void)strcpy(tmpApd->name, "dftTimeFileApd");
-	// 输出方输出级别
-	tmpApd->priority = CLOGL_LEVEL_DEBUG;
-	// 未打开状态
-	tmpApd->isOpen = 0;
-	// 输出方向类型
-	tmpApd->apdType = cloglGetApd("HourFile");
-	if (!tmpApd->apdType) {
-		free(tmpLog->name);
-		free(tmpLog);
-		free(tmpApd);
-		return NULL;
+/*
+  无符号整数按进制转成文字, 不够width位时补pad
+ */
+static void cloglSigNum(cloglSigBuf *b, unsigned long long v, int base, int width, char pad, int neg)
+{
+	char tmp[32];
+	int n = 0;
+	do {
+		tmp[n++] = "0123456789abcdef"[v % base];
+		v /= base;
+	} while (v && n < (int)sizeof(tmp));
+	if (neg && '0' == pad) {
+		cloglSigPut(b, "-", 1);
+		width --;
 	}
-	// 格式
-	tmpApd->fmt = cloglGetFmt("ptidFmt");
-	// 初始化线程锁
-	pthread_mutex_init(&tmpApd->pLock, NULL);
-
-	/* 属性 */
-	cloglTimeFileOpt *tmpOpt = (cloglTimeFileOpt *)calloc(1, sizeof(cloglTimeFileOpt));
-	if (!tmpOpt) {
-		free(tmpLog->name);
-		free(tmpLog);
-		free(tmpApd->name);
-		free(tmpApd);
-		return NULL;
+	for (int i = n + (neg && ' ' == pad); i < width; i++) {
+		cloglSigPut(b, &pad, 1);
 	}
-	// 日志文件名. 默认当前进程可执行文件所在目录下的logs目录, 文件名与可执行文件名相同
-	pid_t pid = getpid();
-	char procf[32] = {0,};
-	char exe[2048] = {0,};
-	(void)snprintf(procf, sizeof(procf), "%s%d%s", "/proc/", pid, "/exe");
-	ssize_t err = readlink(procf, exe, sizeof(exe));
-	if (-1 == err) {
-		free(tmpLog->name);
-		free(tmpLog);
-		free(tmpApd->name);
-		free(tmpApd);
-		free(tmpOpt);
-		return NULL;
+	if (neg && ' ' == pad) {
+		cloglSigPut(b, "-", 1);
 	}
-	char *exep = strrchr(exe, '/');
-	if (!exep) {
-		free(tmpLog->name);
-		free(tmpLog);
-		free(tmpApd->name);
-		free(tmpApd);
-		free(tmpOpt);
-		return NULL;
+	while (n > 0) {
+		cloglSigPut(b, &tmp[--n], 1);
 	}
-	char execname[256] = {0}; // 可执行文件名
-	strncpy(execname, exep+1, sizeof(execname));
+}
 
-	// 建logs目录
-	strcpy(exep+1, "logs");
-	if (!access(exe, F_OK)) {
-		// 如果存在, 是不是目录?
-		struct stat filestat;
-		if (stat(exe, &filestat)) {
-			free(tmpLog->name);
-			free(tmpLog);
-			free(tmpApd->name);
-			free(tmpApd);
-			free(tmpOpt);
-			return NULL;
+/*
+  只认 %d %i %u %x %p %s %c %%, 长度修饰 l ll z, 宽度和0填充
+ */
+static void cloglSigFmt(cloglSigBuf *b, const char *format, va_list args)
+{
+	for (const char *p = format; *p; p++) {
+		if ('%' != *p) {
+			cloglSigPut(b, p, 1);
+			continue;
 		}
-		if (!S_ISDIR(filestat.st_mode))	{
-			if (-1 == mkdir(exe, 0755)) {
-				free(tmpLog->name);
-				free(tmpLog);
-				free(tmpApd->name);
-				free(tmpApd);
-				free(tmpOpt);
-				return NULL;
+		p ++;
+		char pad = ' ';
+		if ('0' == *p) {
+			pad = '0';
+			p ++;
+		}
+		int width = 0;
+		while (*p >= '0' && *p <= '9') {
+			width = width * 10 + (*p++ - '0');
+		}
+		int lng = 0;
+		if ('z' == *p) {
+			lng = 1;
+			p ++;
+		}
+		while ('l' == *p) {
+			lng ++;
+			p ++;
+		}
+
+		switch (*p) {
+		case 'd':
+		case 'i': {
+			long long v = (lng > 1) ? va_arg(args, long long) : lng ? va_arg(args, long) : va_arg(args, int);
+			cloglSigNum(b, (v < 0) ? -(unsigned long long)v : (unsigned long long)v, 10, width, pad, v < 0);
+			break;
+		}
+		case 'u':
+		case 'x': {
+			unsigned long long v = (lng > 1) ? va_arg(args, unsigned long long) : lng ? va_arg(args, unsigned long) : va_arg(args, unsigned int);
+			cloglSigNum(b, v, ('x' == *p) ? 16 : 10, width, pad, 0);
+			break;
+		}
+		case 'p':
+			cloglSigPut(b, "0x", 2);
+			cloglSigNum(b, (uintptr_t)va_arg(args, void *), 16, width, pad, 0);
+			break;
+		case 's': {
+			const char *str = va_arg(args, const char *);
+			if (!str) {
+				str = "(null)";
 			}
+			cloglSigPut(b, str, strlen(str));
+			break;
 		}
-	} else {
-		// 如果不存在, mkdir
-		if (-1 == mkdir(exe, 0755)) {
-			free(tmpLog->name);
-			free(tmpLog);
-			free(tmpApd->name);
-			free(tmpApd);
-			free(tmpOpt);
-			return NULL;
+		case 'c': {
+			char c = (char)va_arg(args, int);
+			cloglSigPut(b, &c, 1);
+			break;
+		}
+		case '%':
+			cloglSigPut(b, "%", 1);
+			break;
+		case 0:
+			return;
+		default: // 不认识的原样输出, 参数对不上了, 后面的都不格式化
+			cloglSigPut(b, p - 1, 2);
+			cloglSigPut(b, p + 1, strlen(p + 1));
+			return;
 		}
 	}
+}
 
-	// 日志文件名
-	int len = strlen(exe) + strlen(execname) + 64;
-	tmpOpt->fileName = (char *)calloc(len, sizeof(char));
-	if (!tmpOpt->fileName) {
-
+/*
+  "%Y-%m-%d %X". 时区用最近一次正常格式化时间时的
+ */
+static void cloglSigTime(cloglSigBuf *b)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	long long t = (long long)ts.tv_sec + __atomic_load_n(&cloglGmtOff, __ATOMIC_RELAXED);
+	long long days = t / 86400;
+	long secs = (long)(t % 86400);
+	if (secs < 0) {
+		secs += 86400;
+		days --;
 	}
-	snprintf(tmpOpt->fileName, len, "%s/%s%s", exe, execname, ".log");
-
-	// 默认简隔1小时
-	tmpOpt->span = 1 * 60 * 60;
-
-	// 赋值属性
-	tmpApd->opt = tmpOpt;
-
-	tmpLog->apds = tmpApd;
 
-	// 加到系统日志对象链中
-	if (!clogls) {
-		clogls = tmpLog;
-	} else {
-		clogl_t **tmp = &clogls->next;
-		while (*tmp)
-			tmp = &((*tmp)->next);
+	// 公历日期 (Howard Hinnant的days_from_civil的逆运算)
+	days += 719468;
+	long long era = (days >= 0 ? days : days - 146096) / 146097;
+	unsigned doe = (unsigned)(days - era * 146097);
+	unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	unsigned mp = (5 * doy + 2) / 153;
+	unsigned d = doy - (153 * mp + 2) / 5 + 1;
+	unsigned m = (mp < 10) ? mp + 3 : mp - 9;
+	long long y = (long long)yoe + era * 400 + (m <= 2);
+
+	cloglSigNum(b, (unsigned long long)y, 10, 4, '0', 0);
+	cloglSigPut(b, "-", 1);
+	cloglSigNum(b, m, 10, 2, '0', 0);
+	cloglSigPut(b, "-", 1);
+	cloglSigNum(b, d, 10, 2, '0', 0);
+	cloglSigPut(b, " ", 1);
+	cloglSigNum(b, secs / 3600, 10, 2, '0', 0);
+	cloglSigPut(b, ":", 1);
+	cloglSigNum(b, secs / 60 % 60, 10, 2, '0', 0);
+	cloglSigPut(b, ":", 1);
+	cloglSigNum(b, secs % 60, 10, 2, '0', 0);
+}
 
-		*tmp = tmpLog;
+/*
+  写一个日志对象的所有输出方向. 读链不进RCU读区间, 重新加载配置时换下的链可能正被释放
+ */
+static void cloglSigOut(clogl_t *log, int level, const char *msg, size_t len)
+{
+	for (cloglApd *apd = __atomic_load_n(&log->apds, __ATOMIC_ACQUIRE); apd; apd = apd->next) {
+		if (apd->priority >= level && apd->apdType && apd->apdType->sigWrite && __atomic_load_n(&apd->isOpen, __ATOMIC_ACQUIRE)) {
+			(void)apd->apdType->sigWrite(apd, msg, len);
+		}
 	}
+}
 
-	only ++;
-
-	return tmpLog;
+static void cloglSigLogV(clogl_t *log, int level, const char *format, va_list args)
+{
+	char buf[CLOGL_SIG_BUFF];
+	cloglSigBuf b = {buf, sizeof(buf), 0};
+
+	cloglSigTime(&b);
+	cloglSigPut(&b, " <", 2);
+	cloglSigNum(&b, (unsigned long long)getpid(), 10, 0, ' ', 0);
+	cloglSigPut(&b, " ", 1);
+	cloglSigNum(&b, (unsigned long long)syscall(SYS_gettid), 10, 0, ' ', 0);
+	cloglSigPut(&b, "> [", 3);
+	const char *tag = (level >= 0 && level < CLOGL_LEVEL_UNKNOWN) ? cloglLevelTag[level] : "UNKNOWN";
+	cloglSigPut(&b, tag, strlen(tag));
+	cloglSigPut(&b, "] ", 2);
+	cloglSigFmt(&b, format, args);
+
+	if (log) {
+		if (log->priority >= level) {
+			cloglSigOut(log, level, buf, b.len);
+		}
+		return;
+	}
+	for (clogl_t *tmp = __atomic_load_n(&clogls, __ATOMIC_ACQUIRE); tmp; tmp = __atomic_load_n(&tmp->next, __ATOMIC_ACQUIRE)) {
+		if (tmp->priority >= level) {
+			cloglSigOut(tmp, level, buf, b.len);
+		}
+	}
 }
 
 /*
  * 功能:
- *    获得一个日志对象指针
+ *    在信号处理函数里记日志. 只用异步信号安全的函数: 格式化在栈上, 直接write各输出方向的文件, 不加锁
+ *    同一输出方向缓冲里还没写的日志先写掉. 还没打开的输出方向和BinFile不写; MmapFile当前段放不下就不写
+ *    日志格式固定为"时间 <pid tid> [级别] 消息", 不用输出方向的格式
  * 入参:
- *    日志对象名
+ *    log:    日志对象. NULL 所有日志对象
+ *    level:  日志级别
+ *    format: 只认 %d %i %u %x %p %s %c %%, 长度修饰 l ll z, 宽度和0填充. 最长CLOGL_SIG_BUFF字节
  * 出参:
  *    NO
  * 返回值:
- *    成功返回日志对象指针, 出错返回 NULL
+ *    NO
  */
-clogl_t *cloglGet(const char *name)
+void cloglSigLog(clogl_t *log, int level, const char *format, ...)
 {
-	if (!name || !name[0]) {
-		return NULL;
+	if (!format) {
+		return;
 	}
 
-	clogl_t *tmplog = clogls;
-	while (tmplog) {
-		if (!strcmp(tmplog->name, name))
-			return tmplog;
-		tmplog = tmplog->next;
-	}
+	int err = errno;
+	va_list va;
+	va_start(va, format);
+	cloglSigLogV(log, level, format, va);
+	va_end(va);
+	errno = err;
+}
 
-	return NULL;
+static void cloglSigAll(int level, const char *format, ...)
+{
+	va_list va;
+	va_start(va, format);
+	cloglSigLogV(NULL, level, format, va);
+	va_end(va);
 }
 
 /*
- * 功能:
- *    获得一个系统默认日志对象指针
- * 入参:
- *    NO
- * 出参:
- *    NO
- * 返回值:
- *    成功返回日志对象指针, 出错返回 NULL
+  致命信号: 等异步队列写完, 写出所有缓冲, 记信号和调用栈, 再交给原来的处理方式
  */
-clogl_t *cloglGetDft()
+static void cloglCrashSig(int sig, siginfo_t *info, void *uctx)
 {
-#define DEFAULT_LOG_NAME "noname"  // 系统中默认日志对象名
+	uctx = uctx;
+	int err = errno;
+
+	// 写线程还活着就等它把队列里的写完. 崩的就是写线程时不等
+	if (__atomic_load_n(&cloglAsyncOK, __ATOMIC_ACQUIRE) && !cloglIsWriter) {
+		size_t enq = __atomic_load_n(&cloglAsyncQ.enq, __ATOMIC_ACQUIRE);
+		for (int i = 0; i < CLOGL_SIG_WAIT_MS && (ssize_t)(__atomic_load_n(&cloglAsyncQ.deq, __ATOMIC_ACQUIRE) - enq) < 0; i++) {
+			struct timespec ts = {0, 1000000L};
+			(void)nanosleep(&ts, NULL);
+		}
+	}
 
-	clogl_t *tmpLog = cloglGet(DEFAULT_LOG_NAME);
+	const char *name = (SIGSEGV == sig) ? "SIGSEGV" : (SIGBUS == sig) ? "SIGBUS" : (SIGFPE == sig) ? "SIGFPE"
+		: (SIGILL == sig) ? "SIGILL" : (SIGABRT == sig) ? "SIGABRT" : "?"; // strsignal不是异步信号安全的
+	cloglSigAll(CLOGL_LEVEL_ERR, "fatal signal %d (%s) code %d addr %p", sig, name, info ? info->si_code : 0, info ? info->si_addr : NULL);
+	void *frames[CLOGL_SIG_FRAMES];
+	int n = backtrace(frames, CLOGL_SIG_FRAMES);
+	for (int i = 0; i < n; i++) {
+		cloglSigAll(CLOGL_LEVEL_ERR, "  #%d %p", i, frames[i]);
+	}
+	backtrace_symbols_fd(frames, n, STDERR_FILENO); // 带符号名的调用栈只能写到fd
 
-	if (!tmpLog)
-		tmpLog = cloglGetDftTimeFile(DEFAULT_LOG_NAME);
+	// 没有写到日志级别的输出方向, 缓冲里的也写掉
+	for (clogl_t *tmp = __atomic_load_n(&clogls, __ATOMIC_ACQUIRE); tmp; tmp = __atomic_load_n(&tmp->next, __ATOMIC_ACQUIRE)) {
+		cloglSigOut(tmp, CLOGL_LEVEL_DATA, NULL, 0);
+	}
 
-	return tmpLog;
+	for (size_t i = 0; i < sizeof(cloglCrashSigs) / sizeof(cloglCrashSigs[0]); i++) {
+		if (cloglCrashSigs[i] == sig) {
+			(void)sigaction(sig, &cloglCrashOld[i], NULL);
+		}
+	}
+	errno = err;
+	(void)raise(sig); // 返回后按原来的方式处理
 }
 
 /*
- * 功能：
- *    日志级别从字符串转换为clogl_level
- * 入参：
- *    字符串形式的日志级别
- * 出参：
+ * 功能:
+ *    安装或卸载致命信号(SIGSEGV SIGBUS SIGFPE SIGILL SIGABRT)处理函数. 收到时先等异步队列写完,
+ *    把所有输出方向缓冲里的日志写出去, 用cloglSigLog记信号和调用栈(地址), 带符号的调用栈写到stderr,
+ *    再交给安装前的处理方式(默认是结束进程并产生core)
+ *    栈溢出时用的备用栈只给调这个函数的线程
+ * 入参:
+ *    on: 1 安装, 0 恢复原来的
+ * 出参:
  *    NO
- * 返回值：
- *     clogl_level形式的日志级别
+ * 返回值:
+ *    0 OR -1
  */
-clogl_level cloglLevel(const char *lvl)
+int cloglCrashHandler(int on)
 {
-	if (!lvl || !lvl[0]) {
-		return CLOGL_LEVEL_UNKNOWN;
+	size_t cnt = sizeof(cloglCrashSigs) / sizeof(cloglCrashSigs[0]);
+
+	if (!on) {
+		if (!cloglCrashOn) {
+			return 0;
+		}
+		for (size_t i = 0; i < cnt; i++) {
+			(void)sigaction(cloglCrashSigs[i], &cloglCrashOld[i], NULL);
+		}
+		cloglCrashOn = 0;
+		return 0;
 	}
-		
-	if(0 == strcmp(lvl, "DATA")) {
-		return CLOGL_LEVEL_DATA;
-	} else if(0 == strcmp(lvl, "ERROR")) {
-		return CLOGL_LEVEL_ERR;
-	} else if(0 == strcmp(lvl, "WARN")) {
-		return CLOGL_LEVEL_WARN;
-	} else if(0 == strcmp(lvl, "INFO")) {
-		return CLOGL_LEVEL_INFO;
-	} else if(0 == strcmp(lvl, "DEBUG")) {
-		return CLOGL_LEVEL_DEBUG;
+	if (cloglCrashOn) {
+		return 0;
 	}
 
-	return CLOGL_LEVEL_UNKNOWN;
+	// backtrace第一次调用会加载libgcc, 要分配内存, 先在这里调一次
+	void *frames[2];
+	(void)backtrace(frames, 2);
+	// 时区偏移
+	time_t now = time(NULL);
+	struct tm tm;
+	localtime_r(&now, &tm);
+	__atomic_store_n(&cloglGmtOff, tm.tm_gmtoff, __ATOMIC_RELAXED);
+
+	stack_t ss;
+	memset(&ss, 0, sizeof(ss));
+	ss.ss_sp = cloglCrashStack;
+	ss.ss_size = sizeof(cloglCrashStack);
+	(void)sigaltstack(&ss, NULL);
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = cloglCrashSig;
+	sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+	sigemptyset(&sa.sa_mask);
+	for (size_t i = 0; i < cnt; i++) {
+		if (sigaction(cloglCrashSigs[i], &sa, &cloglCrashOld[i])) {
+			for (size_t j = 0; j < i; j++) {
+				(void)sigaction(cloglCrashSigs[j], &cloglCrashOld[j], NULL);
+			}
+			return -1;
+		}
+	}
+	cloglCrashOn = 1;
+
+	return 0;
 }
+/* 信号处理 <<< */
 
 #if 0
 #include <sys/time.h>
@@ -1,7 +1,7 @@
 /* 
  * C语言日志记录
  * 可以多线程, 可以日志分级, 可以设置记录级别, 可以输出到多个方向
- * WARN!!! -> 初始化过程可不是线程安全的. 信号处理的过程也不是线程安全的!!!
+ * WARN!!! -> cloglInit只调一次. cloglNew/cloglGet可以在多个线程里同时调; 同一个日志对象的cloglAddApd和cloglApdSet不要在多个线程里同时调. 信号处理函数里只能用cloglSigLog
  *
  * 作者:
  *    刘恒(liuhengloveyou@gmail.com)
@@ -12,6 +12,8 @@
 #include <time.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
 #include <stdarg.h>
 #include <pthread.h>
 #include <unistd.h>
@@ -26,10 +28,38 @@
 extern "C" {
 #endif /* defined (__cplusplus) */
 
-#define CLOGL_EVENT_TIME      100                                               // 事件触发间隔毫秒数
+#define CLOGL_EVENT_TIME      100                                               // 异步写线程空闲时多少毫秒看一次队列
 #define CLOGL_MSG_MAX         (512 * 1024)                                      // 日志信息最大长度(字节)
 #define CLOGL_SRC_INFO        1                                                 // 日志信息里是否显示原代码文件信息
+#ifndef CLOGL_MIN_LEVEL
+#define CLOGL_MIN_LEVEL       4                                                 // 编译进程序的最详细级别, 取值同clogl_level(0 DATA ... 4 DEBUG). 更详细级别的宏展开为空
+#endif
+#define CLOGL_ASYNC_QUEUE     8192                                              // 异步模式队列长度. 必须是2的幂
+#define CLOGL_FILE_BUFF       (64 * 1024)                                       // 文件输出方向批量写缓冲的字节数
+#define CLOGL_MMAP_SEGMENT    (16 * 1024 * 1024)                                // MmapFile每次预分配并映射的字节数
+#define CLOGL_FR_SLOT         256                                               // FlightRecorder每个槽的字节数. 超长的日志截断
+#define CLOGL_FR_SLOTS        16384                                             // FlightRecorder的槽数. 必须是2的幂
+#define CLOGL_ZIP_BUDGET      25                                                // 压缩线程默认最多用一个CPU的百分之几
+#define CLOGL_URING_BUFS      4                                                 // UringFile注册给内核的缓冲个数. 最多这么多批同时在写
+#define CLOGL_ASYNC_INLINE    352                                               // 异步队列单元内的日志缓冲字节数, 超长的另外分配
+#define CLOGL_REG_SLOTS       64                                                // 按名字找日志对象的哈希表初始槽数. 必须是2的幂, 满一半时加倍
+#define CLOGL_BACKLOG_BYTES   (64 * 1024)                                       // 输出方向忙时暂存日志的缓冲默认字节数
+#define CLOGL_DROP_REPORT_MS  1000                                              // 过载丢掉的条数最多这么多毫秒报一次
+#define CLOGL_SIG_BUFF        1024                                              // cloglSigLog一条日志的最大字节数. 在栈上
+#define CLOGL_SIG_STACK       (64 * 1024)                                       // 致命信号处理函数的备用栈字节数
+#define CLOGL_SIG_FRAMES      64                                                // 致命信号时记录的调用栈层数
+#define CLOGL_SIG_WAIT_MS     200                                               // 致命信号时最多等异步队列写多少毫秒
  
+#if defined (__GNUC__)
+#define CLOGL_LIKELY(x)       __builtin_expect(!!(x), 1)
+#define CLOGL_UNLIKELY(x)     __builtin_expect(!!(x), 0)
+#define CLOGL_COLD            __attribute__((cold, noinline))
+#else
+#define CLOGL_LIKELY(x)       (x)
+#define CLOGL_UNLIKELY(x)     (x)
+#define CLOGL_COLD
+#endif
+
 /*
  * 日志级别
  */
@@ -54,14 +84,42 @@ typedef enum
 	CLOGL_APD_NET                             /* 发送到网络 */
 } clogl_apd_type;
 
+/*
+  日志缓冲区结构
+ */
+typedef struct _clog_msg
+{
+	char *msgBuff;                // 输出日志信息缓冲区
+	size_t msgSize;               // 当前日志信息缓冲区大小
+} clogMsg;
+
+/*
+ * 文件输出方向的批量写缓冲. 日志先拷进缓冲, 按输出方向的刷新策略用writev写文件
+ */
+typedef struct _clogl_file_out
+{
+	int fd;                           // O_APPEND打开的文件. -1 未打开
+	char *buf;                        // 批量写缓冲
+	size_t size;                      // 缓冲大小
+	size_t used;                      // 缓冲里待写的字节数
+	struct timespec first;            // 缓冲里最早一条日志的时间
+} cloglFileOut;
+
 /* 
  * 按文件大小产生新的文件输出类型的属性
  */
 typedef struct _clogl_apd_sizefile_opt
 {
 	char *fileName;                   // 日志文件名
-	FILE *fp;                         // 当前打开日志文件的指针
-	int maxSize;                      // 日志文件最大兆数
+	cloglFileOut out;                 // 当前打开的日志文件
+	off_t maxSize;                    // 日志文件最大字节数. 从兆转成字节
+	int backups;                      // 保留几个备份. fileName.1 最新
+	off_t size;                       // 当前日志文件的字节数. 包括缓冲里还没写的
+	dev_t dev;                        // 当前打开文件的设备号
+	ino_t ino;                        // 当前打开文件的inode. 和路径上的比, 知道文件被删或被移走了
+	time_t checked;                   // 上次和路径比较的时间
+	int rolling;                      // 写满了, 等事件线程换文件
+	int rollFailed;                   // 上次换文件失败了. 离上次比较不到CLOGL_SIZEFILE_CHECK秒不再试
 } cloglSizeFileOpt;
 
 /*
@@ -70,13 +128,75 @@ typedef struct _clogl_apd_sizefile_opt
 typedef struct _clogl_apd_timefile_opt
 {
 	char *fileName;                   // 日志文件名
-	FILE *fp;                         // 当前打开日志文件的指针
+	cloglFileOut out;                 // 当前打开的日志文件
 	time_t span;                      // 间隔秒数. 从小时转成秒
 	time_t now;                       // 当前日志文件产生的时间戳
+	time_t next;                      // 下次换文件的时间. 打开时算好
 } cloglTimeFileOpt;
 
+/*
+ * 内存映射文件输出类型的属性. 写日志只是原子地占一段位置再memcpy, 没有系统调用
+ */
+typedef struct _clogl_apd_mmapfile_opt
+{
+	char *fileName;                   // 日志文件名
+	size_t segSize;                   // 每段预分配并映射的字节数
+	time_t span;                      // 间隔秒数. 0 不换文件
+	time_t now;                       // 当前日志文件产生的时间戳
+	struct _clogl_mmap_seg *cur;      // 正在写的段
+	struct _clogl_mmap_seg *retired;  // 写满了, 等正在拷贝的线程写完再解除映射的段
+	pthread_mutex_t rollLock;         // 换段锁
+} cloglMmapFileOpt;
+
+/*
+ * 飞行记录器输出类型的属性. 文件里是定长槽组成的环, 写日志只是原子地占一个槽再memcpy, 没有系统调用.
+ * 映射是MAP_SHARED的, 进程崩溃后写进去的日志还在内核的页缓存里
+ */
+typedef struct _clogl_apd_flightrec_opt
+{
+	char *fileName;                   // 日志文件名. 打开时把上次的改名为fileName.1
+	size_t slotSize;                  // 每个槽的字节数, 包括槽头
+	size_t slots;                     // 槽数. 2的幂
+	struct _clogl_fr_head *head;      // 映射的文件. NULL 没打开
+	size_t mapSize;                   // 映射长度
+} cloglFlightRecOpt;
+
+/*
+ * io_uring文件输出类型的属性. 攒够一批交给内核异步写, 记日志的线程不等磁盘
+ */
+typedef struct _clogl_apd_uringfile_opt
+{
+	char *fileName;                   // 日志文件名
+	cloglFileOut out;                 // io_uring不可用时退回普通的批量写
+	time_t span;                      // 间隔秒数. 从小时转成秒
+	time_t now;                       // 当前日志文件产生的时间戳
+	int fsync;                        // 每批后面链一个fdatasync
+	struct _clogl_uring *ring;        // NULL 没有用io_uring
+} cloglUringFileOpt;
+
+/*
+ * 二进制日志文件输出类型的属性. 记录按块写, 每块带CRC, 用clogl-dump还原成文本
+ */
+typedef struct _clogl_apd_binfile_opt
+{
+	char *fileName;                   // 日志文件名
+	cloglFileOut out;                 // 当前打开的日志文件. 缓冲是正在攒的块, 开头留给块头
+	time_t span;                      // 间隔秒数. 从小时转成秒
+	time_t now;                       // 当前日志文件产生的时间戳
+	time_t next;                      // 下次换文件的时间. 打开时算好
+	pid_t pid;                        // 正在攒的块里的记录是哪个进程的
+	int64_t lastUs;                   // 块里上一条记录的时间, 微秒. 块里第一条存完整时间
+	struct _clogl_bin_site *sites;    // 块里已经定义过的调用处
+	unsigned int siteCap;             // sites大小. 2的幂
+	unsigned int siteCount;           // 块里定义了几个, 也是下一个编号
+	unsigned int gen;                 // 块序号. sites里不是这一块的都作废
+	clogMsg frame;                    // 编码一帧用的缓冲
+} cloglBinFileOpt;
+
 struct _clogl_apd;
 struct _clogl_logger;
+struct _clogl_rec;
+struct _clogl_layout;
 	
 /*
  * 一个日志格式
@@ -85,6 +205,7 @@ typedef struct _clogl_fmt
 {
 	char *name; // 格式名
 	char *(*format)(struct _clogl_logger *log, const char *format, va_list args);  // 格式化函数
+	const struct _clogl_layout *layout; // cloglAddLayout编译好的布局. 非NULL时按它格式化, 不用format
 } cloglFmt;
 
 /*
@@ -94,11 +215,36 @@ typedef struct _clogl_apd_type
 {
 	char *name;
 	int (*open)(struct _clogl_apd*);
-	int (*append)(struct _clogl_apd*, const char*);
+	int (*append)(struct _clogl_apd*, int priority, const char *msg, size_t len);
 	int (*close)(struct _clogl_apd*);
-	int (*event)(struct _clogl_apd*);
+	int (*event)(struct _clogl_apd*);                      // apd->deadline到了由调度线程调, 不加pLock. 自己加锁, 要重新cloglSchedAt. 可以为NULL
+	int (*flush)(struct _clogl_apd*);                      // 把缓冲的日志写出去. 可以为NULL
+	int (*init)(struct _clogl_apd*, const char *fileName); // 分配默认的opt. 可以为NULL
+	int (*set)(struct _clogl_apd*, const char *key, const char *value); // 设置opt里的属性. 可以为NULL
+	int lockFree;                                          // append自己保证线程安全, 写日志时不加pLock
+	int (*record)(struct _clogl_apd*, const struct _clogl_rec *rec, int err, const char *args, size_t len); // 不格式化, 直接写CLOGL_*宏的参数. 加pLock调. 可以为NULL
+	int (*sigWrite)(struct _clogl_apd*, const char *msg, size_t len); // 信号处理函数里调: 先写掉缓冲里的, 再直接写msg. msg为NULL只写缓冲. 不加锁, 只能用异步信号安全的函数. 可以为NULL
 } cloglApdT;
 
+/*
+ * 换下来的日志文件的压缩方式
+ */
+enum {
+	CLOGL_ZIP_NONE = 0,                       /* 不压缩 */
+	CLOGL_ZIP_GZ,                             /* zlib压缩成.gz. 没有用make ZLIB=1编译就用CLOGL_ZIP_LZ4 */
+	CLOGL_ZIP_LZ4,                            /* 自带的LZ4帧格式, .lz4 */
+};
+
+/*
+ * 输出方向忙(别的线程正在写)时怎么办. 不是block的先放进暂存缓冲, 写的线程写完自己的接着写暂存的
+ */
+enum {
+	CLOGL_OVERLOAD_BLOCK = 0,                 /* 等. 不丢日志 */
+	CLOGL_OVERLOAD_NEWEST,                    /* 暂存缓冲满了丢新来的 */
+	CLOGL_OVERLOAD_OLDEST,                    /* 暂存缓冲满了丢最早暂存的 */
+	CLOGL_OVERLOAD_SHED,                      /* 比shedLevel详细的暂存, 满了丢; shedLevel及以上等. ERR和DATA总是等 */
+};
+
 /*
  * 代表一个日志输出方向
  */
@@ -110,19 +256,95 @@ typedef struct _clogl_apd
 	cloglApdT *apdType;           // 一个类型的输出方向
 	cloglFmt *fmt;                // 该输出方向的格式
 	void *opt;                    // 不同类型输出方向的属性
+	size_t flushBytes;            // 刷新策略: 缓冲超过这么多字节就写. 0 每条日志都直接写
+	int flushMs;                  // 刷新策略: 缓冲里最早的日志超过这么多毫秒就写. 0 不按时间
+	int flushLevel;               // 刷新策略: ERR到这个级别的日志立即写(DATA不算). -1 不按级别
+	int64_t deadline;             // 下次要调event的时间. CLOCK_REALTIME毫秒, 0 不用调
+	int compress;                 // 换下来的文件怎么压缩. CLOGL_ZIP_*
+	int keepFiles;                // 保留策略: 最多留几个换下来的文件. 0 不限
+	off_t keepBytes;              // 保留策略: 换下来的文件最多共多少字节. 0 不限
+	time_t keepAge;               // 保留策略: 换下来的文件最多留多少秒. 0 不限
+	int dedupMs;                  // 合并连续重复的日志, 最多合并这么多毫秒. 0 不合并
+	int dupLevel;                 // 上一条日志的级别
+	uint64_t dupHash;             // 上一条日志去掉时间和pid tid以后的哈希. 0 没有
+	size_t dupLen;                // 上一条日志去掉时间和pid tid以后的长度
+	unsigned long dupCount;       // 上一条以后合并掉的条数
+	int64_t dupSince;             // 上一条的时间. CLOCK_REALTIME毫秒
+	struct _clogl_logger *dupLog; // 上一条的日志对象, 格式化汇总行用
+	int overload;                 // 忙时策略. CLOGL_OVERLOAD_*
+	int shedLevel;                // CLOGL_OVERLOAD_SHED时这个级别及以上不丢
+	size_t backlogBytes;          // 暂存缓冲字节数
+	struct _clogl_backlog *backlog; // 暂存缓冲. 第一次暂存时分配
+	unsigned long dropped[CLOGL_LEVEL_UNKNOWN]; // 各级别过载丢掉的条数, 报过就清零
+	int64_t dropSince;            // 上次报丢掉条数的时间. CLOCK_REALTIME毫秒
+	struct _clogl_logger *dropLog; // 最近丢日志的日志对象, 格式化报告行用
+	pthread_mutex_t  qLock;       // 暂存缓冲锁. 只锁拷贝
 	pthread_mutex_t  pLock;       // 线程锁
 	struct _clogl_apd *next;
 } cloglApd;
 
 /*
-  日志缓冲区结构
+ * 一个记日志的代码位置. CLOGL_*宏在每个调用处生成一个静态的
  */
-typedef struct _clog_msg
+typedef struct _clogl_site
 {
-	char *msgBuff;                // 输出日志信息缓冲区
-	size_t msgSize;               // 当前日志信息缓冲区大小
-} clogMsg;
-	
+	int level;                    // 日志级别
+	const char *file;             // 源文件名
+	int line;                     // 行号
+	const char *func;             // 函数名
+	const char *format;           // 日志格式. 静态字符串, 延迟格式化时只保存这个指针
+} cloglSite;
+
+/* 调用处开关 */
+#define CLOGL_DYN_DEFAULT     0   // 跟日志对象的级别
+#define CLOGL_DYN_ON          1   // 不管级别都输出
+#define CLOGL_DYN_OFF         2   // 不输出
+
+/*
+ * CLOGL_INFO/CLOGL_DEBUG和它们的限流抽样宏的调用处. 放在clogl_sites段里, cloglSiteSet按文件, 函数, 行号找
+ */
+typedef struct _clogl_dyn_site
+{
+	cloglSite site;
+	unsigned char state;          // CLOGL_DYN_*
+} cloglDynSite;
+
+/*
+ * 结构化日志的字段类型
+ */
+typedef enum
+{
+	CLOGL_FIELD_INT,                          /* int64_t */
+	CLOGL_FIELD_DOUBLE,                       /* double */
+	CLOGL_FIELD_STR,                          /* const char*. NULL输出null */
+	CLOGL_FIELD_BOOL                          /* int. 非0为true */
+} clogl_field_type;
+
+/*
+ * 结构化日志的一个字段. 只在调用期间有效, 不拷贝
+ */
+typedef struct _clogl_field
+{
+	const char *key;              // 字段名
+	int type;                     // clogl_field_type
+	union {
+		int64_t i;
+		double d;
+		const char *s;
+		int b;
+	} v;                          // 字段值
+} cloglField;
+
+/*
+ * 限流和抽样宏里每个调用处的状态. 静态变量, 各线程共用
+ */
+typedef struct _clogl_limit
+{
+	int64_t tat;                  // 限流: 下一条的理论到达时间(纳秒), GCRA
+	uint64_t seen;                // 抽样: 来过的条数
+	uint64_t dropped;             // 限流: 上次输出以后丢掉的条数
+} cloglLimit;
+
 /*
  * 代表一个日志对象
  */
@@ -131,7 +353,8 @@ typedef struct _clogl_logger
 	char *name;                   // 日志对象名称
 	int priority;                 // 输出级别
 	cloglApd *apds;               // 多个输出方向
-	pthread_key_t msgp;           // 日志缓冲区,各线程独立
+	int async;                    // 是否异步输出
+	int deferred;                 // 是否延迟格式化. 只对CLOGL_*宏有效
 	struct _clogl_logger *next;
 } clogl_t;
 
@@ -149,7 +372,7 @@ int cloglInit();
 
 /*
  * 功能:
- *    跟据配置文件里的日志名，获得一个日志对象指针
+ *    跟据配置文件里的日志名，获得一个日志对象指针. 按名字哈希, 不加锁
  * 入参:
  *    日志对象名
  * 出参:
@@ -159,6 +382,79 @@ int cloglInit();
  */
 clogl_t *cloglGet(const char *name);
 
+/*
+ * 功能:
+ *    新建一个没有输出方向的日志对象, 加到系统日志对象链中. 可以在多个线程里同时建和找
+ * 入参:
+ *    name:     日志对象名. 不能和已有的重复
+ *    priority: 输出级别
+ * 出参:
+ *    NO
+ * 返回值:
+ *    成功返回日志对象指针, 出错返回 NULL
+ */
+clogl_t *cloglNew(const char *name, int priority);
+
+/*
+ * 功能:
+ *    给日志对象加一个输出方向
+ * 入参:
+ *    log:      日志对象
+ *    name:     输出方向名
+ *    type:     输出方向类型名. "Console", "TimeFile", "HourFile", "MmapFile", "UringFile", "SizeFile", "BinFile", "FlightRecorder"
+ *    fmt:      日志格式名. "defFmt", "ptidFmt", "jsonFmt", 或cloglAddLayout加的
+ *    priority: 输出级别
+ *    fileName: 日志文件名. Console不用
+ * 出参:
+ *    NO
+ * 返回值:
+ *    成功返回输出方向指针, 出错返回 NULL
+ */
+cloglApd *cloglAddApd(clogl_t *log, const char *name, const char *type, const char *fmt, int priority, const char *fileName);
+
+/*
+ * 功能:
+ *    把布局串编译成一个日志格式, 以后cloglAddApd可以按名字用. 只在这里解析一次, 写日志时执行编译好的操作
+ *    %d 时间, 同defFmt; %d{...} strftime格式, 里面还可以用 %ms %us %ns 表示秒的小数. 结果超过127个字节的格式不收
+ *    %p 级别  %P 进程ID  %t 线程ID  %c 日志对象名  %F 源文件  %L 行号  %M 函数名  %m 日志信息  %% 百分号
+ *    转换前可以加宽度: %-5p 左对齐补到5个字符; %8.8M 右对齐补到8个, 最多8个
+ * 入参:
+ *    name:    格式名. 不能和已有的重复
+ *    pattern: 布局串, 如 "%d{%H:%M:%S.%us} %-5p [%t] %F:%L %m"
+ * 出参:
+ *    NO
+ * 返回值:
+ *    0 OR -1
+ */
+int cloglAddLayout(const char *name, const char *pattern);
+
+/*
+ * 功能:
+ *    设置输出方向类型特有的属性. 要在第一条日志之前设置
+ *    TimeFile/HourFile: "span" 换文件间隔小时数
+ *    MmapFile: "span" 换文件间隔小时数, 0 不换; "segment" 每段映射的兆数
+ *    FlightRecorder: "slotSize" 每个槽的字节数, 超长的日志截断; "slots" 槽数, 向上取2的幂
+ *    UringFile: "span" 换文件间隔小时数; "fsync" 1 每批写完fdatasync
+ *    SizeFile: "maxSize" 文件最大兆数; "backups" 保留的备份个数
+ *    BinFile: "span" 换文件间隔小时数, 0 不换
+ *    所有类型: "compress" 换下来的文件在后台压缩, "gz" "lz4" 或 "none". 只对TimeFile/HourFile/UringFile/BinFile有效
+ *              "keepFiles" 最多留几个换下来的文件; "keepMB" 换下来的文件最多共多少兆; "keepHours" 最多留多少小时. 0 不限
+ *              "dedupMs" 连续重复的日志只写第一条, 最多合并这么多毫秒后写"last message repeated N times". 0 不合并
+ *              "overload" 别的线程正在写时: "block" 等(默认); "dropNewest" 暂存, 满了丢新的; "dropOldest" 暂存, 满了丢最早暂存的;
+ *                         "shed" 比"shedLevel"(默认WARN)详细的暂存, 满了丢, 其余等. ERR和DATA总是等. MmapFile和FlightRecorder不用等, 不管这个
+ *              "backlogKB" 暂存缓冲的K数, 默认64. 丢掉的按级别计数, 暂存的写完后写一行"dropped N lines under overload (...)"
+ *              每次换文件后在后台线程里删多的, 大文件先分段截短再删
+ * 入参:
+ *    apd:   输出方向
+ *    key:   属性名
+ *    value: 属性值
+ * 出参:
+ *    NO
+ * 返回值:
+ *    0 OR -1
+ */
+int cloglApdSet(cloglApd *apd, const char *key, const char *value);
+
 /*
  * 功能:
  *    获得一个系统默认日志对象指针
@@ -184,6 +480,116 @@ clogl_t *cloglGetDft();
  */
 int setLogPriority(clogl_t *log, int p);
 
+/*
+ * 功能:
+ *    设置日志对象里文件输出方向的刷新策略. 默认每条日志一次write
+ *    三个条件满足任意一个就把缓冲的日志用一次writev写进文件
+ * 入参:
+ *    log:     日志对象
+ *    apdName: 输出方向名. NULL 所有输出方向
+ *    bytes:   缓冲超过这么多字节. 0 不缓冲, 每条都写
+ *    ms:      缓冲里最早的日志超过这么多毫秒(在事件线程里检查). 0 不按时间
+ *    level:   ERR到这个级别的日志立即写, 如CLOGL_LEVEL_ERR. -1 不按级别
+ * 出参:
+ *    NO
+ * 返回值:
+ *    0 OR -1
+ */
+int cloglSetFlush(clogl_t *log, const char *apdName, size_t bytes, int ms, int level);
+
+/*
+ * 功能:
+ *    设置日志时间的精度. 默认到秒
+ * 入参:
+ *    digits: 秒后面的位数. 0 秒, 3 毫秒, 6 微秒
+ * 出参:
+ *    NO
+ * 返回值:
+ *    0 OR -1
+ */
+int cloglSetTimePrecision(int digits);
+
+/*
+ * 功能:
+ *    设置ptidFmt格式里是否带线程名(pthread_setname_np设置的). 各线程第一次记日志时取名字并缓存, 改名后再调用一次可刷新
+ * 入参:
+ *    on: 1 带, 0 不带
+ * 出参:
+ *    NO
+ * 返回值:
+ *    0
+ */
+int cloglSetThreadName(int on);
+
+/*
+ * 功能:
+ *    设置后台压缩线程的CPU预算. 压缩线程nice 19, IO idle, 超过预算就睡
+ * 入参:
+ *    percent: 最多用一个CPU的百分之几. 1 - 100
+ * 出参:
+ *    NO
+ * 返回值:
+ *    0 OR -1
+ */
+int cloglSetZipBudget(int percent);
+
+/*
+ * 功能:
+ *    设置一个日志对象是否异步输出
+ *    异步模式下, 调用线程只把格式化好的日志拷贝进一个无锁队列, 由一个专门的写线程输出到各输出方向
+ * 入参:
+ *    log: 日志对象
+ *    on:  1 异步, 0 同步
+ * 出参:
+ *    NO
+ * 返回值:
+ *    0 OR -1
+ */
+int cloglSetAsync(clogl_t *log, int on);
+
+/*
+ * 功能:
+ *    等待调用前已经进入异步队列的日志全部输出, 并把各输出方向缓冲的日志写出去
+ * 入参:
+ *    NO
+ * 出参:
+ *    NO
+ * 返回值:
+ *    0 OR -1
+ */
+int cloglFlush();
+
+/*
+ * 功能:
+ *    设置一个日志对象是否延迟格式化
+ *    延迟格式化时, CLOGL_*宏只把格式指针和参数的原始字节拷进异步队列, 由写线程做vsnprintf和格式化. 打开后也是异步模式
+ *    参数必须在调用返回后仍然有效的只有格式串本身; %s参数会被拷贝. 含%n, %ls, 位置参数等的格式仍在调用线程格式化
+ * 入参:
+ *    log: 日志对象
+ *    on:  1 延迟格式化, 0 在调用线程格式化
+ * 出参:
+ *    NO
+ * 返回值:
+ *    0 OR -1
+ */
+int cloglSetDeferred(clogl_t *log, int on);
+
+/*
+ * 功能:
+ *    把"BinFile"输出方向写的二进制日志文件还原成文本, 和用fmt格式的文本输出方向写的一样
+ *    CRC不对的块(写了一半, 被改过)跳过, 从下一个块头接着读
+ *    "FlightRecorder"的文件按写的顺序输出环里还在的日志, 写了一半和被覆盖的槽算坏块. 不用fmt
+ * 入参:
+ *    fileName: 二进制日志文件名或飞行记录器文件名
+ *    out:      输出到哪
+ *    fmt:      日志格式名. "defFmt", "ptidFmt", "jsonFmt". NULL 用"ptidFmt"
+ * 出参:
+ *    NO
+ * 返回值:
+ *    跳过的坏块个数, 打不开文件返回 -1
+ */
+int cloglDump(const char *fileName, FILE *out, const char *fmt);
+
 /*
  * 功能:
  *    给用户调用的记录日志函数
@@ -196,7 +602,7 @@ int setLogPriority(clogl_t *log, int p);
  * 返回值:
  *    NO
  */
-void clogLogger(clogl_t *log, int priority, const char *format, ...);
+void clogLogger(clogl_t *log, int priority, const char *format, ...) CLOGL_COLD;
 
 /*
  * 功能：
@@ -210,21 +616,358 @@ void clogLogger(clogl_t *log, int priority, const char *format, ...);
  */
 clogl_level cloglLevel(const char *lvl);
 
-#if defined (CLOGL_SRC_INFO)
-#define CLOGL_DATA(logger, format, args...)  clogLogger(logger, CLOGL_LEVEL_DATA,  "[DATA] " format, ##args);
-#define CLOGL_ERR(logger, format, args...)   clogLogger(logger, CLOGL_LEVEL_ERR,   "[ERROR] <%s %d %s> " format, __FILE__, __LINE__, __FUNCTION__, ##args);
-#define CLOGL_WARN(logger, format, args...)  clogLogger(logger, CLOGL_LEVEL_WARN,  "[WARN] <%s %d %s> " format, __FILE__, __LINE__, __FUNCTION__, ##args);
-#define CLOGL_INFO(logger, format, args...)  clogLogger(logger, CLOGL_LEVEL_INFO,  "[INFO] <%s %d %s> " format, __FILE__, __LINE__, __FUNCTION__, ##args);
-#define CLOGL_DEBUG(logger, format, args...) clogLogger(logger, CLOGL_LEVEL_DEBUG, "[DEBUG] <%s %d %s> " format, __FILE__, __LINE__, __FUNCTION__, ##args);
+/*
+ * 功能:
+ *    按配置文件建立或修改日志对象, 格式和输出方向. 可以反复调, 每次按文件的内容改
+ *    级别, 格式和刷新策略原地改; 输出方向有增删或别的属性改了, 换一条新链, 写日志的线程不用等锁
+ *    有MmapFile或FlightRecorder输出方向的日志对象不换链, 只改级别和格式. 配置文件里删掉的日志对象不动
+ *    [format:名字]    pattern = 布局串
+ *    [logger:名字]    level = 级别  async = 0/1  deferred = 0/1
+ *    [appender:名字]  logger = 日志对象名  type = 类型  fmt = 格式名  level = 级别  file = 文件名
+ *                     flushBytes flushMs flushLevel 同cloglSetFlush, 其他键同cloglApdSet
+ * 入参:
+ *    fileName: 配置文件名
+ *    watch:    1 用inotify盯着文件, 改了就重新加载. 只能盯一个文件
+ * 出参:
+ *    NO
+ * 返回值:
+ *    0 OR -1. 出错的原因写到cloglErr, 原来的配置不变
+ */
+int cloglLoadConfig(const char *fileName, int watch);
+
+/*
+ * 功能:
+ *    CLOGL_*宏调用的记录日志函数. 级别和格式都在site里
+ * 入参:
+ *    log:  日志结构对象
+ *    site: 调用处信息
+ * 出参:
+ *    NO
+ * 返回值:
+ *    NO
+ */
+void clogLoggerSite(clogl_t *log, const cloglSite *site, ...) CLOGL_COLD;
+
+/*
+ * 功能:
+ *    cloglSiteSet打开了的调用处用的记录日志函数. 不管日志对象和输出方向的级别, 在调用线程格式化
+ * 入参:
+ *    log:  日志结构对象
+ *    site: 调用处信息
+ * 出参:
+ *    NO
+ * 返回值:
+ *    NO
+ */
+void clogLoggerForce(clogl_t *log, const cloglSite *site, ...) CLOGL_COLD;
+
+/*
+ * 功能:
+ *    按源文件, 函数, 行号打开或关闭CLOGL_INFO/CLOGL_DEBUG调用处(包括_RATELIMITED/_SAMPLED, 打开了还是限流), 不用改日志对象的级别
+ *    例: cloglSiteSet("net*.c", NULL, 0, CLOGL_DYN_ON) 只打开net模块的DEBUG日志
+ *    只管调用这个函数的程序本身链接进来的调用处, 动态库里的不管
+ * 入参:
+ *    file:  源文件名通配符, 比对完整路径或文件名. NULL或""不限
+ *    func:  函数名通配符. NULL或""不限
+ *    line:  行号. 0 不限
+ *    state: CLOGL_DYN_ON 不管级别都输出; CLOGL_DYN_OFF 不输出; CLOGL_DYN_DEFAULT 跟日志对象的级别
+ * 出参:
+ *    NO
+ * 返回值:
+ *    改了的调用处个数 OR -1
+ */
+int cloglSiteSet(const char *file, const char *func, int line, int state);
+
+/*
+ * 功能:
+ *    列出所有CLOGL_INFO/CLOGL_DEBUG调用处和开关, 一行一个: "文件:行号 [函数] 开关 级别 格式"
+ *    开关: = 跟级别, + 打开, - 关闭
+ * 入参:
+ *    out: 输出到这里
+ * 出参:
+ *    NO
+ * 返回值:
+ *    调用处个数 OR -1
+ */
+int cloglSiteDump(FILE *out);
+
+/*
+ * 功能:
+ *    在信号处理函数里记日志. 只用异步信号安全的函数: 格式化在栈上, 直接write各输出方向的文件, 不加锁
+ *    同一输出方向缓冲里还没写的日志先写掉. 还没打开的输出方向和BinFile不写; MmapFile当前段放不下就不写
+ *    日志格式固定为"时间 <pid tid> [级别] 消息", 不用输出方向的格式
+ * 入参:
+ *    log:    日志对象. NULL 所有日志对象
+ *    level:  日志级别
+ *    format: 只认 %d %i %u %x %p %s %c %%, 长度修饰 l ll z, 宽度和0填充. 最长CLOGL_SIG_BUFF字节
+ * 出参:
+ *    NO
+ * 返回值:
+ *    NO
+ */
+void cloglSigLog(clogl_t *log, int level, const char *format, ...);
+
+/*
+ * 功能:
+ *    安装或卸载致命信号(SIGSEGV SIGBUS SIGFPE SIGILL SIGABRT)处理函数. 收到时先等异步队列写完,
+ *    把所有输出方向缓冲里的日志写出去, 用cloglSigLog记信号和调用栈(地址), 带符号的调用栈写到stderr,
+ *    再交给安装前的处理方式(默认是结束进程并产生core)
+ *    栈溢出时用的备用栈只给调这个函数的线程
+ * 入参:
+ *    on: 1 安装, 0 恢复原来的
+ * 出参:
+ *    NO
+ * 返回值:
+ *    0 OR -1
+ */
+int cloglCrashHandler(int on);
+
+/*
+ * 功能:
+ *    记录一条结构化日志: 一句消息加上若干带类型的字段. 不做printf格式化, 不分配内存
+ *    "jsonFmt"格式输出成一行JSON, 其他格式在消息后面加上" key=value"
+ * 入参:
+ *    log:      日志结构对象
+ *    priority: 日志级别
+ *    msg:      消息. 原样输出, 不是格式串
+ *    fields:   字段数组
+ *    n:        字段个数
+ * 出参:
+ *    NO
+ * 返回值:
+ *    NO
+ */
+void clogLoggerKV(clogl_t *log, int priority, const char *msg, const cloglField *fields, int n) CLOGL_COLD;
+
+/*
+ * 功能:
+ *    CLOGL_KV宏调用的结构化日志函数. 级别和消息都在site里
+ * 入参:
+ *    log:    日志结构对象
+ *    site:   调用处信息. format是消息
+ *    fields: 字段数组
+ *    n:      字段个数
+ * 出参:
+ *    NO
+ * 返回值:
+ *    NO
+ */
+void clogLoggerKVSite(clogl_t *log, const cloglSite *site, const cloglField *fields, int n) CLOGL_COLD;
+
+/*
+ * 功能:
+ *    限流和抽样宏放行一条日志时, 带上前面丢掉的条数. 在调用线程格式化, 后面加" suppressed=N"
+ * 入参:
+ *    log:     日志结构对象
+ *    site:    调用处信息
+ *    dropped: 丢掉的条数
+ * 出参:
+ *    NO
+ * 返回值:
+ *    NO
+ */
+void clogLoggerDropped(clogl_t *log, const cloglSite *site, long dropped, ...) CLOGL_COLD;
+
+/*
+ * 宏里先判断级别, 过滤掉的日志不求值参数, 也不调函数
+ */
+static inline int cloglEnabled(const clogl_t *log, int level)
+{
+	return log && log->priority >= level;
+}
+
+/*
+ * INFO DEBUG在线上一般是关着的, 提示编译器按不进去排; ERR WARN DATA一般开着, 不提示
+ * 宏里logger只求值一次, 先放进_cloglLog
+ */
+#define CLOGL_ENABLED(log, lvl) ((lvl) >= CLOGL_LEVEL_INFO ? CLOGL_UNLIKELY(cloglEnabled(log, lvl)) : cloglEnabled(log, lvl))
+
+#define CLOGL_SITE(logger, lvl, format, args...) do { \
+	clogl_t *_cloglLog = (logger); \
+	if (CLOGL_ENABLED(_cloglLog, lvl)) { \
+		static const cloglSite _cloglSite = {lvl, __FILE__, __LINE__, __FUNCTION__, format}; \
+		clogLoggerSite(_cloglLog, &_cloglSite, ##args); \
+	} \
+} while (0)
+
+/*
+ * 限流: 每秒最多perSec条, 最多一下子来perSec条. 放行返回上次放行以后丢掉的条数, 不放行返回-1
+ * 用粗粒度的单调时钟, 只有一次CAS
+ */
+static inline long cloglLimitRate(cloglLimit *lim, unsigned perSec)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	int64_t now = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+	int64_t step = perSec ? 1000000000LL / perSec : 0;
+	int64_t burst = step * perSec;
+	int64_t tat = __atomic_load_n(&lim->tat, __ATOMIC_RELAXED);
+	int64_t next;
+	do {
+		next = ((tat > now) ? tat : now) + step;
+		if (!perSec || next - now > burst) {
+			__atomic_add_fetch(&lim->dropped, 1, __ATOMIC_RELAXED);
+			return -1;
+		}
+	} while (!__atomic_compare_exchange_n(&lim->tat, &tat, next, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+	return __atomic_load_n(&lim->dropped, __ATOMIC_RELAXED) ? (long)__atomic_exchange_n(&lim->dropped, 0, __ATOMIC_RELAXED) : 0;
+}
+
+/*
+ * 抽样: 每n条放行第一条. 返回值同cloglLimitRate. 放行的两条之间正好丢n-1条, 只要一次原子加
+ */
+static inline long cloglLimitSample(cloglLimit *lim, unsigned n)
+{
+	if (n <= 1) {
+		return 0;
+	}
+
+	uint64_t seen = __atomic_fetch_add(&lim->seen, 1, __ATOMIC_RELAXED);
+	if (seen % n) {
+		return -1;
+	}
+
+	return seen ? (long)(n - 1) : 0;
+}
+
+/* check是cloglLimitRate或cloglLimitSample. 过了级别才算进限流 */
+#define CLOGL_SITE_LIMITED(logger, lvl, check, arg, format, args...) do { \
+	clogl_t *_cloglLog = (logger); \
+	if (CLOGL_ENABLED(_cloglLog, lvl)) { \
+		static const cloglSite _cloglSite = {lvl, __FILE__, __LINE__, __FUNCTION__, format}; \
+		static cloglLimit _cloglLimit; \
+		long _cloglDropped = check(&_cloglLimit, arg); \
+		if (0 == _cloglDropped) \
+			clogLoggerSite(_cloglLog, &_cloglSite, ##args); \
+		else if (_cloglDropped > 0) \
+			clogLoggerDropped(_cloglLog, &_cloglSite, _cloglDropped, ##args); \
+	} \
+} while (0)
+
+/*
+ * 可以用cloglSiteSet单独开关的调用处. 开关是一个字节, 关了的只多一次判断
+ */
+#define CLOGL_DYN(logger, lvl, format, args...) do { \
+	static cloglDynSite _cloglDyn __attribute__((section("clogl_sites"), aligned(8), used)) = {{lvl, __FILE__, __LINE__, __FUNCTION__, format}, CLOGL_DYN_DEFAULT}; \
+	clogl_t *_cloglLog = (logger); \
+	unsigned char _cloglState = __atomic_load_n(&_cloglDyn.state, __ATOMIC_RELAXED); \
+	if (CLOGL_UNLIKELY(_cloglState)) { \
+		if (CLOGL_DYN_ON == _cloglState) \
+			clogLoggerForce(_cloglLog, &_cloglDyn.site, ##args); \
+	} else if (CLOGL_ENABLED(_cloglLog, lvl)) { \
+		clogLoggerSite(_cloglLog, &_cloglDyn.site, ##args); \
+	} \
+} while (0)
+
+/*
+ * INFO DEBUG的限流抽样宏也放在clogl_sites里, 可以用cloglSiteSet单独开关. 打开了的不看级别, 但还是限流
+ */
+#define CLOGL_DYN_LIMITED(logger, lvl, check, arg, format, args...) do { \
+	static cloglDynSite _cloglDyn __attribute__((section("clogl_sites"), aligned(8), used)) = {{lvl, __FILE__, __LINE__, __FUNCTION__, format}, CLOGL_DYN_DEFAULT}; \
+	clogl_t *_cloglLog = (logger); \
+	unsigned char _cloglState = __atomic_load_n(&_cloglDyn.state, __ATOMIC_RELAXED); \
+	if (CLOGL_UNLIKELY(_cloglState) ? CLOGL_DYN_ON == _cloglState : CLOGL_ENABLED(_cloglLog, lvl)) { \
+		static cloglLimit _cloglLimit; \
+		long _cloglDropped = check(&_cloglLimit, arg); \
+		if (0 == _cloglDropped) { \
+			if (_cloglState) \
+				clogLoggerForce(_cloglLog, &_cloglDyn.site, ##args); \
+			else \
+				clogLoggerSite(_cloglLog, &_cloglDyn.site, ##args); \
+		} else if (_cloglDropped > 0) { \
+			clogLoggerDropped(_cloglLog, &_cloglDyn.site, _cloglDropped, ##args); \
+		} \
+	} \
+} while (0)
+
+/* 编译时去掉的级别. if (0)里的参数不会求值, 只是让编译器看到变量被用了 */
+#define CLOGL_NONE(logger, format, args...) do { \
+	if (0) { \
+		clogLoggerSite(logger, (const cloglSite *)0, format, ##args); \
+	} \
+} while (0)
+
+#define CLOGL_DATA(logger, format, args...)  CLOGL_SITE(logger, CLOGL_LEVEL_DATA,  format, ##args)
+
+#if CLOGL_MIN_LEVEL >= 1
+#define CLOGL_ERR(logger, format, args...)   CLOGL_SITE(logger, CLOGL_LEVEL_ERR,   format, ##args)
+#else
+#define CLOGL_ERR(logger, format, args...)   CLOGL_NONE(logger, format, ##args)
+#endif
+
+#if CLOGL_MIN_LEVEL >= 2
+#define CLOGL_WARN(logger, format, args...)  CLOGL_SITE(logger, CLOGL_LEVEL_WARN,  format, ##args)
+#else
+#define CLOGL_WARN(logger, format, args...)  CLOGL_NONE(logger, format, ##args)
+#endif
+
+#if CLOGL_MIN_LEVEL >= 3
+#define CLOGL_INFO(logger, format, args...)  CLOGL_DYN(logger, CLOGL_LEVEL_INFO,  format, ##args)
+#else
+#define CLOGL_INFO(logger, format, args...)  CLOGL_NONE(logger, format, ##args)
+#endif
+
+#if CLOGL_MIN_LEVEL >= 4
+#define CLOGL_DEBUG(logger, format, args...) CLOGL_DYN(logger, CLOGL_LEVEL_DEBUG, format, ##args)
+#else
+#define CLOGL_DEBUG(logger, format, args...) CLOGL_NONE(logger, format, ##args)
+#endif
+
+/* 例: CLOGL_ERR_RATELIMITED(log, 10, "read %s error", path); 每秒最多10条. CLOGL_INFO_SAMPLED(log, 100, ...); 每100条输出1条 */
+#define CLOGL_DATA_RATELIMITED(logger, perSec, format, args...)  CLOGL_SITE_LIMITED(logger, CLOGL_LEVEL_DATA,  cloglLimitRate,   perSec, format, ##args)
+#define CLOGL_DATA_SAMPLED(logger, n, format, args...)           CLOGL_SITE_LIMITED(logger, CLOGL_LEVEL_DATA,  cloglLimitSample, n,      format, ##args)
+
+#if CLOGL_MIN_LEVEL >= 1
+#define CLOGL_ERR_RATELIMITED(logger, perSec, format, args...)   CLOGL_SITE_LIMITED(logger, CLOGL_LEVEL_ERR,   cloglLimitRate,   perSec, format, ##args)
+#define CLOGL_ERR_SAMPLED(logger, n, format, args...)            CLOGL_SITE_LIMITED(logger, CLOGL_LEVEL_ERR,   cloglLimitSample, n,      format, ##args)
+#else
+#define CLOGL_ERR_RATELIMITED(logger, perSec, format, args...)   CLOGL_NONE(logger, format, ##args)
+#define CLOGL_ERR_SAMPLED(logger, n, format, args...)            CLOGL_NONE(logger, format, ##args)
+#endif
+
+#if CLOGL_MIN_LEVEL >= 2
+#define CLOGL_WARN_RATELIMITED(logger, perSec, format, args...)  CLOGL_SITE_LIMITED(logger, CLOGL_LEVEL_WARN,  cloglLimitRate,   perSec, format, ##args)
+#define CLOGL_WARN_SAMPLED(logger, n, format, args...)           CLOGL_SITE_LIMITED(logger, CLOGL_LEVEL_WARN,  cloglLimitSample, n,      format, ##args)
+#else
+#define CLOGL_WARN_RATELIMITED(logger, perSec, format, args...)  CLOGL_NONE(logger, format, ##args)
+#define CLOGL_WARN_SAMPLED(logger, n, format, args...)           CLOGL_NONE(logger, format, ##args)
+#endif
+
+#if CLOGL_MIN_LEVEL >= 3
+#define CLOGL_INFO_RATELIMITED(logger, perSec, format, args...)  CLOGL_DYN_LIMITED(logger, CLOGL_LEVEL_INFO,  cloglLimitRate,   perSec, format, ##args)
+#define CLOGL_INFO_SAMPLED(logger, n, format, args...)           CLOGL_DYN_LIMITED(logger, CLOGL_LEVEL_INFO,  cloglLimitSample, n,      format, ##args)
+#else
+#define CLOGL_INFO_RATELIMITED(logger, perSec, format, args...)  CLOGL_NONE(logger, format, ##args)
+#define CLOGL_INFO_SAMPLED(logger, n, format, args...)           CLOGL_NONE(logger, format, ##args)
+#endif
+
+#if CLOGL_MIN_LEVEL >= 4
+#define CLOGL_DEBUG_RATELIMITED(logger, perSec, format, args...) CLOGL_DYN_LIMITED(logger, CLOGL_LEVEL_DEBUG, cloglLimitRate,   perSec, format, ##args)
+#define CLOGL_DEBUG_SAMPLED(logger, n, format, args...)          CLOGL_DYN_LIMITED(logger, CLOGL_LEVEL_DEBUG, cloglLimitSample, n,      format, ##args)
 #else
-#define CLOGL_DATA(logger, format, args...)  clogLogger(logger, CLOGL_LEVEL_DATA,  "[DATA] " format, ##args);
-#define CLOGL_ERR(logger, format, args...)   clogLogger(logger, CLOGL_LEVEL_ERR,   "[ERROR] <%d %s> " format, __LINE__, __FUNCTION__, ##args);
-#define CLOGL_WARN(logger, format, args...)  clogLogger(logger, CLOGL_LEVEL_WARN,  "[WARN] <%d %s> " format, __LINE__, __FUNCTION__, ##args);
-#define CLOGL_INFO(logger, format, args...)  clogLogger(logger, CLOGL_LEVEL_INFO,  "[INFO] <%d %s> " format, __LINE__, __FUNCTION__, ##args);
-#define CLOGL_DEBUG(logger, format, args...) clogLogger(logger, CLOGL_LEVEL_DEBUG, "[DEBUG] <%d %s> " format, __LINE__, __FUNCTION__, ##args);
+#define CLOGL_DEBUG_RATELIMITED(logger, perSec, format, args...) CLOGL_NONE(logger, format, ##args)
+#define CLOGL_DEBUG_SAMPLED(logger, n, format, args...)          CLOGL_NONE(logger, format, ##args)
 #endif
 
 
+/* 结构化日志的字段. 用在CLOGL_KV里或者cloglField数组的初始化里 */
+#define CLOGL_INT(key, val)   {key, CLOGL_FIELD_INT,    {.i = (int64_t)(val)}}
+#define CLOGL_DBL(key, val)   {key, CLOGL_FIELD_DOUBLE, {.d = (double)(val)}}
+#define CLOGL_STR(key, val)   {key, CLOGL_FIELD_STR,    {.s = (val)}}
+#define CLOGL_BOOL(key, val)  {key, CLOGL_FIELD_BOOL,   {.b = !!(val)}}
+
+/* 例: CLOGL_KV(log, CLOGL_LEVEL_INFO, "login", CLOGL_STR("user", name), CLOGL_INT("uid", uid)); */
+#define CLOGL_KV(logger, lvl, msg, fields...) do { \
+	clogl_t *_cloglLog = (logger); \
+	if (CLOGL_ENABLED(_cloglLog, lvl)) { \
+		static const cloglSite _cloglSite = {lvl, __FILE__, __LINE__, __FUNCTION__, msg}; \
+		const cloglField _cloglFields[] = {fields}; \
+		clogLoggerKVSite(_cloglLog, &_cloglSite, _cloglFields, sizeof(_cloglFields) / sizeof(_cloglFields[0])); \
+	} \
+} while (0)
+
+
 #if defined (__cplusplus)
 }   
 #endif /* defined (__cplusplus) */
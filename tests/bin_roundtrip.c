@@ -0,0 +1,67 @@
+/*
+ * BinFile往返: 同一批日志同时写BinFile和文本文件, 用cloglDump把BinFile还原成文本, 要和文本文件一模一样
+ */
+#include <limits.h>
+#include "check.h"
+
+static void logAll(clogl_t *log)
+{
+	int i = 0;
+	for (i = 0; i < 200; i++) {
+		CLOGL_INFO(log, "round %d of %u hex %x %#X oct %o", i, 200u, i * 17, i * 255, i);
+		CLOGL_WARN(log, "long %ld %lld %lld size %zu diff %td", -1L * i, LLONG_MIN, LLONG_MAX, (size_t)i * 4096, (ptrdiff_t)-i);
+		CLOGL_ERR(log, "str [%s] [%-8s] [%8s] [%.3s] [%s] char %c", "hello", "left", "right", "truncated", (const char *)0, 'A' + i % 26);
+		CLOGL_INFO(log, "float %f %.3f %e %g %10.2f %Lf", i / 7.0, -i / 3.0, i * 1e10, i / 1000.0, i * 1.5, (long double)i / 9);
+		CLOGL_INFO(log, "star [%*d] [%-*d] [%.*s] pct %%", 6, i, 6, i, 2, "abcdef");
+	}
+	CLOGL_DEBUG(log, "no args");
+	errno = ENOENT;
+	CLOGL_INFO(log, "errno %m");
+}
+
+int main()
+{
+	char dir[64];
+	if (!checkTmpDir(dir, sizeof(dir))) {
+		perror("mkdtemp");
+		return 1;
+	}
+	char binName[128], textName[128], dumpName[128];
+	snprintf(binName, sizeof(binName), "%s/b.bin", dir);
+	snprintf(textName, sizeof(textName), "%s/t.log", dir);
+	snprintf(dumpName, sizeof(dumpName), "%s/d.log", dir);
+
+	CHECK(0 == cloglInit(), "cloglInit");
+	CHECK(0 == cloglAddLayout("noTime", "%p <%F:%L %M> %m"), "cloglAddLayout");
+	clogl_t *log = cloglNew("bin", CLOGL_LEVEL_DEBUG);
+	CHECK(log, "cloglNew");
+	CHECK(cloglAddApd(log, "bin", "BinFile", "noTime", CLOGL_LEVEL_DEBUG, binName), "BinFile");
+	CHECK(cloglAddApd(log, "text", "TimeFile", "noTime", CLOGL_LEVEL_DEBUG, textName), "TimeFile");
+	if (checkFails) {
+		return checkDone("bin_roundtrip");
+	}
+
+	logAll(log);
+	CHECK(0 == cloglFlush(), "cloglFlush");
+
+	FILE *out = fopen(dumpName, "w");
+	CHECK(out, "open %s", dumpName);
+	if (out) {
+		CHECK(0 == cloglDump(binName, out, "noTime"), "cloglDump skipped blocks");
+		fclose(out);
+	}
+
+	char *text = checkReadFile(textName, NULL);
+	char *dump = checkReadFile(dumpName, NULL);
+	CHECK(text && dump, "read %s %s", textName, dumpName);
+	if (text && dump) {
+		CHECK(1002 == checkLines(textName), "text lines %ld", checkLines(textName));
+		CHECK(0 == checkSameLines("text", text, "dump", dump), "text and dump differ");
+	}
+	free(text);
+	free(dump);
+
+	checkRmDir(dir);
+
+	return checkDone("bin_roundtrip");
+}
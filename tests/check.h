@@ -0,0 +1,140 @@
+/*
+ * 测试程序共用的检查和小工具. 每个测试是一个独立的程序, 全过返回0
+ */
+#ifndef CLOGL_CHECK_H
+#define CLOGL_CHECK_H
+
+#include "clogl.h"
+
+static int checkFails;
+
+#define CHECK(cond, fmt, args...) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: FAIL: " fmt "\n", __FILE__, __LINE__, ##args); \
+		checkFails ++; \
+	} \
+} while (0)
+
+/*
+  建一个临时目录, 测试写的文件都放在里面
+ */
+static inline char *checkTmpDir(char *dir, size_t size)
+{
+	snprintf(dir, size, "/tmp/clogl-test-XXXXXX");
+	return mkdtemp(dir);
+}
+
+/*
+  删掉临时目录和里面的文件. 测试只在里面建普通文件
+ */
+static inline void checkRmDir(const char *dir)
+{
+	char cmd[512];
+	snprintf(cmd, sizeof(cmd), "rm -rf '%s'", dir);
+	(void)system(cmd);
+}
+
+/*
+  读整个文件, 返回malloc的内容, 结尾补0. 打不开返回NULL
+ */
+static inline char *checkReadFile(const char *fileName, size_t *len)
+{
+	FILE *fp = fopen(fileName, "rb");
+	if (!fp) {
+		return NULL;
+	}
+
+	size_t size = 0, cap = 4096;
+	char *buf = (char *)malloc(cap);
+	while (buf) {
+		size_t n = fread(buf + size, 1, cap - size - 1, fp);
+		size += n;
+		if (n == 0) {
+			break;
+		}
+		if (size + 1 >= cap) {
+			char *tmp = (char *)realloc(buf, cap * 2);
+			if (!tmp) {
+				free(buf);
+				buf = NULL;
+				break;
+			}
+			buf = tmp;
+			cap *= 2;
+		}
+	}
+	fclose(fp);
+	if (buf) {
+		buf[size] = 0;
+		if (len) {
+			*len = size;
+		}
+	}
+
+	return buf;
+}
+
+/*
+  数文件里的行. 打不开返回-1
+ */
+static inline long checkLines(const char *fileName)
+{
+	char *buf = checkReadFile(fileName, NULL);
+	if (!buf) {
+		return -1;
+	}
+
+	long n = 0;
+	for (char *p = buf; (p = strchr(p, '\n')); p++)
+		n ++;
+	free(buf);
+
+	return n;
+}
+
+/*
+  逐行比两段文本, 行尾的\r不算(文本输出方向写\r\n, cloglDump写\n). 一样返回0, 不一样报出第一行不一样的
+ */
+static inline int checkSameLines(const char *aName, const char *a, const char *bName, const char *b)
+{
+	long line = 1;
+	while (*a || *b) {
+		const char *ae = strchr(a, '\n');
+		const char *be = strchr(b, '\n');
+		if (!ae) {
+			ae = a + strlen(a);
+		}
+		if (!be) {
+			be = b + strlen(b);
+		}
+		size_t al = ae - a, bl = be - b;
+		if (al && '\r' == a[al - 1]) {
+			al --;
+		}
+		if (bl && '\r' == b[bl - 1]) {
+			bl --;
+		}
+		if (al != bl || memcmp(a, b, al)) {
+			fprintf(stderr, "line %ld differs:\n  %s: %.*s\n  %s: %.*s\n", line, aName, (int)al, a, bName, (int)bl, b);
+			return -1;
+		}
+		a = *ae ? ae + 1 : ae;
+		b = *be ? be + 1 : be;
+		line ++;
+	}
+
+	return 0;
+}
+
+static inline int checkDone(const char *name)
+{
+	if (checkFails) {
+		fprintf(stderr, "%s: %d check(s) failed\n", name, checkFails);
+		return 1;
+	}
+	printf("%s: ok\n", name);
+
+	return 0;
+}
+
+#endif // CLOGL_CHECK_H
@@ -0,0 +1,66 @@
+/*
+ * 合并重复日志: 同步和异步写都不比开头的时间和pid tid, 跨秒的相同日志也要合并成一条加一行汇总
+ */
+#include "check.h"
+
+#define REPEATS 5
+
+/*
+  检查一个文件: 第一条日志加一行"last message repeated N times"
+ */
+static void checkFile(const char *fileName)
+{
+	char *buf = checkReadFile(fileName, NULL);
+	CHECK(buf, "read %s", fileName);
+	if (!buf) {
+		return;
+	}
+
+	long n = checkLines(fileName);
+	CHECK(2 == n, "%s: %ld lines", fileName, n);
+	char *p = strstr(buf, "same message");
+	CHECK(p && !strstr(p + 1, "same message"), "%s: message not written exactly once", fileName);
+	CHECK(strstr(buf, "last message repeated 4 times"), "%s: no summary line", fileName);
+	free(buf);
+}
+
+int main()
+{
+	char dir[64];
+	if (!checkTmpDir(dir, sizeof(dir))) {
+		perror("mkdtemp");
+		return 1;
+	}
+	char syncName[128], asyncName[128];
+	snprintf(syncName, sizeof(syncName), "%s/s.log", dir);
+	snprintf(asyncName, sizeof(asyncName), "%s/a.log", dir);
+
+	CHECK(0 == cloglInit(), "cloglInit");
+	clogl_t *s = cloglNew("sync", CLOGL_LEVEL_DEBUG);
+	clogl_t *a = cloglNew("async", CLOGL_LEVEL_DEBUG);
+	CHECK(s && a, "cloglNew");
+	cloglApd *sApd = cloglAddApd(s, "s", "TimeFile", "ptidFmt", CLOGL_LEVEL_DEBUG, syncName);
+	cloglApd *aApd = cloglAddApd(a, "a", "TimeFile", "ptidFmt", CLOGL_LEVEL_DEBUG, asyncName);
+	CHECK(sApd && aApd, "TimeFile");
+	if (checkFails) {
+		return checkDone("dedup_async");
+	}
+	CHECK(0 == cloglApdSet(sApd, "dedupMs", "5000"), "sync dedupMs");
+	CHECK(0 == cloglApdSet(aApd, "dedupMs", "5000"), "async dedupMs");
+	CHECK(0 == cloglSetAsync(a, 1), "cloglSetAsync");
+
+	// 隔300毫秒写一次, 中间一定跨秒, 开头的时间不一样
+	for (int i = 0; i < REPEATS; i++) {
+		CLOGL_ERR(s, "same message");
+		CLOGL_ERR(a, "same message");
+		usleep(300000);
+	}
+	CHECK(0 == cloglFlush(), "cloglFlush");
+
+	checkFile(syncName);
+	checkFile(asyncName);
+
+	checkRmDir(dir);
+
+	return checkDone("dedup_async");
+}
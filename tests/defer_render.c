@@ -0,0 +1,79 @@
+/*
+ * 延迟格式化: 写日志的线程只保存参数, 异步写线程用cloglArgsRender还原. 结果要和当场vsnprintf的一样
+ * 两个日志对象写同样的日志, 一个同步一个延迟格式化, 比两个文件
+ */
+#include <limits.h>
+#include <float.h>
+#include "check.h"
+
+#define LOG_BOTH(sync, deferred, format, args...) do { \
+	CLOGL_INFO(sync, format, ##args); \
+	CLOGL_INFO(deferred, format, ##args); \
+} while (0)
+
+static void logAll(clogl_t *s, clogl_t *d)
+{
+	static int local;
+	int i = 0;
+	for (i = -50; i < 50; i++) {
+		LOG_BOTH(s, d, "int %d %i %u %x %X %o %c|", i, i * 1000, (unsigned)i, i, i, i & 0777, 'a' + (i & 15));
+		LOG_BOTH(s, d, "flags [%+d] [% d] [%05d] [%-5d] [%#x] [%#o]", i, i, i, i, i & 0xff, i & 0777);
+		LOG_BOTH(s, d, "sizes %hd %hhu %ld %lu %lld %llu %zu %zd %jd %td", (short)(i * 999), (unsigned char)i, (long)i * 1048576,
+		         (unsigned long)i, (long long)i * 1099511627776LL, (unsigned long long)i, (size_t)i, (ssize_t)i, (intmax_t)i, (ptrdiff_t)i);
+		LOG_BOTH(s, d, "float %f %.0f %.10f %e %E %g %G %a %8.3f %-8.3f|", i / 3.0, i / 3.0, i / 7.0, i * 1e-5, i * 1e300,
+		         i / 9.0, i * 1e20, i / 4.0, i / 3.0, i / 3.0);
+		LOG_BOTH(s, d, "long double %Lf %Le %Lg", (long double)i / 3, (long double)i * 1e100L, (long double)i / 7);
+		LOG_BOTH(s, d, "str [%s] [%10s] [%-10s] [%.2s] [%*s] [%.*s]", "abc", "right", "left", "cut", 4, "w", i & 7, "precision");
+	}
+	LOG_BOTH(s, d, "limits %d %d %u %ld %ld %lld %llu", INT_MIN, INT_MAX, UINT_MAX, LONG_MIN, LONG_MAX, LLONG_MIN, ULLONG_MAX);
+	LOG_BOTH(s, d, "double limits %g %g %g %e", DBL_MAX, DBL_MIN, -0.0, DBL_EPSILON);
+	LOG_BOTH(s, d, "null [%s] pointer %p %p", (const char *)0, (void *)&local, (void *)0);
+	LOG_BOTH(s, d, "percent %% and nothing else");
+	LOG_BOTH(s, d, "empty string [%s]", "");
+	errno = EACCES;
+	CLOGL_INFO(s, "errno %m");
+	errno = EACCES;
+	CLOGL_INFO(d, "errno %m");
+}
+
+int main()
+{
+	char dir[64];
+	if (!checkTmpDir(dir, sizeof(dir))) {
+		perror("mkdtemp");
+		return 1;
+	}
+	char syncName[128], deferName[128];
+	snprintf(syncName, sizeof(syncName), "%s/s.log", dir);
+	snprintf(deferName, sizeof(deferName), "%s/d.log", dir);
+
+	CHECK(0 == cloglInit(), "cloglInit");
+	CHECK(0 == cloglAddLayout("msgOnly", "%m"), "cloglAddLayout");
+	clogl_t *s = cloglNew("sync", CLOGL_LEVEL_DEBUG);
+	clogl_t *d = cloglNew("deferred", CLOGL_LEVEL_DEBUG);
+	CHECK(s && d, "cloglNew");
+	CHECK(cloglAddApd(s, "s", "TimeFile", "msgOnly", CLOGL_LEVEL_DEBUG, syncName), "sync TimeFile");
+	CHECK(cloglAddApd(d, "d", "TimeFile", "msgOnly", CLOGL_LEVEL_DEBUG, deferName), "deferred TimeFile");
+	CHECK(0 == cloglSetAsync(d, 1), "cloglSetAsync");
+	CHECK(0 == cloglSetDeferred(d, 1), "cloglSetDeferred");
+	if (checkFails) {
+		return checkDone("defer_render");
+	}
+
+	logAll(s, d);
+	CHECK(0 == cloglFlush(), "cloglFlush");
+
+	char *sync = checkReadFile(syncName, NULL);
+	char *defer = checkReadFile(deferName, NULL);
+	CHECK(sync && defer, "read %s %s", syncName, deferName);
+	if (sync && defer) {
+		CHECK(606 == checkLines(syncName), "sync lines %ld", checkLines(syncName));
+		CHECK(0 == checkSameLines("vsnprintf", sync, "deferred", defer), "vsnprintf and deferred differ");
+	}
+	free(sync);
+	free(defer);
+
+	checkRmDir(dir);
+
+	return checkDone("defer_render");
+}
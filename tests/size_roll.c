@@ -0,0 +1,108 @@
+/*
+ * SizeFile换文件: 写满maxSize以后由事件线程换文件, 备份往后挪, 多出来的删掉, 日志一条不丢也不乱
+ */
+#include "check.h"
+
+#define LINES   60000                 // 每行100字节左右, 一共6兆左右
+#define BACKUPS 2
+
+/*
+  按名字把每个文件里的序号收起来. 返回这个文件的行数, 打不开返回-1
+ */
+static long collect(const char *fileName, char *seen, long *first, long *last)
+{
+	char *buf = checkReadFile(fileName, NULL);
+	if (!buf) {
+		return -1;
+	}
+
+	long n = 0;
+	*first = -1;
+	*last = -1;
+	for (char *p = buf; (p = strstr(p, "seq=")); ) {
+		long seq = strtol(p + 4, &p, 10);
+		if (seq >= 0 && seq < LINES) {
+			seen[seq] ++;
+		}
+		if (*first < 0) {
+			*first = seq;
+		}
+		CHECK(seq > *last, "%s: seq %ld after %ld", fileName, seq, *last);
+		*last = seq;
+		n ++;
+	}
+	free(buf);
+
+	return n;
+}
+
+int main()
+{
+	char dir[64];
+	if (!checkTmpDir(dir, sizeof(dir))) {
+		perror("mkdtemp");
+		return 1;
+	}
+	char fileName[128], name[160];
+	snprintf(fileName, sizeof(fileName), "%s/s.log", dir);
+
+	CHECK(0 == cloglInit(), "cloglInit");
+	clogl_t *log = cloglNew("size", CLOGL_LEVEL_DEBUG);
+	CHECK(log, "cloglNew");
+	cloglApd *apd = cloglAddApd(log, "s", "SizeFile", "ptidFmt", CLOGL_LEVEL_DEBUG, fileName);
+	CHECK(apd, "SizeFile");
+	if (checkFails) {
+		return checkDone("size_roll");
+	}
+	CHECK(0 == cloglApdSet(apd, "maxSize", "1"), "maxSize");
+	CHECK(0 == cloglApdSet(apd, "backups", "2"), "backups");
+	CHECK(-1 == cloglApdSet(apd, "maxSize", "0"), "maxSize 0 accepted");
+
+	// 写得慢一点, 事件线程来得及换文件
+	for (long i = 0; i < LINES; i++) {
+		CLOGL_INFO(log, "seq=%ld padding padding padding padding padding padding", i);
+		if (0 == i % 2000) {
+			usleep(20000);
+		}
+	}
+	CHECK(0 == cloglFlush(), "cloglFlush");
+
+	// 只剩fileName和BACKUPS个备份, 按name.N ... name.1, name的顺序序号递增, 最后一条在fileName里
+	char *seen = (char *)calloc(LINES, 1);
+	long prevLast = -1, total = 0;
+	for (int i = BACKUPS; i >= 0; i--) {
+		if (i) {
+			snprintf(name, sizeof(name), "%s.%d", fileName, i);
+		} else {
+			snprintf(name, sizeof(name), "%s", fileName);
+		}
+		long first = -1, last = -1;
+		long n = collect(name, seen, &first, &last);
+		// 最后一条正好写满时刚换过文件, 当前文件可以是空的
+		CHECK(n > 0 || (0 == i && 0 == n), "%s: %ld lines", name, n);
+		if (n <= 0) {
+			continue;
+		}
+		CHECK(first == prevLast + 1 || prevLast < 0, "%s starts at %ld, previous file ended at %ld", name, first, prevLast);
+		if (i) {
+			struct stat st;
+			CHECK(0 == stat(name, &st) && st.st_size >= 1024 * 1024, "%s is smaller than maxSize", name);
+		}
+		prevLast = last;
+		total += n;
+	}
+	snprintf(name, sizeof(name), "%s.%d", fileName, BACKUPS + 1);
+	CHECK(0 != access(name, F_OK), "%s should have been removed", name);
+	CHECK(LINES - 1 == prevLast, "last seq %ld", prevLast);
+	for (long i = LINES - total; i < LINES; i++) {
+		if (1 != seen[i]) {
+			CHECK(0, "seq %ld seen %d times", i, seen[i]);
+			break;
+		}
+	}
+	free(seen);
+
+	checkRmDir(dir);
+
+	return checkDone("size_roll");
+}